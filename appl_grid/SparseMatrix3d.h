@@ -27,9 +27,12 @@ public:
 
   // constructors and destructor
 
+  // if empty, no elements are allocated until they are filled, so 
+  // the memory needed only grows with the occupied rows - otherwise 
+  // the full grid is allocated and the fast fill is available
   SparseMatrix3d( int Nx, double lx, double ux, 
 		  int Ny, double ly, double uy, 
-		  int Nz, double lz, double uz);
+		  int Nz, double lz, double uz, bool empty=false);
 
   SparseMatrix3d(const SparseMatrix3d& s); 
   
@@ -42,6 +45,13 @@ public:
 
   TH3D* getTH3D(const std::string& s) const; 
 
+  // the same in two steps - an empty histogram with the grid axes, 
+  // and filling it, which only touches the histogram itself, so can 
+  // be done away from the thread that created it. Returns the number 
+  // of bins filled
+  TH3D* newTH3D(const std::string& s) const; 
+  int   fillTH3D(TH3D* h) const; 
+
   // axis accessors
   const axis<double>& xaxis() const { return m_xaxis; } 
   const axis<double>& yaxis() const { return m_yaxis; } 
@@ -50,29 +60,24 @@ public:
 
   // trim to sparse structure 
   void trim() { empty_fast(); sparse3d::trim(); }
+
+  // remove all the elements, keeping the axes
+  void clear() { empty_fast(); sparse3d::clear(); }
+
+  // inflate to the full grid, which allows the fast fill again
+  void untrim() { sparse3d::untrim(); setup_fast(); }
     
-  // set up fast lookup table into the (untrimmed) 3d array.
-  void setup_fast() { 
-    m_fastindex = new double*[Nx()*Ny()*Nz()];
-
-    for ( int i=0 ; i<Nx() ; i++ ) { 
-      for ( int j=0 ; j<Ny() ; j++ ) { 
-	for ( int k=0 ; k<Nz() ; k++ ) { 
-	  m_fastindex[(i*Ny()+j)*Nz()+k] = &(m_v[i]->v()[j])->v()[k];
-	}
-      }
-    }
-  }
+  // set up fast lookup into the (untrimmed) 3d array - only 
+  // possible if the full grid is allocated, since then all 
+  // the elements are stored in order, and never move
+  void setup_fast() { m_fastindex = dense(); }
   
   // and clean up
-  void empty_fast() { 
-    if ( m_fastindex ) delete[] m_fastindex;
-    m_fastindex = NULL;
-  }
+  void empty_fast() { m_fastindex = NULL; }
 
   // access using the fast (dangerous) methods
-  double& fill_fast(int i, int j, int k)       { return *m_fastindex[(i*Ny()+j)*Nz()+k]; }
-  double  fill_fast(int i, int j, int k) const { return *m_fastindex[(i*Ny()+j)*Nz()+k]; }
+  double& fill_fast(int i, int j, int k)       { return m_fastindex[(i*Ny()+j)*Nz()+k]; }
+  double  fill_fast(int i, int j, int k) const { return m_fastindex[(i*Ny()+j)*Nz()+k]; }
 
   void fill(double x, double y, double z, double w) { 
 
@@ -146,7 +151,7 @@ private:
   axis<double> m_yaxis;
   axis<double> m_zaxis;
   
-  double** m_fastindex;
+  double* m_fastindex;
 
 };
 
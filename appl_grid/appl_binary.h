@@ -0,0 +1,158 @@
+// emacs: this is -*- c++ -*-
+//
+//   @file    appl_binary.h
+//            reading and writing the native binary grid files
+//
+//            the file is a short header, followed by a sequence of
+//            records, each starting on an 8 byte boundary - integers
+//            and doubles are single 8 byte records, strings and arrays
+//            are an 8 byte count followed by the elements, padded to
+//            the next 8 byte boundary
+//
+//            the file is read through a read only memory map, so the
+//            arrays can be used in place, aligned for their type,
+//            without being copied - the map is released when the
+//            binaryfile is deleted, so anything using the arrays in
+//            place must not outlive it
+//
+//            the records are in the byte order of the machine that
+//            wrote the file, files with the other byte order are
+//            rejected
+//
+//   Created: Sat 17 Oct 2026
+
+
+#ifndef  APPL_BINARY_H
+#define  APPL_BINARY_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+
+
+namespace appl {
+
+
+class binaryfile {
+
+public:
+
+  // file error exception
+  class exception : public std::exception {
+  public:
+    exception(const std::string& s) { std::cerr << what() << " " << s << std::endl; };
+    virtual const char* what() const throw() { return "appl::binaryfile::exception"; }
+  };
+
+public:
+
+  binaryfile(const std::string& filename);
+
+  ~binaryfile();
+
+  // does the file start with the native header
+  static bool detect(const std::string& filename);
+
+  int         readint();
+  double      readdouble();
+  std::string readstring();
+
+  // the next array, used in place in the memory map, with its length in n
+  template<typename T>
+  const T* readarray(size_t& n) {
+    n = readcount();
+    return (const T*)readbytes( n*sizeof(T) );
+  }
+
+  // the next array copied into a vector
+  template<typename T>
+  std::vector<T> readvector() {
+    size_t n;
+    const T* v = readarray<T>(n);
+    return std::vector<T>( v, v+n );
+  }
+
+  size_t size() const { return m_size; }
+
+private:
+
+  size_t      readcount();
+  const char* readbytes(size_t n);
+
+private:
+
+  std::string m_filename;
+
+  const char* m_data;
+  size_t      m_size;
+  size_t      m_pos;
+
+};
+
+
+
+class binarywriter {
+
+public:
+
+  binarywriter(const std::string& filename);
+
+  ~binarywriter();
+
+  void writeint(int i);
+  void writedouble(double d);
+  void writestring(const std::string& s);
+
+  template<typename T>
+  void writearray(const T* v, size_t n) {
+    writecount(n);
+    writebytes( (const char*)v, n*sizeof(T) );
+  }
+
+  template<typename T>
+  void writevector(const std::vector<T>& v) {
+    writearray( v.size() ? &v[0] : (const T*)NULL, v.size() );
+  }
+
+  // the start of an array whose elements are written separately with
+  // append(), for arrays that are never held in memory all at once -
+  // the array is finished, and padded, by finish()
+  void startarray(size_t n) { writecount(n); }
+
+  template<typename T>
+  void append(const T* v, size_t n) {
+    if ( n && std::fwrite( v, sizeof(T), n, m_file )!=n ) m_good = false;
+    m_pos += n*sizeof(T);
+  }
+
+  void finish() { pad(); }
+
+  // close the file, so that any error in flushing the buffered records 
+  // is seen by good() - called by the destructor if not called before
+  void close();
+
+  bool good() const { return m_good; }
+
+private:
+
+  void writecount(size_t n);
+  void writebytes(const char* v, size_t n);
+  void pad();
+
+private:
+
+  std::string m_filename;
+
+  std::FILE*  m_file;
+  size_t      m_pos;
+  bool        m_good;
+
+};
+
+
+}
+
+
+#endif  // APPL_BINARY_H
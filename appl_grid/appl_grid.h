@@ -27,6 +27,7 @@
 #include <iostream>
 #include <cmath>
 #include <string>
+#include <utility>
 #include <exception>
 
 #include "TH1D.h"
@@ -37,7 +38,17 @@ double _fx(double y);
 double _fun(double y);
 
 
+/// forward declaration of the pdf node cache - full definition 
+/// in Cache.h included from appl_grid.cxx
+template<typename T> class Cache;
+typedef Cache<std::pair<double,double> > NodeCache;
+
+/// forward declaration of the root file, only used for reading
+class TFile;
+
+
 #include "correction.h"
+#include "appl_grid/appl_memory.h"
 
 namespace appl { 
 
@@ -46,11 +57,25 @@ namespace appl {
 /// from appl_grid.cxx 
 class igrid;
 class appl_pdf;
+class threadpool;
+class nodetables;
+class binaryfile;
 
 
 const int MAXGRIDS = 5;
 
 
+/// the derivatives of a cross section with respect to the values 
+/// x*f(x,Q) returned by the pdf routine at a single grid node for 
+/// one of the beams
+struct pdfnode { 
+  int    beam;     /// 0 or 1
+  double x;
+  double Q;
+  double d[14];
+};
+
+
 /// externally visible grid class
 class grid {
 
@@ -66,6 +91,19 @@ public:
 
   typedef enum { STANDARD=0, AMCATNLO=1, SHERPA=2, LAST_TYPE=3 } CALCULATION; 
 
+  // storage for the weights of the compiled grids - single precision, or 
+  // 16 bit integers scaled to the largest weight at each node 
+  typedef enum { DOUBLE=0, SINGLE=1, SCALED16=2 } PRECISION; 
+
+  // the grid file formats - the ROOT file, or the native binary file 
+  // that is read through a memory map, so the trimmed weights are used 
+  // in place rather than being copied when the grid is read, or a ROOT 
+  // file with the weights stored as their occupied ranges and values 
+  // rather than as a full histogram for each subprocess, which can be 
+  // written with only a fixed amount of memory beyond the grid itself, 
+  // but can only be read by this version onwards
+  typedef enum { ROOTFILE=0, NATIVE=1, ROOTSPARSE=2 } FORMAT; 
+
 public:
 
   grid(int NQ2=50,  double Q2min=10000.0, double Q2max=25000000.0,  int Q2order=5,  
@@ -98,8 +136,17 @@ public:
   // copy constructor
   grid(const grid& g);
 
-  // read from a file
-  grid(const std::string& filename="./grid.root", const std::string& dirname="grid");
+  // read from a file, either a ROOT file or a native binary file, 
+  // detected from the file itself - dirname is not used for native files. 
+  // If lazy, only the state and reference histograms are read from a ROOT 
+  // file, and the igrids for each bin are read when they are first needed, 
+  // or with prefetch() - native files are always read through a memory map
+  grid(const std::string& filename="./grid.root", const std::string& dirname="grid", bool lazy=false);
+
+  // read the igrids of a lazily read grid now, for all the bins or for 
+  // the bins from ilower to iupper, rather than when first needed
+  void prefetch() { load(); }
+  void prefetch(int ilower, int iupper);
 
   // add an igrid for a given bin and a given order 
   void add_igrid(int bin, int order, igrid* g);
@@ -133,6 +180,60 @@ public:
   // trim/untrim the grid to reduce memory footprint
   void trim();
   void untrim();
+
+  // compile the internal grids into flat lists of the non-zero 
+  // nodes for faster convolutions once the grid has been filled - 
+  // with a reduced precision, the largest deviation of any weight 
+  // relative to the largest weight at the same node is returned. 
+  // This is not the relative deviation of each weight, weights much 
+  // smaller than the largest at their node, eg below 1/65534 of it 
+  // for SCALED16, can lose all their precision, and become zero
+  double compile(PRECISION precision=DOUBLE);
+
+  // approximate the weights of the internal grids for each tau and 
+  // subprocess by a sum of rank 1 terms in y1 and y2, to the relative 
+  // tolerance for each slice, for faster approximate convolutions, 
+  // eg for pdf scans - the exact weights are still used for factorisation
+  // scale variations, returns the largest relative residual. All other 
+  // convolutions then use the approximation until unfactorise() is called, 
+  // or the grid is modified, eg by a fill
+  double factorise(double tolerance);
+
+  // discard the factorised weights, so the convolutions are exact again 
+  void   unfactorise();
+
+  // the largest rank, and largest relative residual, of the factorised 
+  // weights for any order and subprocess for the internal bin iobs
+  int    rank(int iobs) const;
+  double residual(int iobs) const;
+
+  // remove the weights of the internal grids with negligible contributions 
+  // to each bin for a reference pdf at the central scale - the smallest 
+  // contributions, from all the orders together, are removed as long as 
+  // their magnitudes sum to less than tolerance times the cross section 
+  // in the bin, then the grids are trimmed, returns the relative change 
+  // in the cross section for each internal bin. The bound holds for the 
+  // reference pdf, for other pdfs and scales the change is only expected 
+  // to be of a similar size 
+  std::vector<double> prune(void   (*pdf)(const double& , const double&, double* ), 
+			    double (*alphas)(const double& ), 
+			    double tolerance );
+
+  // store the weights for all the subprocesses at each node of the 
+  // internal grids together, for filling and for the convolution 
+  void interleave();
+  void deinterleave();
+
+  // fold the internal grids onto the x1<=x2 half, for symmetric beams, 
+  // mapping each subprocess to the one with the beams exchanged - the 
+  // convolution must then use the same pdf for both beams, returns 
+  // false if the pdf combination or the x1, x2 axes are not symmetric.
+  // Only the sum over the subprocesses is kept, so the convolutions for 
+  // single subprocesses, vconvolute_subproc(), convolute_subproc() and
+  // vconvolute_subprocs(), and the jacobian for each beam, 
+  // vconvolute_jacobian(), throw an exception for a folded grid
+  bool fold();
+  bool folded() const;
  
   // formatted output 
   std::ostream& print(std::ostream& s=std::cout) const;
@@ -190,7 +291,8 @@ public:
 
 
   // perform the convolution to a specified number of loops 
-  // for a single sub process, nloops=-1 gives the nlo part only
+  // for a single sub process, nloops=-1 gives the nlo part only, 
+  // not for folded grids
   std::vector<double> vconvolute_subproc(int subproc, 
 					 void   (*pdf)(const double& , const double&, double* ), 
 					 double (*alphas)(const double& ), 
@@ -228,6 +330,72 @@ public:
   } 
   
 
+  /// perform the convolution for all the sub processes at once, in a single 
+  /// pass over the grid, returning xsec[iobs][isubproc], each exactly as from
+  /// vconvolute_subproc() - only for standard, unfolded grids
+  std::vector<std::vector<double> > vconvolute_subprocs(void   (*pdf)(const double& , const double&, double* ), 
+							double (*alphas)(const double& ), 
+							int     nloops, 
+							double  rscale_factor=1, double Escale=1 ); 
+
+  /// the cross section split into the contributions with no, one and two 
+  /// incoming photons, returning xsec[iobs][nphotons] from a single pass 
+  /// over the grid - the three sum to the full convolution. The photon 
+  /// must be at index 13 of the 14 values filled by the pdf routine, ie 
+  /// LHAPDF code 7 offset by 6, after the 13 partons -6 to 6. Only for 
+  /// standard, non DIS, grids
+  std::vector<std::vector<double> > vconvolute_photons(void   (*pdf)(const double& , const double&, double* ), 
+						       double (*alphas)(const double& ), 
+						       int     nloops, 
+						       double  rscale_factor=1,
+						       double  fscale_factor=1,
+						       double  Escale=1 ); 
+
+
+  /// perform the convolution for several pdfs, eg all the members of a 
+  /// pdf set, in a single pass over the grid, returning the cross sections 
+  /// xsec[iobs][ipdf] for each bin and each pdf - only for standard grids. 
+  /// The weights are read, and the alpha_s tables built, only once for 
+  /// each 32 pdfs, but the generalised pdfs are still evaluated separately 
+  /// for each pdf at each node, so the saving is limited to the pass over 
+  /// the grid, not the pdf combinations. The node caches and pdf tables, a 
+  /// few MB for each pdf, are only held for 32 pdfs at a time, so the 
+  /// memory does not grow with the number of pdfs
+  std::vector<std::vector<double> > vconvolute(const std::vector<void (*)(const double& , const double&, double* )>& pdfs, 
+					       double (*alphas)(const double& ), 
+					       int     nloops, 
+					       double  rscale_factor=1,
+					       double  fscale_factor=1,
+					       double  Escale=1 );
+
+  /// perform the convolution, and also calculate the jacobian, ie the 
+  /// derivatives of the cross section in each bin with respect to the 
+  /// pdf values at each of the grid nodes for each beam, jacobian[iobs] 
+  /// being a list of the nodes with non-zero derivatives. As the 
+  /// convolution is bilinear in the pdfs, these are exact. Only for 
+  /// standard grids, and not with factorisation scale variation, nor 
+  /// for folded grids, since the derivatives for each beam are lost
+  std::vector<double> vconvolute_jacobian(std::vector<std::vector<pdfnode> >& jacobian, 
+					  void   (*pdf)(const double& , const double&, double* ), 
+					  double (*alphas)(const double& ), 
+					  int     nloops, 
+					  double  rscale_factor=1,
+					  double  Escale=1 );
+
+  /// perform the convolution for several (rscale_factor, fscale_factor) 
+  /// pairs, eg for a scale uncertainty band, in a single pass over the grid, 
+  /// returning the cross sections xsec[iobs][iscale] for each bin and each 
+  /// pair - only for standard grids
+  std::vector<std::vector<double> > vconvolute(void   (*pdf)(const double& , const double&, double* ), 
+					       double (*alphas)(const double& ), 
+					       int     nloops, 
+					       const std::vector<std::pair<double,double> >& scales, 
+					       double  Escale=1 );
+
+  /// the (rscale_factor, fscale_factor) pairs for the standard 7 or 9 
+  /// point scale variation, with factors of 0.5 and 2, central scale first
+  static std::vector<std::pair<double,double> > scaleVariations(int npoints=7);
+
   double vconvolute_bin( int bin, 
 			 void (*pdf)(const double& , const double&, double* ), 
 			 double (*alphas)(const double&) ); 
@@ -278,7 +446,8 @@ public:
 
 
   // perform the convolution to a specified number of loops 
-  // for a single sub process, nloops=-1 gives the nlo part only
+  // for a single sub process, nloops=-1 gives the nlo part only, 
+  // not for folded grids
   TH1D* convolute_subproc(int subproc, 
 			  void   (*pdf)(const double& , const double&, double* ), 
 			  double (*alphas)(const double& ), 
@@ -310,6 +479,77 @@ public:
   } 
 
 
+  /// set the number of threads used for the convolution of the 
+  /// different bins and orders - 1 for the serial convolution, 
+  /// 0 to use all the available cores. The results are identical 
+  /// to the serial convolution, but the pdf and alphas functions 
+  /// are still only called from the calling thread, and the pdf 
+  /// tables for all the igrids are held in memory at the same time
+  int setThreads(int n=0);
+  int getThreads() const { return m_threads; } 
+
+  /// set the number of threads used to build the igrids from the 
+  /// histograms when ROOT grid files are read, and to fill the 
+  /// histograms when they are written - 1, the default, for the 
+  /// serial reading and writing, 0 to use all the available cores. 
+  /// The file itself is only ever accessed from the calling thread, 
+  /// each thread handles the histogram for a single subprocess, and 
+  /// at most about 128 MB of histograms, or a single one if larger, 
+  /// are held in memory at the same time. The same for all grids, so 
+  /// it can be set before a grid is read
+  static int setIOThreads(int n=0);
+  static int getIOThreads() { return m_iothreads; } 
+
+
+  /// keep the pdf and alpha_s tables at the grid nodes between 
+  /// convolutions, so repeated convolutions with the same pdf, eg 
+  /// for each bin or subprocess in turn, only evaluate the pdf once.
+  /// The tables are identified only by the pdf and alphas routines, 
+  /// and the cache generation, so a new generation must be set with 
+  /// setCacheGeneration(), or the cache cleared with clearCache(), 
+  /// whenever these routines would return different values, eg for 
+  /// a new pdf set or member, otherwise the stale tables are used. 
+  /// Setting the generation to eg the member number keeps the tables 
+  /// for each member separately, so they can be reused on switching 
+  /// back. The least recently used tables are deleted after each 
+  /// convolution to keep the cache below setCacheSize(), 256 MB by 
+  /// default
+  void setCache(bool b=true);
+
+  /// use an external cache, eg to share the tables between grids 
+  /// with the same nodes, the grid does not take ownership  
+  void useCache(nodetables* tables);
+
+  nodetables* getCache() { return m_cache; } 
+
+  void clearCache();
+
+  void setCacheGeneration(unsigned long g);
+
+  /// the maximum size in bytes of the cached tables, 0 for no limit
+  void setCacheSize(size_t bytes);
+
+
+  /// set up the sums over each tau slice of each igrid, of the weights 
+  /// times the pdfs, for a fixed pdf and fscale_factor, so that the 
+  /// convolution for a different alpha_s, or rscale_factor, eg for an 
+  /// alpha_s scan, need only sum over the tau slices. As in vconvolute(), 
+  /// for nloops=0 the scales are varied together, so the partial sums 
+  /// are then for rscale_factor=fscale_factor. The partial sums must 
+  /// be set up again if the grid is changed, filled, or optimised
+  void setupPartialSums(void   (*pdf)(const double& , const double&, double* ), 
+			int     nloops, 
+			double  fscale_factor=1, 
+			double  Escale=1 );
+
+  /// the convolution from the partial sums, for nloops=0 the 
+  /// rscale_factor must be the fscale_factor from the setup
+  std::vector<double> vconvolute_partialsums(double (*alphas)(const double& ), 
+					     double rscale_factor=1 );
+
+  void clearPartialSums();
+
+
   // optimise the bin limits
   void optimise(bool force=false);
   void optimise(int NQ2, int Nx);
@@ -330,11 +570,12 @@ public:
 
   bool reweight(bool t=false); 
 
-  // access to internal grids if need be
-  const igrid* weightgrid(int iorder, int iobs) const { return m_grids[iorder][iobs]; }
+  // access to internal grids if need be, reading them first for a lazily read grid
+  const igrid* weightgrid(int iorder, int iobs) const { load(iobs); return m_grids[iorder][iobs]; }
   
-  // save grid to specified file
-  void Write(const std::string& filename, const std::string& dirname="grid", const std::string& pdfname="" );
+  // save grid to specified file, in either format
+  void Write(const std::string& filename, const std::string& dirname="grid", const std::string& pdfname="", 
+	     FORMAT format=ROOTFILE );
 
   // accessors for the observable after possible bin combination
   int    Nobs()               const { return m_obs_bins_combined->GetNbinsX(); }
@@ -422,6 +663,18 @@ public:
   // find the number of words used for storage
   int size() const; 
 
+  // memory accounting - the heap memory used by the whole grid, by the 
+  // internal grid for each order and bin, and by the weights for each 
+  // subprocess of an internal grid, and the peak transient memory, for 
+  // the pdf tables or histograms, of the last convolution, Write or read
+  appl::memory memory() const;
+  appl::memory memory(int iorder, int iobs) const;
+  appl::memory memory(int iorder, int iobs, int ip) const;
+  appl::memory peakmemory() const;
+
+  // print the memory for each order and bin
+  std::ostream& printmemory(std::ostream& s=std::cout) const;
+
   // get the cross sections
   double& crossSection()      { return m_total; } 
   double& crossSectionError() { return m_totalerror; } 
@@ -607,6 +860,62 @@ protected:
   void addpdf( const std::string& s, const std::vector<int>& combinations=std::vector<int>() );
 
   appl_pdf* genpdf(int i) { return m_genpdf[i]; }
+
+  /// a single igrid convolution contributing to the cross section in a bin
+  struct term;
+
+  /// the partial sums for each term of the convolution 
+  struct partialsums;
+
+  /// collect the igrid convolutions needed for each bin for the standard 
+  /// convolution, the terms for bin bins[i] are first_term[i] to 
+  /// first_term[i+1]-1 and should be summed in that order
+  void standard_terms( std::vector<term>& terms, 
+		       std::vector<int>& bins, std::vector<unsigned>& first_term, 
+		       std::string& label, 
+		       int nloops, double rscale_factor, double fscale_factor, double Escale );
+
+  /// calculate the igrid convolutions, in parallel if required
+  void convolute_terms( std::vector<term>& terms, 
+			NodeCache* pdf0, NodeCache* pdf1, double (*alphas)(const double& ) );
+
+  /// apply the corrections and combine the bins of a convoluted cross section
+  void correctAndCombine( std::vector<double>& hvec );
+
+  /// start the transient memory accounting for a new convolution, Write or read
+  void resettransient();
+
+  /// the state flags stored in the grid files, and setting them from a file
+  std::vector<double> state() const;
+  void setstate(const std::vector<double>& setup);
+
+  /// create the generic pdfs read from a file, with the stored 
+  /// combinations for each order, and set the ckm matrices 
+  void setupgenpdf( const std::vector<std::vector<int> >& combinations, 
+		    const std::vector<std::vector<double> >& ckm, 
+		    const std::vector<std::vector<double> >& ckm2 );
+
+  /// read from an open root file
+  void readroot(TFile* gridfilep, const std::string& filename, const std::string& dirname, bool lazy);
+
+  /// delete anything already read when reading fails
+  void readfailed();
+
+  /// read and write the native binary files
+  void readbinary(const std::string& filename);
+  void writebinary(const std::string& filename);
+
+  /// read the igrids of a lazily read grid that have not yet been read, 
+  /// for all the bins, for bin iobs, or for the bins ilower to iupper
+  void load() const { load( 0, Nobs_internal()-1 ); }
+  void load(int iobs) const { load( iobs, iobs ); }
+  void load(int ilower, int iupper) const;
+
+  /// sum the separate contributions, eg for each subprocess, from the terms 
+  /// for each bin and scale, correct and combine the bins for each contribution
+  std::vector<std::vector<double> > combine_parts( const std::vector<term>& terms, 
+						   const std::vector<int>& bins, const std::vector<unsigned>& first_term, 
+						   int Nparts, double scale );
   
 public: 
 
@@ -649,6 +958,8 @@ protected:
 
   static const std::string m_version;
 
+  static int m_iothreads;
+
   double m_cmsScale;
 
   double m_dynamicScale;
@@ -681,8 +992,32 @@ protected:
   int  m_subproc;
   int  m_bin;
 
+  /// threads for the convolution, and the pool, 
+  /// only created when needed
+  int         m_threads;
+  threadpool* m_threadpool;
+
+  /// persistent pdf and alpha_s node tables, if required
+  nodetables* m_cache;
+  bool        m_ownCache;
+
+  /// per tau partial sums, if required
+  partialsums* m_partialsums;
+
+  /// transient memory used by all the igrids together, for 
+  /// the convolutions that set up all their tables at once
+  appl::memory m_transient;
+
   std::vector<double> m_userdata;
 
+  /// the memory map of a native grid file, which must be kept until 
+  /// the igrids using the weights in place have been deleted
+  binaryfile* m_binaryfile;
+
+  /// the file for the igrids of a lazily read grid, closed once all are read
+  struct lazyfile;
+  lazyfile* m_lazyfile;
+
 };
 
 
@@ -33,6 +33,7 @@
 
 #include "appl_grid/Directory.h"
 #include "appl_grid/appl_pdf.h"
+#include "appl_grid/appl_memory.h"
 
 #include "SparseMatrix3d.h"
 
@@ -41,6 +42,10 @@
 namespace appl {
 
 class grid;
+class nodetables;
+class binaryfile;
+class binarywriter;
+struct pdfnode;
 
 
 
@@ -76,8 +81,16 @@ public:
 
   igrid(const igrid& g);
 
-  // read grid from stored file
-  igrid(TFile& f, const std::string& s);
+  // read grid from stored file - if deferred, the weight histograms 
+  // are not read, they are read one subprocess at a time later with 
+  // readhistogram() and the weights built from them by decode(), so 
+  // the building can be done away from the thread reading the file
+  igrid(TFile& f, const std::string& s, bool deferred=false);
+
+  // read grid from the next record of a native binary file - if mapped 
+  // the weights are used in place in the file until they are modified, 
+  // so the file must not be closed while the igrid still uses them
+  igrid(binaryfile& f, bool mapped=true);
 
   ~igrid();
 
@@ -87,6 +100,11 @@ public:
  
   // formatted print
   std::ostream&  print(std::ostream& s=std::cout) const {
+    if ( m_nodes ) { 
+      igrid g(*this);
+      g.deinterleave();
+      return g.print(s);
+    }
     header(std::cout);
     for ( int i=0 ; i<m_Nproc ; i++ ) { 
       s << "sub process " << i << std::endl; 
@@ -97,19 +115,120 @@ public:
   
   // return the number of words used for storage
   int size() const {
+    if ( m_nodes ) return m_nodes->size();
     int _size = 0;
     for ( int i=0 ; i<m_Nproc ; i++ ) _size += m_weight[i]->size();
     return _size;
   }
 
+  // the heap memory used by the grid in total, and by the weights for 
+  // subprocess ip alone, and the largest transient memory, for the pdf 
+  // tables or the histograms, used by the last convolution, write or read
+  appl::memory memory() const;
+  appl::memory memory(int ip) const;
+  appl::memory transient() const { return m_transient; }
+  void         resettransient()  { m_transient = appl::memory(); }
+
   // trim unfilled elements
-  void trim() { for ( int i=0 ; i<m_Nproc ; i++ )  m_weight[i]->trim(); }
+  void trim() { 
+    if ( m_nodes ) m_nodes->trim();
+    else for ( int i=0 ; i<m_Nproc ; i++ )  m_weight[i]->trim(); 
+  }
 
   // inflate unfilled elements
-  void untrim() { for ( int i=0 ; i<m_Nproc ; i++ ) m_weight[i]->untrim(); }
+  void untrim() { 
+    if ( m_nodes ) m_nodes->untrim();
+    else for ( int i=0 ; i<m_Nproc ; i++ ) m_weight[i]->untrim(); 
+  }
+
+  // compile the non-zero nodes into a flat list for the convolution, 
+  // the list is discarded as soon as the weights are modified again - 
+  // the weights in the list can be stored with a reduced precision, 
+  // see grid::PRECISION, the convolution still accumulates in double, 
+  // returns the largest deviation of any stored weight, relative to 
+  // the largest weight at the same node, not to the weight itself, so 
+  // the weights much smaller than the largest can be much less precise. 
+  // Any precision other than those of grid::PRECISION throws, and the 
+  // grid is left as it was
+  double compile(int precision=0);
+  void   uncompile();
+  bool   compiled() const  { return m_compiled; }
+  int    precision() const { return m_cprecision; }
+
+  // approximate the weights for each tau and subprocess by a sum of 
+  // outer products u(y1)v(y2), to a relative tolerance on the weights 
+  // for each slice, so the convolution costs rank*(Ny1+Ny2) rather 
+  // than Ny1*Ny2 - the factors are discarded along with the compiled 
+  // list, the exact weights are kept for the convolutions that cannot 
+  // be factorised, ie with factorisation scale variation or for the 
+  // photon contributions, returns the largest relative residual 
+  double factorise(double tolerance);
+  void   unfactorise();
+  bool   factorised() const { return m_factorised; }
+  double residual() const   { return m_fresidual; }
+  int    rank() const;
+
+  // the contributions alpha_s^lo_order*W_ip*H_ip of each non-zero weight 
+  // to the convolution with a reference pdf at the central scale - their 
+  // magnitudes are appended to c, and the convolution is returned - the 
+  // weights for subprocesses whose generalised pdf vanishes for the 
+  // reference pdf are skipped, since their contribution is unknown 
+  double contributions(NodeCache* pdf0, appl_pdf* genpdf, double (*alphas)(const double& ), 
+		       int lo_order, std::vector<double>& c);
+
+  // remove the weights whose contributions, as above, are smaller in 
+  // magnitude than threshold, then trim the grid - returns the sum of 
+  // the contributions removed, with the number of weights in Nremoved 
+  double prune(NodeCache* pdf0, appl_pdf* genpdf, double (*alphas)(const double& ), 
+	       int lo_order, double threshold, int& Nremoved);
+
+  // store the weights for all the subprocesses at each node together,
+  // so that filling or convolving a node reads or writes a single 
+  // contiguous vector - the separate subprocess grids are rebuilt 
+  // whenever they are needed, eg to write or optimise the grid
+  void interleave();
+  void deinterleave();
+  bool interleaved() const { return m_nodes!=NULL; }
 
   // write to the current root directory
   void write(const std::string& name);
+
+  // write to the current root directory with the weights for each 
+  // subprocess as their occupied ranges and their values, in chunks 
+  // of fixed size, rather than as a full histogram, so that only a 
+  // fixed amount of memory is needed beyond the grid itself - these 
+  // are read back by the usual constructor
+  void writesparse(const std::string& name);
+
+  // writing in separate steps for each subprocess, so the weights can 
+  // be encoded away from the thread writing the file, with only the 
+  // histograms in use held in memory: writesetup() writes the setup to 
+  // the current root directory, histogram() creates the empty weight 
+  // histogram for a subprocess, encode() fills it without any file 
+  // access, and writehistogram() writes it to the current directory 
+  // and deletes it. The separate subprocess grids are needed, so an 
+  // interleaved grid must be deinterleaved first. encode() for different
+  // subprocesses can run at the same time
+  void  writesetup() const;
+  TH3D* histogram(int ip);
+  void  encode(int ip, TH3D* h);
+  void  writehistogram(TH3D* h) const;
+
+  // reading in the same way, for a grid read with deferred set: the 
+  // subprocesses not yet decoded() have their histogram read by 
+  // readhistogram(), detached from the file, and their weights built 
+  // from it by decode(), without any file access - the histogram is 
+  // still deleted by the caller
+  bool  decoded(int ip) const { return m_weight[ip]!=NULL; }
+  TH3D* readhistogram(TFile& f, const std::string& s, int ip);
+  void  decode(int ip, TH3D* h);
+
+  // the memory for the histogram of the weights for a single subprocess
+  appl::memory histmemory() const;
+
+  // write as the next record of a native binary file, the weights 
+  // are written as they are stored, separately or interleaved
+  void write(binarywriter& w);
   
   // update grid with one set of event weights
   void fill(const double x1, const double x2, const double Q2, const double* weight);
@@ -120,8 +239,8 @@ public:
   void fill_index(const int ix1, const int ix2, const int iQ2, const double* weight);
 
   // get the sparse structure for easier access  
-  const SparseMatrix3d* weightgrid(int ip) { return m_weight[ip]; }
-  SparseMatrix3d**      weightgrid()       { return m_weight; } 
+  const SparseMatrix3d* weightgrid(int ip) { deinterleave(); return m_weight[ip]; }
+  SparseMatrix3d**      weightgrid()       { deinterleave(); uncompile(); return m_weight; } 
 
 
   // this section stores the available x<->y transforms.
@@ -290,6 +409,13 @@ public:
   bool   symmetrise(bool t=true)   { return m_symmetrise=t; }
   bool   isSymmetric() const       { return m_symmetrise; }
 
+  // move the weights below the x1=x2 diagonal onto the conjugate 
+  // subprocesses, with the beams exchanged, above it, so only half 
+  // the grid is stored - subsequent fills are folded in the same way, 
+  // returns false if the x1 and x2 axes are not identical
+  bool   fold(const std::vector<int>& conjugate);
+  bool   folded() const            { return m_folded; }
+
   bool   isOptimised() const       { return m_optimised; }
   bool   setOptimised(bool t=true) { return m_optimised=t; } 
 
@@ -329,8 +455,121 @@ public:
 		   double  fscale_factor=1,
 		   double Escale=1 );
   
+  // the separate stages of the convolution, so that the pdf tables 
+  // can be set up serially and the convolutions of the weights for  
+  // different igrids then run concurrently - convolute_setup() 
+  // returns false, and creates no tables, if the grid is empty
+  bool   convolute_setup(NodeCache* pdf0, 
+			 NodeCache* pdf1,
+			 double (*alphas)(const double& ), 
+			 int     nloop=0, 
+			 double  rscale_factor=1,
+			 double  fscale_factor=1,
+			 double Escale=1 );
+
+  // the same, but with the pdf and alpha_s tables shared between the 
+  // igrids through the nodetables 
+  bool   convolute_setup(nodetables& tables,
+			 NodeCache* pdf0, 
+			 NodeCache* pdf1,
+			 double (*alphas)(const double& ), 
+			 int     nloop=0, 
+			 double  rscale_factor=1,
+			 double  fscale_factor=1,
+			 double Escale=1 );
+
+  double convolute_weights(appl_pdf* genpdf, 
+			   int     lo_order=0,  
+			   int     nloop=0, 
+			   double  rscale_factor=1,
+			   double  fscale_factor=1 ) const;
+
+  // the convolution of the weights for each subprocess separately, 
+  // dsigma must have space for SubProcesses() values 
+  void   convolute_subprocs(appl_pdf* genpdf, 
+			    int     lo_order,  
+			    int     nloop, 
+			    double  rscale_factor, 
+			    double  fscale_factor, 
+			    double* dsigma ) const;
+
+  // the convolution of the weights separately for the parton pairs with 
+  // no, one and two incoming photons, dsigma must have space for 3 values 
+  void   convolute_photons(appl_pdf* genpdf, 
+			   int     lo_order,  
+			   int     nloop, 
+			   double  rscale_factor, 
+			   double  fscale_factor, 
+			   double* dsigma ) const;
+
+  void   convolute_cleanup() { deletepdftable(); }
+
+  // convolute with several pdfs, eg all the members of a pdf set, in 
+  // a single pass over the weights, returning the cross section for 
+  // each pdf - the generalised pdfs are still evaluated for each pdf 
+  // at each node, only the reading of the weights is shared. The pdf 
+  // tables for all the pdfs are held at the same time, so the caller 
+  // should only pass a bounded number of pdfs
+  std::vector<double> convolute(const std::vector<NodeCache*>& pdfs,
+				appl_pdf* genpdf, 
+				double (*alphas)(const double& ), 
+				int     lo_order=0,  
+				int     nloop=0, 
+				double  rscale_factor=1,
+				double  fscale_factor=1,
+				double  Escale=1 );
+
+  // convolute for several (rscale_factor, fscale_factor) pairs, eg for a 
+  // scale uncertainty band, in a single pass over the weights - the pdf 
+  // and splitting function tables are set up once for each different  
+  // fscale_factor, and the alpha_s tables for each different rscale_factor
+  std::vector<double> convolute(NodeCache* pdf0,
+				NodeCache* pdf1,
+				appl_pdf* genpdf, 
+				double (*alphas)(const double& ), 
+				int     lo_order,  
+				int     nloop, 
+				const std::vector<std::pair<double,double> >& scales,
+				double  Escale=1 );
 
   
+  // the convolution, as convolute(), but also the derivatives of the 
+  // cross section with respect to the pdf values x*f(x,Q) at each node, 
+  // only those nodes with a non-zero derivative are added to the nodes - 
+  // throws for a folded grid, where only the sum over the beams is kept
+  double jacobian(NodeCache* pdf0,
+		  NodeCache* pdf1,
+		  appl_pdf* genpdf, 
+		  double (*alphas)(const double& ), 
+		  int     lo_order,  
+		  int     nloop, 
+		  double  rscale_factor,
+		  double  fscale_factor,
+		  double  Escale,
+		  std::vector<pdfnode>& nodes );
+
+  // the sums over the nodes in each tau slice of the weights times the 
+  // generalised pdfs for a fixed pdf and fscale_factor - S0 for the born 
+  // term, and SF for the factorisation scale dependent term - so that 
+  // the convolution for any alpha_s and rscale_factor is then only a 
+  // sum over the tau slices
+  void   partialsums(NodeCache* pdf0,
+		     NodeCache* pdf1,
+		     appl_pdf* genpdf, 
+		     int     nloop, 
+		     double  fscale_factor,
+		     double  Escale,
+		     std::vector<double>& S0, 
+		     std::vector<double>& SF );
+
+  double convolute(const std::vector<double>& S0, 
+		   const std::vector<double>& SF, 
+		   double (*alphas)(const double& ), 
+		   int     lo_order,  
+		   int     nloop, 
+		   double  rscale_factor, 
+		   double  fscale_factor ) const;
+
   /// convolute method for amcatnlo grids
   double amc_convolute(NodeCache* pdf0,
 		       NodeCache* pdf1,
@@ -350,12 +589,21 @@ public:
   igrid& operator=(const igrid& g); 
   
   igrid& operator*=(const double& d) { 
+    uncompile();
+    if ( m_nodes ) (*m_nodes) *= d;
     for ( int ip=0 ; ip<m_Nproc ; ip++ ) if ( m_weight[ip] ) (*m_weight[ip]) *= d; 
     return *this;
   } 
 
   // should really check all the limits and *everything* is the same
   igrid& operator+=(const igrid& g) { 
+    if ( g.m_nodes ) { 
+      igrid _g(g);
+      _g.deinterleave();
+      return (*this) += _g;
+    }
+    deinterleave();
+    uncompile();
     for ( int ip=0 ; ip<m_Nproc ; ip++ ) {
       if ( m_weight[ip] && g.m_weight[ip] ) { 
 	//if ( (*m_weight[ip]) == (*g.m_weight[ip]) ) (*m_weight[ip]) += (*g.m_weight[ip]);
@@ -383,6 +631,13 @@ public:
 
 
   bool operator==(const igrid& g) const { 
+    if ( m_nodes || g.m_nodes ) { 
+      igrid a(*this);
+      igrid b(g);
+      a.deinterleave();
+      b.deinterleave();
+      return a==b;
+    }
     for ( int ip=0 ; ip<m_Nproc ; ip++ ) {
       if ( m_weight[ip] && g.m_weight[ip] ) { 
 	if ( (*m_weight[ip]) != (*g.m_weight[ip]) ) return false;
@@ -405,10 +660,101 @@ private:
   // internal common construct for the different types of constructor
   void construct();
 
+  // the setup parameters, as stored in the grid files, and setting 
+  // up the grid dimensions and flags from them when reading 
+  std::vector<double> parameters() const;
+  void setparameters(const std::vector<double>& setup);
+
   // cleanup
   void deleteweights();
   void deletepdftable();
 
+  // trim the grid if needed and check whether it is empty
+  bool emptygrid();
+
+  // the subprocess selected by the parent grid, or -1 for all
+  int  subproc() const;
+
+  // the weights for all the subprocesses at a node, either directly from 
+  // the interleaved nodes, or gathered into sig from the separate grids, 
+  // or NULL if they are all zero
+  const double* weights(int itau, int iy1, int iy2, double* sig) const { 
+    if ( m_nodes ) { 
+      const double* w = ((const tsparse3d<double>*)m_nodes)->node(itau,iy1,iy2);
+      if ( w ) for ( int ip=0 ; ip<m_Nproc ; ip++ ) if ( w[ip] ) return w;
+      return NULL;
+    }
+    bool nonzero = false;
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) {
+      if ( (sig[ip] = (*(const SparseMatrix3d*)m_weight[ip])(itau,iy1,iy2)) ) nonzero = true;
+    }
+    return ( nonzero ? sig : NULL );
+  }
+
+  // the weights for the compiled node inode, converted into sig 
+  // if they are stored with a reduced precision
+  const double* cweights(int inode, double* sig) const { 
+    if ( m_cprecision==1 ) { 
+      const float* w = &m_cweightf[inode*m_Nproc];
+      for ( int ip=0 ; ip<m_Nproc ; ip++ ) sig[ip] = w[ip];
+      return sig;
+    }
+    if ( m_cprecision==2 ) { 
+      const short* w = &m_cweight16[inode*m_Nproc];
+      const double scale = m_cscale[inode];
+      for ( int ip=0 ; ip<m_Nproc ; ip++ ) sig[ip] = w[ip]*scale;
+      return sig;
+    }
+    return &m_cweight[inode*m_Nproc];
+  }
+
+  // the set of tables, and scale factors, for one of the 
+  // convolutions in a single pass over the weights
+  struct pdftables { 
+    double*** fg1;
+    double*** fg2;
+    double*** fsplit1;
+    double*** fsplit2;
+    const double* alphas;
+    double rscale_factor;
+    double fscale_factor;
+    int    subproc;
+    int    photons;
+  };
+
+  // the memory for a set of pdf tables as filled by setuppdf(), with 
+  // the splitting function tables if split, or if shared, for the 
+  // views into the shared nodetables
+  appl::memory tablememory(bool split, bool shared) const;
+
+  // fill a new alpha_s table for the convolution 
+  double* alphastable( double (*alphas)(const double& ), double rscale_factor ) const;
+
+  // add the contribution from a single node to the convolution, if 
+  // evaluate is false the generalised pdfs in H, HA and HB are reused,
+  // if subproc is not -1 only that subprocess is included, and if photons 
+  // is not -1 only the parton pairs with that number of incoming photons, 
+  // with Hw as the scratch space for appl_pdf::evaluatePhotons()
+  void convolute_node( double& dsigma, const double* sig, double* H, double* HA, double* HB, double* Hw,
+		       bool evaluate, int subproc, int photons, appl_pdf* genpdf, 
+		       const double* fA,  const double* fB, 
+		       const double* fsA, const double* fsB, 
+		       int lo_order, int _nloop, double rscale_factor, double fscale_factor, 
+		       double _alphas, double alphaplus1 ) const;
+
+  // convolution of the weights with several sets of tables at once
+  void convolute_weights( appl_pdf* genpdf, int lo_order, int nloop, 
+			  int Ntables, const pdftables* tables, double* dsigma ) const;
+
+  // the same convolution using the factorised weights
+  void convolute_factors( appl_pdf* genpdf, int lo_order, int nloop, 
+			  int Ntables, const pdftables* tables, double* dsigma ) const;
+
+  // the loop over the weights for contributions() and prune(), once the 
+  // pdf tables are set up, removing weights only if c is NULL
+  double prunenodes( appl_pdf* genpdf, int lo_order, double threshold, 
+		     std::vector<double>* c, int& Nremoved );
+
   // interpolation section - inline and static internals for calculation of the 
   // interpolation for storing on the grid nodes 
 
@@ -548,11 +894,49 @@ private:
   bool   m_reweight;    // reweight the pdf?
   
   bool   m_symmetrise;   // symmetrise the grid or not 
+
+  // weights folded onto the x1<=x2 half of the grid, and the 
+  // subprocess with the beams exchanged for each subprocess
+  bool             m_folded;
+  std::vector<int> m_conjugate;
   bool   m_optimised;    // optimised?
 
   // the actual weight grids
   SparseMatrix3d**   m_weight;
 
+  // the weights for all the subprocesses at each node stored together, 
+  // when interleaved the separate grids are cleared, keeping only the axes
+  tsparse3d<double>* m_nodes;
+
+  // compiled list of the non-zero nodes, ordered as in the convolution 
+  // loop - the nodes for each tau are in m_ctau[itau] to m_ctau[itau+1]-1 
+  // with the weights for all the subprocesses for each node stored 
+  // contiguously in m_cweight
+  bool                m_compiled;
+  std::vector<int>    m_ctau;
+  std::vector<int>    m_cy1;
+  std::vector<int>    m_cy2;
+  std::vector<double> m_cweight;
+
+  // or, for the reduced precisions, in single precision in m_cweightf, 
+  // or as 16 bit integers in m_cweight16, scaled by m_cscale for each node
+  int                 m_cprecision;
+  std::vector<float>  m_cweightf;
+  std::vector<short>  m_cweight16;
+  std::vector<double> m_cscale;
+
+  // factorised weights - the rank 1 terms for slice itau*Nproc+ip are 
+  // m_fslice[slice] to m_fslice[slice+1]-1, covering n1 nodes in y1 
+  // from y1lo and n2 in y2 from y2lo, with m_fbox[4*slice] = { y1lo, n1,
+  // y2lo, n2 } - the factors u and v for each term are stored one after 
+  // the other in m_ffactor, starting from m_fbase[slice]
+  bool                m_factorised;
+  double              m_fresidual;
+  std::vector<int>    m_fslice;
+  std::vector<int>    m_fbox;
+  std::vector<int>    m_fbase;
+  std::vector<double> m_ffactor;
+
   // pdf value table for convolution 
   // (NB: doesn't need to be a class variable)
   double*** m_fg1; 
@@ -565,10 +949,16 @@ private:
   // alpha_s table
   double*   m_alphas;
 
+  // are the pdf and alpha_s tables views into shared nodetables
+  bool      m_sharedtables;
+
   // flag to emulate a 2d (Q2, x) grid of use the 
   // full 3d (Q2, x1, x2) grid
   bool m_DISgrid;
 
+  // largest transient memory of the last convolution, write or read
+  appl::memory m_transient;
+
 };
 
 };
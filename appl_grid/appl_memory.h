@@ -0,0 +1,64 @@
+// emacs: this is -*- c++ -*-
+//
+//   @file    appl_memory.h
+//            memory accounting for the grids - the number of bytes
+//            used, and the number of separate heap allocations they
+//            are held in, so that the memory needed for large sets
+//            of grids can be estimated
+//
+//            the sizes are the capacities actually allocated, not
+//            the number of elements in use, but do not include any
+//            overhead from the allocator itself
+//
+//   Created: Sat 17 Oct 2026
+
+
+#ifndef  APPL_MEMORY_H
+#define  APPL_MEMORY_H
+
+#include <iostream>
+#include <vector>
+#include <cstddef>
+
+
+namespace appl {
+
+
+struct memory {
+
+  memory(size_t b=0, size_t n=0) : bytes(b), allocations(n) { }
+
+  memory& operator+=(const memory& m) {
+    bytes       += m.bytes;
+    allocations += m.allocations;
+    return *this;
+  }
+
+  memory operator+(const memory& m) const { return memory(*this) += m; }
+
+  memory operator*(size_t n) const { return memory( bytes*n, allocations*n ); }
+
+  bool operator<(const memory& m) const { return bytes<m.bytes; }
+
+  size_t bytes;
+  size_t allocations;
+
+};
+
+
+/// the heap memory held by a vector
+template<typename T>
+memory vectormemory(const std::vector<T>& v) {
+  return memory( v.capacity()*sizeof(T), v.capacity() ? 1 : 0 );
+}
+
+
+}
+
+
+inline std::ostream& operator<<(std::ostream& s, const appl::memory& m) {
+  return s << m.bytes << " bytes in " << m.allocations << " allocations";
+}
+
+
+#endif  // APPL_MEMORY_H
@@ -0,0 +1,144 @@
+// emacs: this is -*- c++ -*-
+//
+//   @file    appl_nodetables.h
+//            pdf and alpha_s tables at the grid nodes shared between
+//            all the igrids for a convolution
+//
+//            the tables for an igrid are a product of the Q values for
+//            its tau nodes, and the x values for its y nodes, and are
+//            kept in a map keyed by those nodes, so the igrids with the
+//            same nodes, eg all those of an unoptimised grid, share a
+//            single table, found without searching the other tables
+//
+//            the tables are identified by the pdf and alpha_s routines,
+//            and a generation token, so can be kept between convolutions,
+//            and shared between grids, but a different generation must be
+//            set, or the tables cleared, when the pdf or alpha_s routines
+//            would return different values, eg for a different member of
+//            a pdf set
+//
+//            the tables used since the last mark() can be kept, and all
+//            the others deleted with sweep(), so that a serial
+//            convolution need only hold the tables for the igrids being
+//            convoluted, or the least recently used deleted with evict(),
+//            so that the tables kept between convolutions are limited to
+//            a maximum size
+//
+//   Created: Sat 17 Oct 2026
+
+
+#ifndef  APPL_NODETABLES_H
+#define  APPL_NODETABLES_H
+
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "appl_grid/appl_memory.h"
+
+template<typename T> class Cache;
+typedef Cache<std::pair<double,double> > NodeCache;
+
+
+namespace appl {
+
+
+class nodetables {
+
+public:
+
+  nodetables(size_t maxbytes=256*1024*1024) : m_generation(0), m_stamp(0), m_maxbytes(maxbytes) { }
+
+  virtual ~nodetables() { clear(); }
+
+  /// the pdf table for the nodes at Q[i] and x[j] evaluated at the
+  /// scale fscale_factor*Q, with x scaled by beam_scale, and weighted
+  /// as in the igrid, if reweight is set - returns a pointer to the 14
+  /// values at Q[0], x[0], with the values for Q[i], x[j] at
+  /// table+(i*stride+j)*14
+  double* pdftable( NodeCache* pdf,
+		    const std::vector<double>& Q, const std::vector<double>& x,
+		    double fscale_factor, double beam_scale, bool reweight,
+		    int& stride );
+
+  /// the alpha_s/2pi table for the Q values at the scale rscale_factor*Q
+  double* alphastable( double (*alphas)(const double& ),
+		       const std::vector<double>& Q, double rscale_factor );
+
+  /// mark() starts a new set of tables in use, and sweep() deletes 
+  /// all the tables that have not been used since the last mark()
+  void mark() { m_stamp++; }
+  void sweep();
+
+  /// delete the least recently used tables, other than those used 
+  /// since the last mark(), until no more than maxbytes are held
+  void evict();
+
+  /// the maximum size of the tables kept by evict(), 0 for no limit 
+  size_t maxbytes() const { return m_maxbytes; } 
+  size_t maxbytes(size_t b) { return m_maxbytes=b; } 
+
+  /// delete all the tables
+  void clear();
+
+  /// the generation token for the pdf and alpha_s - tables are only 
+  /// found for the current generation, so those for the others, eg 
+  /// for the other members of a pdf set, are kept, until evicted, and 
+  /// can be reused if that generation is set again
+  unsigned long generation() const { return m_generation; }
+  unsigned long generation(unsigned long g) { return m_generation=g; }
+
+  /// number of tables and total number of pdf nodes
+  unsigned size()  const { return m_pdftables.size(); }
+  unsigned nodes() const;
+
+  /// memory held by all the tables
+  appl::memory memory() const;
+
+private:
+
+  /// copying would need the views to be remapped
+  nodetables(const nodetables& );
+  nodetables& operator=(const nodetables& );
+
+  /// the parameters a table was filled for
+  struct key {
+    void              (*pdf)(const double& , const double&, double* );
+    double            (*alphas)(const double& );
+    unsigned long       generation;
+    double              scale_factor;
+    double              beam_scale;
+    bool                reweight;
+    std::vector<double> Q;
+    std::vector<double> x;
+    bool operator<(const key& k) const;
+  };
+
+  /// a single table, and when it was last used
+  struct table {
+    std::vector<double> values;
+    unsigned long       stamp;
+  };
+
+  typedef std::map<key,table*> tablemap;
+
+  static appl::memory memory(const tablemap::value_type& entry);
+  static appl::memory memory(const tablemap& tables);
+
+private:
+
+  tablemap            m_pdftables;
+  tablemap            m_alphastables;
+
+  unsigned long       m_generation;
+  unsigned long       m_stamp;
+
+  size_t              m_maxbytes;
+
+};
+
+
+}
+
+
+#endif  // APPL_NODETABLES_H
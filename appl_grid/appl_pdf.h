@@ -79,8 +79,44 @@ public:
 
   virtual void evaluate(const double* fA, const double* fB, double* H) = 0; 
 
+  /// evaluate only the parton pairs with nphotons (0, 1 or 2) incoming photons, 
+  /// the photon being at index 13 of fA and fB, LHAPDF code 7 offset by 6 - 
+  /// by default from the full evaluate() with the photon, or all but the 
+  /// photon, masked off, which for a single photon needs two evaluate() 
+  /// calls, the second into work, which must hold Nproc() values
+  virtual void evaluatePhotons(const double* fA, const double* fB, double* H, int nphotons, double* work); 
+
   virtual int decideSubProcess( const int , const int  ) const;
 
+  /// find for each subprocess i the subprocess conj[i] with the beams 
+  /// exchanged, ie with H[i](fB,fA) = H[conj[i]](fA,fB) for any fA, fB, 
+  /// returns false if there is not one for every subprocess
+  bool conjugates( std::vector<int>& conj ); 
+
+  /// the generalised pdfs are bilinear in the pdfs for the two beams, so
+  /// are given by the coefficient of each pair of partons ia*14+ib in each 
+  /// subprocess, found from evaluate() with unit pdfs, and the partons 
+  /// from each beam that are used in each subprocess
+  struct bilinear { 
+    std::vector<std::vector<int> >    pairs;
+    std::vector<std::vector<double> > coefficients;
+    std::vector<std::vector<int> >    partonsA;
+    std::vector<std::vector<int> >    partonsB;
+  };
+
+  /// find the coefficients for the current ckm matrices 
+  void coefficients( bilinear& b ); 
+
+  /// find and keep the coefficients, eg before a factorised convolution, 
+  /// they are then updated whenever the ckm matrices are set - not thread 
+  /// safe, so must not be called during a convolution  
+  void setupcoefficients() { coefficients( m_bilinear ); }
+
+  /// the kept coefficients, or NULL if they have not been set up 
+  const bilinear* coefficients() const { 
+    return ( m_Nproc>0 && m_bilinear.pairs.size()==unsigned(m_Nproc) ? &m_bilinear : 0 );
+  } 
+
   std::string   name() const { return m_name;  }
 
   int     Nproc() const { return m_Nproc; } 
@@ -176,6 +212,9 @@ protected:
   /// some strings for more useful name if required
   std::vector<std::string>           m_names;
 
+  /// the coefficients for the pairs of partons, if set up
+  bilinear                           m_bilinear;
+
   static pdfmap                     __pdfmap;
   static std::vector<std::string>   __pdfpath;
 };
@@ -0,0 +1,136 @@
+// emacs: this is -*- c++ -*-
+//
+//   @file    appl_threadpool.h
+//            a small, persistent pthreads pool with work stealing
+//            so that a set of independent tasks of very different
+//            sizes can be spread evenly across the threads
+//
+//            each thread owns a queue of tasks, and takes tasks from
+//            the front of its own queue, and when that is empty, steals
+//            tasks from the back of the queues of the other threads.
+//            The calling thread also takes part in the processing
+//
+//   Created: Sat 17 Oct 2026
+
+
+#ifndef  APPL_THREADPOOL_H
+#define  APPL_THREADPOOL_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <exception>
+#include <pthread.h>
+
+
+namespace appl {
+
+
+class threadpool {
+
+public:
+
+  /// a single unit of work
+  class task {
+  public:
+    virtual ~task() { }
+    virtual void run() = 0;
+  };
+
+  /// thrown by run() for a failed task, only when the exception 
+  /// from the task itself cannot be rethrown
+  class exception : public std::exception { 
+  public:
+    exception(const std::string& s) { std::cerr << what() << " " << s << std::endl; }; 
+    virtual const char* what() const throw() { return "appl::threadpool::exception"; }
+  };
+
+public:
+
+  /// nthreads is the total number of threads including the
+  /// calling thread, so nthreads-1 worker threads are started
+  threadpool(int nthreads);
+
+  virtual ~threadpool();
+
+  int threads() const { return m_queues.size(); }
+
+  /// run all the tasks, only returning when all have completed - if 
+  /// any task throws, the tasks not yet started are skipped, and once 
+  /// all the threads have finished, the first exception is rethrown 
+  /// on the calling thread
+  void run(const std::vector<task*>& tasks);
+
+  /// number of available cores
+  static int cores();
+
+private:
+
+  /// copying a pool makes no sense
+  threadpool(const threadpool& );
+  threadpool& operator=(const threadpool& );
+
+  /// the per thread task queue
+  struct queue {
+    queue()  { pthread_mutex_init(&lock, 0); }
+    ~queue() { pthread_mutex_destroy(&lock); }
+    pthread_mutex_t   lock;
+    std::deque<task*> tasks;
+  };
+
+  /// get the next task for thread i, own queue first, then steal
+  task* next(int i);
+
+  /// process tasks until there are none left
+  void work(int i);
+
+  /// keep the exception being handled, if it is the first
+  void fail();
+
+  /// rethrow the exception kept by fail(), if any
+  void rethrow();
+
+  /// worker thread main loop
+  void worker(int i);
+
+  static void* start(void* arg);
+
+private:
+
+  std::vector<queue*>    m_queues;
+  std::vector<pthread_t> m_threads;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t  m_start;
+  pthread_cond_t  m_done;
+
+  /// incremented for each call to run() so the workers know
+  /// there is new work
+  unsigned long m_generation;
+
+  /// tasks not yet completed
+  int  m_pending;
+
+  /// worker threads still starting up
+  int  m_starting;
+
+  bool m_stop;
+
+  /// a task has thrown during this run()
+  bool m_failed;
+
+  /// the first exception thrown, as it was thrown if it can be 
+  /// kept, otherwise only its description
+#if __cplusplus >= 201103L
+  std::exception_ptr m_exception;
+#endif
+  std::string        m_message;
+
+};
+
+
+}
+
+
+#endif  // APPL_THREADPOOL_H
@@ -117,6 +117,18 @@ extern "C" void setckm_( const int& id, const double* ckm );
 /// get the ckm matrix - a flat vector of 9 doubles, Vud, Vus, Vub, Vcd ...
 extern "C" void getckm_( const int& id, double* ckm );
 
+/// keep the pdf node tables between convolutions for a grid, flag=0 to disable
+extern "C" void setcache_( const int& id, const int& flag );
+
+/// set the pdf generation for the cached tables, the tables for each 
+/// generation are kept, so switching back to a generation reuses them
+extern "C" void setcachegeneration_( const int& id, const int& generation );
+
+/// the maximum size of the cached tables in MB, once the cache is enabled 
+/// with setcache_, the least recently used tables are deleted after each 
+/// convolution to stay below it, 0 for no limit, 256 MB by default
+extern "C" void setcachesize_( const int& id, const int& mbytes );
+
 
 /// print a grid
 extern "C" void printgrid_(const int& id);
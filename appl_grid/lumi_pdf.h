@@ -41,6 +41,10 @@ public:
 
   void evaluate(const double* _fA, const double* _fB, double* H);
 
+  /// evaluate only the pairs with nphotons incoming photons, from the 
+  /// separate combinations for each, so work is not needed
+  void evaluatePhotons(const double* _fA, const double* _fB, double* H, int nphotons, double* work=0);
+
   /// additional user defined functions to actually initialise 
   /// based on the input file
 
@@ -71,6 +75,9 @@ private:
 
   void create_lookup();
 
+  /// split the combinations by the number of incoming photons
+  void create_photons();
+
 private:
 
   /// this might eventually become a std::string encoding the grid
@@ -91,6 +98,9 @@ private:
   /// lookup table for decideSubprocess
   std::vector<std::vector<int> >  m_lookup;
 
+  /// the pairs from each combination with no, one and two photons
+  std::vector<combination> m_photons[3];
+
 };
 
 
@@ -13,8 +13,8 @@
 
 SparseMatrix3d::SparseMatrix3d( int Nx, double lx, double ux, 
 				int Ny, double ly, double uy, 
-				int Nz, double lz, double uz) :
-  sparse3d(Nx, Ny, Nz), 
+				int Nz, double lz, double uz, bool empty) :
+  sparse3d(Nx, Ny, Nz, 1, empty), 
   m_xaxis(Nx, lx, ux),
   m_yaxis(Ny, ly, uy),
   m_zaxis(Nz, lz, uz),
@@ -34,29 +34,28 @@ SparseMatrix3d::SparseMatrix3d(const SparseMatrix3d& s) :
 } 
 
  
+// the axes are taken directly from the histogram, and the trimmed 
+// storage is built straight from the histogram bins, without the 
+// full grid ever being allocated 
 SparseMatrix3d::SparseMatrix3d(const TH3D* h) : 
-  sparse3d( h->GetNbinsX(), h->GetNbinsY(), h->GetNbinsZ() ),
+  sparse3d( h->GetNbinsX(), h->GetNbinsY(), h->GetNbinsZ(), 1, true ),
   m_fastindex(NULL) {
+
+  const TAxis* ax = h->GetXaxis();
+  const TAxis* ay = h->GetYaxis();
+  const TAxis* az = h->GetZaxis();
   
-  TH1D* hx = (TH1D*)h->Project3D("x");
-  TH1D* hy = (TH1D*)h->Project3D("y");
-  TH1D* hz = (TH1D*)h->Project3D("z");
-  
-  m_xaxis = axis<double>(hx->GetNbinsX(), hx->GetBinCenter(1),  hx->GetBinCenter(hx->GetNbinsX() ) ); 
-  m_yaxis = axis<double>(hy->GetNbinsX(), hy->GetBinCenter(1),  hy->GetBinCenter(hy->GetNbinsX() ) ); 
-  m_zaxis = axis<double>(hz->GetNbinsX(), hz->GetBinCenter(1),  hz->GetBinCenter(hz->GetNbinsX() ) ); 
-  
-  delete hx;
-  delete hy;
-  delete hz;
-  
-  for ( int i=0 ; i<m_xaxis.N() ; i++ ) { 
-    for ( int j=0 ; j<m_yaxis.N() ; j++ ) { 
-      for ( int k=0 ; k<m_zaxis.N() ; k++ ) { 
-	(*this)(i,j,k) = h->GetBinContent(i+1,j+1,k+1);
-      }  
-    }  
-  }
+  m_xaxis = axis<double>(ax->GetNbins(), ax->GetBinCenter(1),  ax->GetBinCenter(ax->GetNbins()) ); 
+  m_yaxis = axis<double>(ay->GetNbins(), ay->GetBinCenter(1),  ay->GetBinCenter(ay->GetNbins()) ); 
+  m_zaxis = axis<double>(az->GetNbins(), az->GetBinCenter(1),  az->GetBinCenter(az->GetNbins()) ); 
+
+  /// the bins, including the underflow and overflow bins, are stored 
+  /// with x varying fastest, and bin (i+1,j+1,k+1) is element (i,j,k)
+  const int sy = h->GetNbinsX()+2;
+  const int sz = sy*(h->GetNbinsY()+2);
+
+  assign( h->GetArray()+1+sy+sz, 1, sy, sz );
+
   setup_fast();
 }
 
@@ -66,30 +65,21 @@ bool SparseMatrix3d::operator==(const SparseMatrix3d& s) const {
   /// first if the axes are different, cannot be the same
   if ( !compare_axes( s ) ) return false;
 
-  int nvalue = 0;
-
-  /// now do a deep comparison ...
-  for ( int i=0 ; i<m_xaxis.N() ; i++ ) { 
-    for ( int j=0 ; j<m_yaxis.N() ; j++ ) { 
-      for ( int k=0 ; k<m_zaxis.N() ; k++ ) { 
-
-	//	std::cout << i << " " << j << " " << k
-	//		  << " : " << (*this)(i,j,k) 
-	//		  << " " << s(i,j,k)  << "  : " << ((*this)(i,j,k)-s(i,j,k) ) << std::endl;
-
-	if ( (*this)(i,j,k) != s(i,j,k) ) return false;
-	if ( (*this)(i,j,k)!=0 ) nvalue++;
-      }  
-    }  
-  }
-
-  return true;
+  /// now do a deep comparison of the occupied elements
+  return sparse3d::operator==( s );
 }
 
 
 // utilities for file access and storage
 
 TH3D* SparseMatrix3d::getTH3D(const std::string& s) const { 
+  TH3D* h = newTH3D(s);
+  fillTH3D(h);
+  return h;
+}
+
+
+TH3D* SparseMatrix3d::newTH3D(const std::string& s) const { 
   
   double delx = xaxis().delta();
   double dely = yaxis().delta();
@@ -99,6 +89,12 @@ TH3D* SparseMatrix3d::getTH3D(const std::string& s) const {
 		   xaxis().N(),  xaxis().min()-0.5*delx, xaxis().max()+0.5*delx, 
 		   yaxis().N(),  yaxis().min()-0.5*dely, yaxis().max()+0.5*dely, 
 		   zaxis().N(),  zaxis().min()-0.5*delz, zaxis().max()+0.5*delz);
+
+  return h;
+}
+
+
+int SparseMatrix3d::fillTH3D(TH3D* h) const { 
   
   const SparseMatrix3d& sm = (*this);
   
@@ -108,24 +104,21 @@ TH3D* SparseMatrix3d::getTH3D(const std::string& s) const {
   //  print();
 
   for ( int i=lo() ; i<=hi() ; i++ ) { 
-    const sparse2d* s2d = sm[i]; 
-    if ( s2d==NULL ) continue;
-    for ( int j=s2d->lo() ; j<=s2d->hi() ; j++ ) { 
-      const sparse1d* s1d = (*s2d)[j];
-      if ( s1d==NULL ) continue;
-      for ( int k=s1d->lo() ; k<=s1d->hi() ; k++ ) {
+    for ( int j=sm.ylo(i) ; j<=sm.yhi(i) ; j++ ) { 
+      const double* v = sm.row(i,j);
+      for ( int k=sm.zlo(i,j) ; k<=sm.zhi(i,j) ; k++ ) {
 	N++;
-	// std::cout << "\tsm(" << i << "\t, " << j << "\t, " << k << ")=" << (*s1d)(k) << std::endl; 
+	// std::cout << "\tsm(" << i << "\t, " << j << "\t, " << k << ")=" << (*v) << std::endl; 
 	// h->SetBinContent(i+1, j+1, k+1, sm(i,j,k) );
-	h->SetBinContent(i+1, j+1, k+1, (*s1d)(k) );
+	h->SetBinContent(i+1, j+1, k+1, *v++ );
       }
     }
   }
   
-  //  std::cout << "SparseMatrix3d::getTH3D() s=" << s 
+  //  std::cout << "SparseMatrix3d::fillTH3D() s=" << h->GetName() 
   //       << "\tN=" << N << "\tfilled bins" << std::endl;
   
-  return h;
+  return N;
 }
 
 
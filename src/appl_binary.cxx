@@ -0,0 +1,183 @@
+//
+//   @file    appl_binary.cxx
+//
+//            reading and writing the native binary grid files
+//
+//   Created: Sat 17 Oct 2026
+
+
+#include <cstring>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "appl_grid/appl_binary.h"
+
+
+// the header - an 8 byte tag, the format version, and a known
+// value to check the byte order
+static const char     binarytag[8]  = { 'A', 'P', 'P', 'L', 'g', 'r', 'i', 'd' };
+static const int64_t  binaryversion = 1;
+static const uint64_t binaryorder   = 0x0102030405060708ULL;
+
+
+bool appl::binaryfile::detect(const std::string& filename) {
+  std::FILE* f = std::fopen( filename.c_str(), "rb" );
+  if ( f==NULL ) return false;
+  char tag[8];
+  bool native = ( std::fread( tag, 1, 8, f )==8 && std::memcmp( tag, binarytag, 8 )==0 );
+  std::fclose(f);
+  return native;
+}
+
+
+appl::binaryfile::binaryfile(const std::string& filename) :
+  m_filename(filename), m_data(NULL), m_size(0), m_pos(0)
+{
+  int fd = open( filename.c_str(), O_RDONLY );
+  if ( fd<0 ) throw exception( "cannot open file " + filename );
+
+  struct stat info;
+  if ( fstat( fd, &info ) ) {
+    close(fd);
+    throw exception( "cannot stat file " + filename );
+  }
+
+  m_size = info.st_size;
+
+  if ( m_size<24 ) {
+    close(fd);
+    throw exception( "file too short " + filename );
+  }
+
+  void* data = mmap( NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close(fd);
+  if ( data==MAP_FAILED ) throw exception( "cannot map file " + filename );
+
+  m_data = (const char*)data;
+
+  if ( std::memcmp( m_data, binarytag, 8 ) ) {
+    munmap( data, m_size );
+    throw exception( "not a native grid file " + filename );
+  }
+
+  m_pos = 8;
+
+  int64_t  version = *(const int64_t*)readbytes(8);
+  uint64_t order   = *(const uint64_t*)readbytes(8);
+
+  if ( order!=binaryorder ) {
+    munmap( data, m_size );
+    throw exception( "wrong byte order for file " + filename );
+  }
+
+  if ( version>binaryversion ) {
+    munmap( data, m_size );
+    throw exception( "unknown format version for file " + filename );
+  }
+}
+
+
+appl::binaryfile::~binaryfile() {
+  if ( m_data ) munmap( (void*)m_data, m_size );
+}
+
+
+const char* appl::binaryfile::readbytes(size_t n) {
+  // the records are padded to 8 bytes
+  size_t padded = (n+7) & ~size_t(7);
+  if ( padded<n || m_pos+padded>m_size || m_pos+padded<m_pos ) throw exception( "file truncated " + m_filename );
+  const char* p = m_data+m_pos;
+  m_pos += padded;
+  return p;
+}
+
+
+size_t appl::binaryfile::readcount() {
+  int64_t n = *(const int64_t*)readbytes(8);
+  if ( n<0 || uint64_t(n)>m_size ) throw exception( "file corrupted " + m_filename );
+  return n;
+}
+
+
+int appl::binaryfile::readint() {
+  return int( *(const int64_t*)readbytes(8) );
+}
+
+
+double appl::binaryfile::readdouble() {
+  return *(const double*)readbytes(8);
+}
+
+
+std::string appl::binaryfile::readstring() {
+  size_t n;
+  const char* s = readarray<char>(n);
+  return std::string( s, n );
+}
+
+
+
+
+appl::binarywriter::binarywriter(const std::string& filename) :
+  m_filename(filename), m_file(NULL), m_pos(0), m_good(true)
+{
+  m_file = std::fopen( filename.c_str(), "wb" );
+  if ( m_file==NULL ) {
+    m_good = false;
+    throw binaryfile::exception( "cannot write file " + filename );
+  }
+
+  writebytes( binarytag, 8 );
+  writebytes( (const char*)&binaryversion, 8 );
+  writebytes( (const char*)&binaryorder, 8 );
+}
+
+
+appl::binarywriter::~binarywriter() { close(); }
+
+
+void appl::binarywriter::close() {
+  if ( m_file && std::fclose(m_file) ) m_good = false;
+  m_file = NULL;
+}
+
+
+void appl::binarywriter::writebytes(const char* v, size_t n) {
+  if ( n && std::fwrite( v, 1, n, m_file )!=n ) m_good = false;
+  m_pos += n;
+  pad();
+}
+
+
+void appl::binarywriter::pad() {
+  static const char zero[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  size_t n = (8-(m_pos&7))&7;
+  if ( n && std::fwrite( zero, 1, n, m_file )!=n ) m_good = false;
+  m_pos += n;
+}
+
+
+void appl::binarywriter::writecount(size_t n) {
+  int64_t _n = n;
+  writebytes( (const char*)&_n, 8 );
+}
+
+
+void appl::binarywriter::writeint(int i) {
+  int64_t _i = i;
+  writebytes( (const char*)&_i, 8 );
+}
+
+
+void appl::binarywriter::writedouble(double d) {
+  writebytes( (const char*)&d, 8 );
+}
+
+
+void appl::binarywriter::writestring(const std::string& s) {
+  writearray( s.c_str(), s.size() );
+}
@@ -15,6 +15,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
@@ -27,6 +28,9 @@
 
 #include "appl_grid/generic_pdf.h"
 #include "appl_grid/lumi_pdf.h"
+#include "appl_grid/appl_threadpool.h"
+#include "appl_grid/appl_nodetables.h"
+#include "appl_grid/appl_binary.h"
 
 #include "appl_igrid.h"
 #include "Cache.h"
@@ -60,6 +64,8 @@ std::ostream& operator<<(std::ostream& s, const std::vector<T>& v) {
 // const std::string appl::grid::m_version = "version-3.3";
 const std::string appl::grid::m_version = PACKAGE_VERSION;
 
+int appl::grid::m_iothreads = 1;
+
 std::string appl::grid::appl_version() const { return PACKAGE_VERSION; }
 
 #include "hoppet_init.h"
@@ -79,6 +85,20 @@ void Splitting(const double& x, const double& Q, double* xf) {
   return;
 }
 
+// set up the hoppet evolution for the splitting functions for this pdf,  
+// if not already done
+static void setupSplitting(void (*pdf)(const double& , const double&, double* ), double cmsScale) { 
+  if ( hoppet == 0 ) { 
+    double Qmax = 15000;
+    if ( cmsScale>Qmax ) Qmax = cmsScale;
+    hoppet = new hoppet_init( Qmax );
+  } 
+  
+  bool newpdf = hoppet->compareCache( pdf );
+  
+  if ( newpdf ) hoppet->fillCache( pdf );
+}
+
 #else
 
 void Splitting(const double& x, const double& Q, double* xf) {
@@ -97,6 +117,269 @@ static bool contains(const std::string& s, const std::string& reg ) {
   return s.find(reg)!=std::string::npos;
 }
 
+
+/// a single igrid convolution contributing to the cross section in a bin
+struct appl::grid::term : public appl::threadpool::task { 
+
+  term( appl::igrid* g, appl::appl_pdf* genpdf, int lo_order, int nloop, 
+	double rscale_factor=1, double fscale_factor=1, double Escale=1 ) :
+    m_g(g), m_genpdf(genpdf), m_lo_order(lo_order), m_nloop(nloop), 
+    m_rscale_factor(rscale_factor), m_fscale_factor(fscale_factor), m_Escale(Escale), 
+    m_subprocs(false), m_photons(false), dsigma(0) 
+  { } 
+
+  /// the pdf tables must already have been set up
+  void run() { 
+    if      ( m_subprocs ) m_g->convolute_subprocs( m_genpdf, m_lo_order, m_nloop, m_rscale_factor, m_fscale_factor, &dparts[0] );
+    else if ( m_photons  ) m_g->convolute_photons(  m_genpdf, m_lo_order, m_nloop, m_rscale_factor, m_fscale_factor, &dparts[0] );
+    else      dsigma = m_g->convolute_weights( m_genpdf, m_lo_order, m_nloop, m_rscale_factor, m_fscale_factor ); 
+  }
+
+  appl::igrid*    m_g;
+  appl::appl_pdf* m_genpdf;
+  int             m_lo_order;
+  int             m_nloop;
+  double          m_rscale_factor;
+  double          m_fscale_factor;
+  double          m_Escale;
+
+  /// calculate each subprocess separately 
+  bool            m_subprocs;
+
+  /// calculate the contributions with no, one and two photons separately 
+  bool            m_photons;
+
+  double dsigma;
+
+  /// the separate contributions for each subprocess or number of photons 
+  std::vector<double> dparts;
+};
+
+
+/// the terms for the convolution, and their partial sums
+struct appl::grid::partialsums { 
+  int    nloops;
+  double fscale_factor;
+  double Escale;
+  std::vector<term>     terms;
+  std::vector<int>      bins;
+  std::vector<unsigned> first_term;
+  std::vector<std::vector<double> > S0;
+  std::vector<std::vector<double> > SF;
+};
+
+
+/// the open file for the igrids of a lazily read grid, the file bin 
+/// for each internal bin, since the bin range may since have changed,
+/// and the lock so that each igrid is read only once, by one thread
+struct appl::grid::lazyfile { 
+
+  lazyfile( TFile* f, const std::string& d, int Nobs, int order ) : 
+    file(f), dirname(d), bins(Nobs), unread(Nobs*order) { 
+    for ( int i=0 ; i<Nobs ; i++ ) bins[i] = i;
+    pthread_mutex_init(&lock, 0); 
+  }
+
+  ~lazyfile() { 
+    close();
+    pthread_mutex_destroy(&lock); 
+  }
+
+  /// the file is closed once all the igrids have been read
+  void close() { 
+    if ( file==0 ) return;
+    file->Close();
+    delete file;
+    file = 0;
+  }
+
+  TFile*           file;
+  std::string      dirname;
+  std::vector<int> bins;
+  int              unread;
+  pthread_mutex_t  lock;
+};
+
+
+/// a single subprocess of an igrid to build from, or fill into, its 
+/// weight histogram
+struct iotask : public appl::threadpool::task { 
+
+  iotask( appl::igrid* g=0, int ip=0, bool read=true ) : m_g(g), m_ip(ip), m_read(read), m_h(0) { } 
+
+  /// no file access, the histogram is created and deleted by the file thread
+  void run() { 
+    if ( m_read ) m_g->decode( m_ip, m_h );
+    else          m_g->encode( m_ip, m_h );
+  }
+
+  appl::igrid* m_g;
+  int          m_ip;
+  bool         m_read;
+  TH3D*        m_h;
+};
+
+
+/// the subprocess histograms are read and written a batch at a time, 
+/// with the batch limited by the memory for its histograms rather than 
+/// the number of igrids, since a single igrid with many subprocesses 
+/// can need far more than all the threads together need to keep busy
+static const size_t iobytes = 128*1024*1024;
+
+
+/// the end of the batch of tasks starting at k0, at least one task, 
+/// and otherwise as many as fit in iobytes
+static unsigned iobatch( const std::vector<iotask>& tasks, unsigned k0 ) { 
+  size_t bytes = 0;
+  unsigned k1 = k0;
+  while ( k1<tasks.size() ) { 
+    size_t b = tasks[k1].m_g->histmemory().bytes;
+    if ( k1>k0 && bytes+b>iobytes ) break;
+    bytes += b;
+    k1++;
+  }
+  return k1;
+}
+
+
+/// read the named igrids from the file - the file is only accessed from 
+/// the calling thread, and the grids are built from the histograms of 
+/// each batch of subprocesses on a pool of threads
+static std::vector<appl::igrid*> readigrids( TFile& f, const std::vector<std::string>& names, int nthreads ) { 
+
+  std::vector<appl::igrid*> grids;
+  grids.reserve( names.size() );
+
+  std::vector<iotask> items;
+
+  /// nothing partly read is returned, a bad igrid throws with 
+  /// all the igrids and histograms already read deleted
+  try { 
+
+    if ( nthreads<=1 || names.size()<2 ) { 
+      for ( unsigned i=0 ; i<names.size() ; i++ ) grids.push_back( new appl::igrid( f, names[i] ) );
+      return grids;
+    }
+
+    /// just the setup and any sparse weights, the histograms are read later
+    std::vector<unsigned> index;
+    for ( unsigned i=0 ; i<names.size() ; i++ ) { 
+      grids.push_back( new appl::igrid( f, names[i], true ) );
+      for ( int ip=0 ; ip<grids[i]->SubProcesses() ; ip++ ) { 
+	if ( grids[i]->decoded(ip) ) continue;
+	items.push_back( iotask( grids[i], ip, true ) );
+	index.push_back( i );
+      }
+    }
+
+    appl::threadpool pool( nthreads );
+
+    for ( unsigned k0=0 ; k0<items.size() ; ) { 
+
+      unsigned k1 = iobatch( items, k0 );
+
+      std::vector<appl::threadpool::task*> tasks;
+      for ( unsigned k=k0 ; k<k1 ; k++ ) { 
+	items[k].m_h = items[k].m_g->readhistogram( f, names[index[k]], items[k].m_ip );
+	tasks.push_back( &items[k] );
+      }
+
+      pool.run( tasks );
+
+      for ( unsigned k=k0 ; k<k1 ; k++ ) { 
+	delete items[k].m_h;
+	items[k].m_h = 0;
+      }
+
+      k0 = k1;
+    }
+  }
+  catch (...) { 
+    for ( unsigned k=0 ; k<items.size() ; k++ ) delete items[k].m_h;
+    for ( unsigned i=0 ; i<grids.size() ; i++ ) delete grids[i];
+    throw;
+  }
+
+  return grids;
+}
+
+
+/// write the igrids to the current directory - the histograms are created 
+/// and written from the calling thread, and filled on a pool of threads, 
+/// a batch of subprocesses at a time
+static void writeigrids( const std::vector<std::string>& names, const std::vector<appl::igrid*>& grids, int nthreads ) { 
+
+  if ( nthreads<=1 || names.size()<2 ) { 
+    for ( unsigned i=0 ; i<names.size() ; i++ ) grids[i]->write( names[i] );
+    return;
+  }
+
+  std::vector<iotask> items;
+  std::vector<unsigned> index;
+  for ( unsigned i=0 ; i<grids.size() ; i++ ) { 
+    for ( int ip=0 ; ip<grids[i]->SubProcesses() ; ip++ ) { 
+      items.push_back( iotask( grids[i], ip, false ) );
+      index.push_back( i );
+    }
+  }
+
+  appl::threadpool pool( nthreads );
+
+  /// the separate subprocess grids are needed for the histograms, and 
+  /// each igrid stays deinterleaved until its last histogram is written
+  std::vector<bool> interleaved( grids.size(), false );
+
+  /// the directory for the igrid being written, across batches 
+  Directory d;
+
+  /// if anything throws, the histograms not written are deleted, and 
+  /// the igrids and the current directory are left as they were
+  try { 
+
+    for ( unsigned k0=0 ; k0<items.size() ; ) { 
+
+      unsigned k1 = iobatch( items, k0 );
+
+      std::vector<appl::threadpool::task*> tasks;
+      for ( unsigned k=k0 ; k<k1 ; k++ ) { 
+	appl::igrid* g = items[k].m_g;
+	if ( items[k].m_ip==0 ) { 
+	  interleaved[index[k]] = g->interleaved();
+	  g->deinterleave();
+	}
+	items[k].m_h = g->histogram( items[k].m_ip );
+	tasks.push_back( &items[k] );
+      }
+
+      pool.run( tasks );
+
+      for ( unsigned k=k0 ; k<k1 ; k++ ) { 
+	appl::igrid* g = items[k].m_g;
+	if ( items[k].m_ip==0 ) { 
+	  d = Directory( names[index[k]] );
+	  d.push();
+	  g->writesetup();
+	}
+	g->writehistogram( items[k].m_h );
+	items[k].m_h = 0;
+	if ( items[k].m_ip==g->SubProcesses()-1 ) { 
+	  d.pop();
+	  if ( interleaved[index[k]] ) g->interleave();
+	}
+      }
+
+      k0 = k1;
+    }
+  }
+  catch (...) { 
+    for ( unsigned k=0 ; k<items.size() ; k++ ) delete items[k].m_h;
+    for ( unsigned i=0 ; i<grids.size() ; i++ ) if ( interleaved[i] && !grids[i]->interleaved() ) grids[i]->interleave();
+    d.pop();
+    throw;
+  }
+}
+
+
 /// make sure pdf std::map is initialised
 // bool pdf_ready = appl::appl_pdf::create_map(); 
 
@@ -115,7 +398,14 @@ appl::grid::grid(int NQ2, double Q2min, double Q2max, int Q2order,
   m_type(STANDARD),
   m_read(false),
   m_subproc(-1),
-  m_bin(-1)
+  m_bin(-1),
+  m_threads(1),
+  m_threadpool(0),
+  m_cache(0),
+  m_ownCache(false),
+  m_partialsums(0),
+  m_binaryfile(0),
+  m_lazyfile(0)
 {
   // Initialize histogram that saves the correspondence obsvalue<->obsbin
   m_obs_bins=new TH1D("referenceInternal","Bin-Info for Observable", Nobs, obsmin, obsmax);
@@ -151,7 +441,14 @@ appl::grid::grid(int Nobs, const double* obsbins,
   m_type(STANDARD),
   m_read(false),
   m_subproc(-1),
-  m_bin(-1)
+  m_bin(-1),
+  m_threads(1),
+  m_threadpool(0),
+  m_cache(0),
+  m_ownCache(false),
+  m_partialsums(0),
+  m_binaryfile(0),
+  m_lazyfile(0)
 {
   
   // Initialize histogram that saves the correspondence obsvalue<->obsbin
@@ -188,7 +485,14 @@ appl::grid::grid(const std::vector<double>& obs,
   m_type(STANDARD),
   m_read(false),
   m_subproc(-1),
-  m_bin(-1)
+  m_bin(-1),
+  m_threads(1),
+  m_threadpool(0),
+  m_cache(0),
+  m_ownCache(false),
+  m_partialsums(0),
+  m_binaryfile(0),
+  m_lazyfile(0)
 {
   
   if ( obs.size()==0 ) { 
@@ -231,7 +535,14 @@ appl::grid::grid(const std::vector<double>& obs,
   m_type(STANDARD),
   m_read(false),
   m_subproc(-1),
-  m_bin(-1)
+  m_bin(-1),
+  m_threads(1),
+  m_threadpool(0),
+  m_cache(0),
+  m_ownCache(false),
+  m_partialsums(0),
+  m_binaryfile(0),
+  m_lazyfile(0)
 { 
 
   if ( obs.size()==0 ) { 
@@ -263,7 +574,7 @@ appl::grid::grid(const std::vector<double>& obs,
 
 
 
-appl::grid::grid(const std::string& filename, const std::string& dirname)  :
+appl::grid::grid(const std::string& filename, const std::string& dirname, bool lazy)  :
   m_leading_order(0),  m_order(0),
   m_optimised(false),  m_trimmed(false), 
   m_normalised(false),
@@ -274,7 +585,14 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
   m_type(STANDARD),
   m_read(false),
   m_subproc(-1),
-  m_bin(-1)
+  m_bin(-1),
+  m_threads(1),
+  m_threadpool(0),
+  m_cache(0),
+  m_ownCache(false),
+  m_partialsums(0),
+  m_binaryfile(0),
+  m_lazyfile(0)
 {
   m_obs_bins_combined = m_obs_bins = 0;
 
@@ -285,6 +603,20 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
     throw exception(std::cerr << "grid::grid() cannot open file " << filename << std::endl ); 
   }
 
+  if ( binaryfile::detect( filename ) ) { 
+    /// the destructor is not called if reading fails, so anything 
+    /// already read must be deleted here 
+    for ( int iorder=0 ; iorder<MAXGRIDS ; iorder++ ) m_grids[iorder] = 0;
+    try { 
+      readbinary( filename );
+    }
+    catch (...) { 
+      readfailed();
+      throw;
+    }
+    return;
+  }
+
   std::cout << "appl::grid() reading grid from file " << filename;
   
   TFile* gridfilep = TFile::Open(filename.c_str());
@@ -300,6 +632,54 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
     throw exception(std::cerr << "grid::grid() cannot open file: zombie " << filename << std::endl ); 
   }
 
+  /// the destructor is not called if reading fails, so the file must 
+  /// be closed, and anything already read deleted, here
+  for ( int iorder=0 ; iorder<MAXGRIDS ; iorder++ ) m_grids[iorder] = 0;
+  try { 
+    readroot( gridfilep, filename, dirname, lazy );
+  }
+  catch (...) { 
+    readfailed();
+    delete gridfilep;
+    throw;
+  }
+
+  if ( lazy ) { 
+    /// keep the file open for the igrids, already trimmed when they are read
+    m_lazyfile = new lazyfile( gridfilep, dirname, Nobs_internal(), m_order );
+    m_trimmed  = true;
+    std::cout << "appl::grid() read grid header in " << appl_timer_stop( tstart ) << " ms, " 
+	      << m_order*Nobs_internal() << " igrids to read on demand" << std::endl;
+    return;
+  }
+
+  gridfilep->Close();
+  delete gridfilep;
+
+  double tstop = appl_timer_stop( tstart );
+
+  unsigned usize = size();
+
+  struct timeval tstart2 =  appl_timer_start();
+
+  trim();
+
+  double tstop2 = appl_timer_stop( tstart2 );
+
+  std::cout << "appl::grid() read grid, size ";
+  if ( usize>1024*10 ) std::cout << usize/1024/1024 << " MB";
+  else                 std::cout << usize/1024      << " kB";
+  std::cout << "\tin " << tstop << " ms";
+
+  std::cout << "\ttrim in " << tstop2 << " ms" << std::endl;
+
+}
+
+
+/// read the setup, the reference histograms and, unless lazy, the 
+/// igrids from an open root file
+void appl::grid::readroot(TFile* gridfilep, const std::string& filename, const std::string& dirname, bool lazy) { 
+
   // TFile gridfile(filename.c_str());
   
   //  gDirectory->cd(dirname.c_str());
@@ -360,25 +740,14 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
   // hmmm, have to use TVectorT<double> since TVector<int> 
   // apparently has no constructor (???)
   TVectorT<double>* setup=(TVectorT<double>*)gridfilep->Get((dirname+"/State").c_str());
- 
-  m_run        = (*setup)(0);
-  m_optimised  = ( (*setup)(1)!=0 ? true : false );
-  m_symmetrise = ( (*setup)(2)!=0 ? true : false );  
-
-  m_leading_order = int((*setup)(3)+0.5);  
-  m_order         = int((*setup)(4)+0.5);  
 
-  if ( setup->GetNoElements()>5 ) m_cmsScale = (*setup)(5);
-  else                            m_cmsScale = 0;
- 
-  if ( setup->GetNoElements()>6 ) m_normalised = ( (*setup)(6)!=0 ? true : false );
-  else                            m_normalised = true;
+  std::vector<double> _state( setup->GetNoElements() );
+  for ( unsigned i=0 ; i<_state.size() ; i++ ) _state[i] = (*setup)(i);
 
-  if ( setup->GetNoElements()>7 ) m_applyCorrections = ( (*setup)(7)!=0 ? true : false );
-  else                            m_applyCorrections = false;
+  setstate( _state );
 
   int n_userdata = 0;
-  if ( setup->GetNoElements()>10 ) n_userdata = int((*setup)(10)+0.5);
+  if ( _state.size()>10 ) n_userdata = int(_state[10]+0.5);
 
   //  std::vector<double> _ckmsum;
   std::vector<std::vector<double> > _ckm2;
@@ -388,7 +757,7 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
 
   /// check whether we need to read in the ckm matrices
 
-  if ( setup->GetNoElements()>8 && (*setup)(8)!=0 ) {
+  if ( _state.size()>8 && _state[8]!=0 ) {
 
     std::cout << "grid::grid() read ckm matrices" << std::endl;
     
@@ -423,9 +792,6 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
 
   }
 
-  if ( setup->GetNoElements()>9 ) m_type = (CALCULATION)int( (*setup)(9)+0.5 );
-  else                            m_type = STANDARD;
-
   //  std::cout << "appl::grid() reading grid calculation type: " << _calculation(m_type) << std::endl;
 
   //  std::cout << "appl::grid() normalised: " << getNormalised() << std::endl;
@@ -437,6 +803,8 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
   //  std::cout << "appl::grid() requested pdf combination " << m_genpdfname << std::endl;
   
 
+  std::vector<std::vector<int> > _combinations;
+
   if ( !added && contains(m_genpdfname, ".config") ) { 
     /// decode the pdf combination if appropriate
 
@@ -451,34 +819,20 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
       /// I ask you!! what's the point of a template if it doesn't actually instantiate
       /// it's pathetic!
 
-      TVectorT<double>* _combinations = (TVectorT<double>*)gridfilep->Get( label.c_str() );
+      TVectorT<double>* combinations = (TVectorT<double>*)gridfilep->Get( label.c_str() );
 
       label += "N"; /// add an N for each order, N-LO, NN-LO etc
 
-      if ( _combinations==0 ) throw exception(std::cerr << "grid::grid() cannot read pdf combination " << namevec[i] << std::endl );
-
-      std::vector<int> combinations(_combinations->GetNoElements());
+      if ( combinations==0 ) throw exception(std::cerr << "grid::grid() cannot read pdf combination " << namevec[i] << std::endl );
 
-      for ( unsigned ic=0 ; ic<combinations.size() ; ic++ )  combinations[ic] = int((*_combinations)(ic)); 
-    
-      //      addpdf(m_genpdfname, combinations);
-      addpdf( namevec[i], combinations);
+      _combinations.push_back( std::vector<int>(combinations->GetNoElements()) );
 
+      for ( unsigned ic=0 ; ic<_combinations.back().size() ; ic++ )  _combinations.back()[ic] = int((*combinations)(ic)); 
     }
   }
-  else { 
-    /// of just create the generic from the file
-    if ( contains(m_genpdfname, ".dat") ) addpdf(m_genpdfname);
-  }
-  
-  /// retrieve the pdf routine 
-  findgenpdf( m_genpdfname );
 
-  //  std::cout << "grid::grid() read " << m_genpdfname << " " << m_genpdf[0]->getckmsum().size() << std::endl; 
-
-  // set the ckm matrices 
-  if      ( _ckm.size()>0 )  setckm( _ckm );
-  else if ( _ckm2.size()>0 ) setckm2( _ckm2 );
+  /// create the generic pdfs, retrieve the pdf routine and set the ckm matrices 
+  setupgenpdf( _combinations, _ckm, _ckm2 );
 
   delete setup;
 
@@ -490,11 +844,13 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
   m_obs_bins = (TH1D*)gridfilep->Get((dirname+"/reference_internal").c_str());
   if ( m_obs_bins ) { 
     m_obs_bins_combined = (TH1D*)gridfilep->Get((dirname+"/reference").c_str());
+    if ( m_obs_bins_combined==0 ) throw exception(std::cerr << "grid::grid() cannot read reference: " << filename << std::endl ); 
     m_obs_bins_combined->SetDirectory(0);
     m_obs_bins_combined->Scale(run());
   }
   else { 
     m_obs_bins = (TH1D*)gridfilep->Get((dirname+"/reference").c_str());
+    if ( m_obs_bins==0 ) throw exception(std::cerr << "grid::grid() cannot read reference: " << filename << std::endl ); 
     m_obs_bins_combined = m_obs_bins;
   }
 
@@ -506,18 +862,30 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
 
   //  std::cout << "grid::grid() read obs bins" << std::endl;
 
+  std::vector<std::string> names;
+
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     //    std::cout << "grid::grid() iorder=" << iorder << std::endl;
     m_grids[iorder] = new igrid*[Nobs_internal()];  
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {
+      /// read on demand if lazy
+      m_grids[iorder][iobs] = 0;
+      if ( lazy ) continue;
+
       char name[128];  sprintf(name, (dirname+"/weight[alpha-%d][%03d]").c_str(), iorder, iobs);
       //   std::cout << "grid::grid() reading " << name << "\tiobs=" << iobs << std::endl;
 
-      m_grids[iorder][iobs] = new igrid(*gridfilep, name);
-      m_grids[iorder][iobs]->setparent( this ); 
+      names.push_back( name );
+    }
+  }
+
+  /// the igrids, in the same order as the names
+  std::vector<igrid*> grids = readigrids( *gridfilep, names, m_iothreads );
 
-      //    _size += m_grids[iorder][iobs]->size();
-      //      std::cout << "grid::grid() done" << std::endl;
+  for( int iorder=0, i=0 ; iorder<m_order && !lazy ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++, i++ ) {
+      m_grids[iorder][iobs] = grids[i];
+      m_grids[iorder][iobs]->setparent( this ); 
     }
   }
 
@@ -562,27 +930,23 @@ appl::grid::grid(const std::string& filename, const std::string& dirname)  :
     m_userdata.clear();
     for ( int i=0 ; i<n_userdata ; i++ ) m_userdata.push_back( (*userdata)(i) );
   }
+}
 
-  gridfilep->Close();
-  delete gridfilep;
-
-  double tstop = appl_timer_stop( tstart );
-
-  unsigned usize = size();
-
-  struct timeval tstart2 =  appl_timer_start();
-
-  trim();
-
-  double tstop2 = appl_timer_stop( tstart2 );
-
-  std::cout << "appl::grid() read grid, size ";
-  if ( usize>1024*10 ) std::cout << usize/1024/1024 << " MB";
-  else                 std::cout << usize/1024      << " kB";
-  std::cout << "\tin " << tstop << " ms";
-
-  std::cout << "\ttrim in " << tstop2 << " ms" << std::endl;
 
+/// delete anything read by a constructor that failed - the grids 
+/// must all have been set to zero before reading
+void appl::grid::readfailed() { 
+  for( int iorder=0 ; iorder<MAXGRIDS ; iorder++ ) {  
+    if ( m_grids[iorder]==0 ) continue;
+    for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) delete m_grids[iorder][iobs];
+    delete[] m_grids[iorder];
+    m_grids[iorder] = 0;
+  }
+  if ( m_obs_bins_combined!=m_obs_bins ) delete m_obs_bins_combined;
+  delete m_obs_bins;
+  m_obs_bins_combined = m_obs_bins = 0;
+  delete m_binaryfile;
+  m_binaryfile = 0;
 }
 
 
@@ -603,7 +967,15 @@ appl::grid::grid(const grid& g) :
   m_ckm(g.m_ckm),       /// need a deep copy of the contents
   m_type(g.m_type),
   m_read(g.m_read),
-  m_bin(-1)
+  m_subproc(-1),
+  m_bin(-1),
+  m_threads(g.m_threads),
+  m_threadpool(0),
+  m_cache(0),
+  m_ownCache(false),
+  m_partialsums(0),
+  m_binaryfile(0),
+  m_lazyfile(0)
 {
   m_obs_bins->SetDirectory(0);
   m_obs_bins->Sumw2();
@@ -620,6 +992,8 @@ appl::grid::grid(const grid& g) :
   if ( contains(m_genpdfname, ".dat") ||  contains(m_genpdfname, ".config") ) addpdf(m_genpdfname);
   findgenpdf( m_genpdfname );
 
+  g.load();
+
   for ( int iorder=0 ; iorder<m_order ; iorder++ ) { 
     m_grids[iorder] = new igrid*[Nobs_internal()];
     for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ )  { 
@@ -663,6 +1037,7 @@ void appl::grid::construct(int Nobs,
   // number of subprocesses 
 int appl::grid::subProcesses(int i) const { 
   if ( i<0 || i>=m_order ) throw exception( std::cerr << "grid::subProcess(int i) " << i << " out or range [0-" << m_order-1 << "]" << std::endl );
+  load(0);
   return m_grids[i][0]->SubProcesses();     
 }  
 
@@ -687,7 +1062,19 @@ void appl::grid::add_igrid(int bin, int order, igrid* g) {
     return;
   }
 
-  m_grids[order][bin] = g;
+  /// an igrid not yet read from a lazily read grid need not be read now, 
+  /// so the file can be closed once all the others have been read
+  if ( m_lazyfile ) { 
+    pthread_mutex_lock( &m_lazyfile->lock );
+    if ( m_grids[order][bin]==0 ) { 
+      m_lazyfile->unread--;
+      if ( m_lazyfile->unread==0 ) m_lazyfile->close();
+    }
+    m_grids[order][bin] = g;
+    pthread_mutex_unlock( &m_lazyfile->lock );
+  }
+  else m_grids[order][bin] = g;
+
   m_grids[order][bin]->setparent(this);
 
   if ( g->transform()!=m_transform ) { 
@@ -723,6 +1110,21 @@ appl::grid::~grid() {
   hoppet=0; 
 #endif
 
+  if ( m_threadpool ) delete m_threadpool;
+  m_threadpool = 0;
+
+  if ( m_ownCache ) delete m_cache;
+  m_cache = 0;
+
+  if ( m_partialsums ) delete m_partialsums;
+  m_partialsums = 0;
+
+  /// only once the igrids using the mapped weights are gone
+  if ( m_binaryfile ) delete m_binaryfile;
+  m_binaryfile = 0;
+
+  if ( m_lazyfile ) delete m_lazyfile;
+  m_lazyfile = 0;
 }
 
 
@@ -738,6 +1140,14 @@ appl::grid& appl::grid::operator=(const appl::grid& g) {
     for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ )  delete m_grids[iorder][iobs];
     delete m_grids[iorder];
   }
+
+  if ( m_binaryfile ) delete m_binaryfile;
+  m_binaryfile = 0;
+
+  if ( m_lazyfile ) delete m_lazyfile;
+  m_lazyfile = 0;
+
+  g.load();
   
   // copy the new
   m_obs_bins = new TH1D(*g.m_obs_bins);
@@ -766,6 +1176,7 @@ appl::grid& appl::grid::operator=(const appl::grid& g) {
   
 
 appl::grid& appl::grid::operator*=(const double& d) { 
+  load();
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) (*m_grids[iorder][iobs])*=d; 
   }
@@ -776,11 +1187,13 @@ appl::grid& appl::grid::operator*=(const double& d) {
 
 
 double appl::grid::fx(double x) const { 
+  if ( m_order>0 && Nobs_internal()>0 ) load(0);
   if ( m_order>0 && Nobs_internal()>0 ) return m_grids[0][0]->fx(x);
   else return 0;
 }
 
 double appl::grid::fy(double x) const { 
+  if ( m_order>0 && Nobs_internal()>0 ) load(0);
   if ( m_order>0 && Nobs_internal()>0 ) return m_grids[0][0]->fy(x);
   else return 0;
 }
@@ -793,6 +1206,8 @@ appl::grid& appl::grid::operator+=(const appl::grid& g) {
   if ( Nobs_internal()!=g.Nobs_internal() )   throw exception("grid::operator+ Nobs bin mismatch");
   if ( m_order!=g.m_order ) throw exception("grid::operator+ different order grids");
   if ( m_leading_order!=g.m_leading_order ) throw exception("grid::operator+ different order processes in grids");
+  load();
+  g.load();
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) (*m_grids[iorder][iobs]) += (*g.m_grids[iorder][iobs]); 
   }
@@ -815,6 +1230,9 @@ bool appl::grid::operator==(const appl::grid& g) const {
   if ( Nobs_internal()!=g.Nobs_internal() )    match = false;
   if ( m_order!=g.m_order )  match = false;
   if ( m_leading_order!=g.m_leading_order ) match = false;
+  if ( !match ) return false;
+  load();
+  g.load();
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     //    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) match &= ( (*m_grids[iorder][iobs]) == (*g.m_grids[iorder][iobs]) ); 
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) match &= ( m_grids[iorder][iobs]->compare_axes( *g.m_grids[iorder][iobs] ) ); 
@@ -840,6 +1258,7 @@ void appl::grid::fill(const double x1, const double x2, const double Q2,
   //  std::cout << std::endl;
 
   //  std::cout << "\tiobs=" << iobs << std::endl;
+  if ( m_lazyfile ) load(iobs);
   if ( m_symmetrise && x2<x1 )  m_grids[iorder][iobs]->fill(x2, x1, Q2, weight);
   else                          m_grids[iorder][iobs]->fill(x1, x2, Q2, weight);
 }
@@ -855,6 +1274,7 @@ void appl::grid::fill_phasespace(const double x1, const double x2, const double
     //  cerr << "obs=" << obs << "\tobsmin=" << obsmin() << "\tobsmax=" << obsmax() << std::endl;
     return;
   }
+  if ( m_lazyfile ) load(iobs);
   if ( m_symmetrise && x2<x1 )  m_grids[iorder][iobs]->fill_phasespace(x2, x1, Q2, weight);
   else                          m_grids[iorder][iobs]->fill_phasespace(x1, x2, Q2, weight);
 }
@@ -872,12 +1292,14 @@ void appl::grid::fill_index(const int ix1, const int ix2, const int iQ2,
     //  cerr << "obs=" << obs << "\tobsmin=" << obsmin() << "\tobsmax=" << obsmax() << std::endl;
     return;
   }
+  if ( m_lazyfile ) load(iobs);
   if ( m_symmetrise && ix2<ix1 )  m_grids[iorder][iobs]->fill_index(ix2, ix1, iQ2, weight);
   else                            m_grids[iorder][iobs]->fill_index(ix1, ix2, iQ2, weight);
 }
 
 
 void appl::grid::trim() {
+  load();
   m_trimmed = true;
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->trim(); 
@@ -885,89 +1307,279 @@ void appl::grid::trim() {
 }
 
 void appl::grid::untrim() {
+  load();
   m_trimmed = false;
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->untrim(); 
   }
 }
 
-std::ostream& appl::grid::print(std::ostream& s) const {
-  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
-    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {     
-      s << iobs << "\t" 
-	<< std::setprecision(5) << std::setw(6) << getReference()->GetBinLowEdge(iobs+1) << "\t- " 
-	<< std::setprecision(5) << std::setw(6) << getReference()->GetBinLowEdge(iobs+2) << "\t"; 
-      m_grids[iorder][iobs]->print(s);       
+int appl::grid::setIOThreads(int n) { 
+  if ( n<=0 ) n = threadpool::cores();
+  return m_iothreads=n;
+}
+
+int appl::grid::setThreads(int n) { 
+  if ( n<=0 ) n = threadpool::cores();
+  if ( n!=m_threads && m_threadpool ) { 
+    delete m_threadpool;
+    m_threadpool = 0;
+  }
+  return m_threads=n;
+}
+
+
+void appl::grid::setCache(bool b) { 
+  if ( b ) { 
+    if ( m_cache==0 ) { 
+      m_cache    = new nodetables();
+      m_ownCache = true;
     }
   }
-  return s;
+  else { 
+    if ( m_ownCache ) delete m_cache;
+    m_cache    = 0;
+    m_ownCache = false;
+  }
+}
+
+void appl::grid::useCache(nodetables* tables) { 
+  if ( m_ownCache ) delete m_cache;
+  m_cache    = tables;
+  m_ownCache = false;
+}
+
+void appl::grid::clearCache() { 
+  if ( m_cache ) m_cache->clear();
 }
 
+void appl::grid::setCacheGeneration(unsigned long g) { 
+  if ( m_cache ) m_cache->generation(g);
+}
 
+void appl::grid::setCacheSize(size_t bytes) { 
+  if ( m_cache ) m_cache->maxbytes(bytes);
+}
 
 
- /// get the required pdf combinations from those registered   
-void appl::grid::findgenpdf( std::string s ) { 
-    std::vector<std::string> names = parse( s, ":" );
-    if ( names.size()==unsigned(m_order) ) for ( int i=0 ; i<m_order ; i++ ) m_genpdf[i] = appl_pdf::getpdf( names[i] );
-    else  if ( names.size()==1 )           for ( int i=0 ; i<m_order ; i++ ) m_genpdf[i] = appl_pdf::getpdf( names[0] );
-    else  { 
-      throw exception( std::cerr << "requested " << m_order << " pdf combination but given " << names.size() << std::endl );
+double appl::grid::compile(PRECISION precision) {
+  load();
+  m_trimmed = true;
+  double deviation = 0;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
+      double d = m_grids[iorder][iobs]->compile( precision ); 
+      if ( d>deviation ) deviation = d;
     }
+  }
+  return deviation;
 }
 
+double appl::grid::factorise(double tolerance) {
+  load();
+  double residual = 0;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    /// the pdf combination coefficients are only found once, here 
+    m_genpdf[iorder]->setupcoefficients();
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
+      double r = m_grids[iorder][iobs]->factorise( tolerance ); 
+      if ( r>residual ) residual = r;
+    }
+  }
+  return residual;
+}
 
-void appl::grid::addpdf( const std::string& s, const std::vector<int>& combinations ) {
+void appl::grid::unfactorise() {
+  load();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->unfactorise(); 
+  }
+}
 
-  //  std::cout << "addpdf() in " << std::endl;
+int appl::grid::rank(int iobs) const {
+  load(iobs);
+  int r = 0;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) r = std::max( r, m_grids[iorder][iobs]->rank() );
+  return r;
+}
 
-    /// parse names, if they contain .dat, then create the new generic pdfs
-    /// they will be added to the pdf std::map automatically 
-    std::vector<std::string> names = parse( s, ":" );
+double appl::grid::residual(int iobs) const {
+  load(iobs);
+  double r = 0;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) r = std::max( r, m_grids[iorder][iobs]->residual() );
+  return r;
+}
 
-    unsigned imax = unsigned(m_order); 
+/// the contributions from all the orders for a bin are sorted together, 
+/// and the threshold is the smallest contribution which can not be removed 
+/// without their sum exceeding the tolerance on the cross section
+std::vector<double> appl::grid::prune(void (*pdf)(const double& , const double&, double* ), 
+				      double (*alphas)(const double& ), 
+				      double tolerance ) { 
 
-    /// check to see whether we have a different pdf for each order
-    if ( names.size()!=imax ) { 
-      if ( names.size()==1 ) imax = 1;
-      else { 
-	throw exception( std::cerr << "requested " << m_order << " pdf combination but given " << names.size() << std::endl );
-      }
-    }
+  resettransient();
 
-    //    std::cout << "imax " << imax << std::endl; 
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::prune() pruning only for standard grids" ); 
 
-    /// loop through all the required pdfs checking whether they exist already,
-    /// if not (from thrown exception) then create it, otherwise, don't need to 
-    /// do anything 
-    for ( unsigned i=0 ; i<imax ; i++ ) { 
+  load();
 
-      //      std::cout << "\ti " << i<< std::endl; 
+  NodeCache cache( pdf );
+  cache.reset();
 
-      if ( names[i].find(".dat")!=std::string::npos ) {
+  std::vector<double> dropped( Nobs_internal(), 0 );
 
-	if ( appl_pdf::getpdf(names[i])==0 ) { 
- 	  std::cout << "appl::grid::addpdf() creating new generic_pdf " << names[i] << std::endl;
-	  new generic_pdf(names[i]);
-	}
+  std::vector<double> c;
 
-	// 	try {
-	// 	  appl_pdf::getpdf(names[i]); // , false);
-	// 	}
-	// 	catch ( appl_pdf::exception e ) { 
-	// 	  std::cout << "creating new generic_pdf " << names[i] << std::endl;
-	// 	  new generic_pdf(names[i]);
-	// 	}
+  for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
 
-      }
-      else if ( names[i].find(".config")!=std::string::npos ) { 
+    c.clear();
 
-	if ( appl_pdf::getpdf(names[i])==0 ) { 
-	  std::cout << "appl::grid::addpdf() creating new lumi_pdf " << names[i] << std::endl;
-	  new lumi_pdf(names[i], combinations);
-	}
+    double sigma = 0;
+    for( int iorder=0 ; iorder<m_order ; iorder++ ) { 
+      sigma += m_grids[iorder][iobs]->contributions( &cache, m_genpdf[iorder], alphas, m_leading_order+iorder, c );
+    }
 
-	// 	try {
+    m_transient = std::max( m_transient, vectormemory(c) );
+
+    std::sort( c.begin(), c.end() );
+
+    double budget = tolerance*std::fabs(sigma);
+    double sum    = 0;
+    unsigned i = 0;
+    for ( ; i<c.size() && sum+c[i]<=budget ; i++ ) sum += c[i];
+
+    if ( i==0 ) continue;
+
+    double threshold = ( i<c.size() ? c[i] : 2*c.back() );
+
+    double removed = 0;
+    for( int iorder=0 ; iorder<m_order ; iorder++ ) { 
+      int Nremoved = 0;
+      removed += m_grids[iorder][iobs]->prune( &cache, m_genpdf[iorder], alphas, m_leading_order+iorder, threshold, Nremoved );
+    }
+
+    if ( sigma!=0 ) dropped[iobs] = removed/sigma;
+  }
+
+  return dropped;
+}
+
+
+void appl::grid::interleave() {
+  load();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->interleave(); 
+  }
+}
+
+void appl::grid::deinterleave() {
+  load();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->deinterleave(); 
+  }
+}
+
+bool appl::grid::fold() {
+  std::vector<std::vector<int> > conjugate(m_order);
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) { 
+    if ( !m_genpdf[iorder]->conjugates( conjugate[iorder] ) ) return false;
+  }
+  load();
+  bool status = true;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
+      if ( !m_grids[iorder][iobs]->fold( conjugate[iorder] ) ) status = false; 
+    }
+  }
+  return status;
+}
+
+bool appl::grid::folded() const {
+  load();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) if ( !m_grids[iorder][iobs]->folded() ) return false; 
+  }
+  return true;
+}
+
+std::ostream& appl::grid::print(std::ostream& s) const {
+  load();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {     
+      s << iobs << "\t" 
+	<< std::setprecision(5) << std::setw(6) << getReference()->GetBinLowEdge(iobs+1) << "\t- " 
+	<< std::setprecision(5) << std::setw(6) << getReference()->GetBinLowEdge(iobs+2) << "\t"; 
+      m_grids[iorder][iobs]->print(s);       
+    }
+  }
+  return s;
+}
+
+
+
+
+ /// get the required pdf combinations from those registered   
+void appl::grid::findgenpdf( std::string s ) { 
+    std::vector<std::string> names = parse( s, ":" );
+    if ( names.size()==unsigned(m_order) ) for ( int i=0 ; i<m_order ; i++ ) m_genpdf[i] = appl_pdf::getpdf( names[i] );
+    else  if ( names.size()==1 )           for ( int i=0 ; i<m_order ; i++ ) m_genpdf[i] = appl_pdf::getpdf( names[0] );
+    else  { 
+      throw exception( std::cerr << "requested " << m_order << " pdf combination but given " << names.size() << std::endl );
+    }
+}
+
+
+void appl::grid::addpdf( const std::string& s, const std::vector<int>& combinations ) {
+
+  //  std::cout << "addpdf() in " << std::endl;
+
+    /// parse names, if they contain .dat, then create the new generic pdfs
+    /// they will be added to the pdf std::map automatically 
+    std::vector<std::string> names = parse( s, ":" );
+
+    unsigned imax = unsigned(m_order); 
+
+    /// check to see whether we have a different pdf for each order
+    if ( names.size()!=imax ) { 
+      if ( names.size()==1 ) imax = 1;
+      else { 
+	throw exception( std::cerr << "requested " << m_order << " pdf combination but given " << names.size() << std::endl );
+      }
+    }
+
+    //    std::cout << "imax " << imax << std::endl; 
+
+    /// loop through all the required pdfs checking whether they exist already,
+    /// if not (from thrown exception) then create it, otherwise, don't need to 
+    /// do anything 
+    for ( unsigned i=0 ; i<imax ; i++ ) { 
+
+      //      std::cout << "\ti " << i<< std::endl; 
+
+      if ( names[i].find(".dat")!=std::string::npos ) {
+
+	if ( appl_pdf::getpdf(names[i])==0 ) { 
+ 	  std::cout << "appl::grid::addpdf() creating new generic_pdf " << names[i] << std::endl;
+	  new generic_pdf(names[i]);
+	}
+
+	// 	try {
+	// 	  appl_pdf::getpdf(names[i]); // , false);
+	// 	}
+	// 	catch ( appl_pdf::exception e ) { 
+	// 	  std::cout << "creating new generic_pdf " << names[i] << std::endl;
+	// 	  new generic_pdf(names[i]);
+	// 	}
+
+      }
+      else if ( names[i].find(".config")!=std::string::npos ) { 
+
+	if ( appl_pdf::getpdf(names[i])==0 ) { 
+	  std::cout << "appl::grid::addpdf() creating new lumi_pdf " << names[i] << std::endl;
+	  new lumi_pdf(names[i], combinations);
+	}
+
+	// 	try {
 	// 	  appl_pdf::getpdf(names[i]); // , false);
 	// 	}
 	// 	catch ( appl_pdf::exception e ) { 
@@ -1020,6 +1632,7 @@ const std::vector<std::vector<double> >& appl::grid::getckm2() const { return m_
 
 // set the rewight flag of the internal grids
 bool appl::grid::reweight(bool t) { 
+  load();
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->reweight(t);       
   }
@@ -1037,9 +1650,14 @@ bool exists( const std::string& filename ) {
 // dump to file
 void appl::grid::Write(const std::string& filename, 
 		       const std::string& dirname, 
-		       const std::string& pdfname) 
+		       const std::string& pdfname,
+		       FORMAT format ) 
 { 
 
+  load();
+
+  resettransient();
+
   std::cout << "appl::grid::Write() " << filename << "\tdirname " << dirname << "\tpdfname " << pdfname << std::endl; 
 
   if ( exists( filename ) ) { 
@@ -1049,6 +1667,11 @@ void appl::grid::Write(const std::string& filename,
 
   if ( pdfname!="" ) shrink( pdfname, m_genpdf[0]->getckmcharge() );
 
+  if ( format==NATIVE ) { 
+    writebinary( filename );
+    return;
+  }
+
   //  std::cout << "grid::Write() writing to file " << filename << std::endl;
   TFile rootfile(filename.c_str(),"recreate");
 
@@ -1078,22 +1701,9 @@ void appl::grid::Write(const std::string& filename,
   //  std::cout << "state std::vector=" << std::endl;
 
   // state information
-  TVectorT<double>* setup=new TVectorT<double>(12); // add a few extra just in case 
-  (*setup)(0) = m_run;
-  (*setup)(1) = ( m_optimised  ? 1 : 0 );
-  (*setup)(2) = ( m_symmetrise ? 1 : 0 );
-  (*setup)(3) =   m_leading_order ;
-  (*setup)(4) =   m_order ;
-  (*setup)(5) =   m_cmsScale ;
-  (*setup)(6) = ( m_normalised ? 1 : 0 );
-  (*setup)(7) = ( m_applyCorrections ? 1 : 0 );
-
-  if ( m_genpdf[0]->getckmsum().size()==0 ) (*setup)(8) = 0;
-  else                                      (*setup)(8) = 1;
-
-  (*setup)(9) = (int)m_type;
-
-  (*setup)(10) = m_userdata.size();
+  std::vector<double> _state = state();
+  TVectorT<double>* setup=new TVectorT<double>(_state.size());
+  for ( unsigned i=0 ; i<_state.size() ; i++ ) (*setup)(i) = _state[i];
 
   setup->Write("State");
   
@@ -1142,8 +1752,14 @@ void appl::grid::Write(const std::string& filename,
   
   //  std::cout << "grids Nobs = " << Nobs_internal() << std::endl;
   
-  untrim();
-  int untrim_size = size();
+  // the size of the full grids, without actually allocating them all 
+  int untrim_size = 0;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
+      const igrid* g = m_grids[iorder][iobs];
+      untrim_size += g->Ntau()*g->Ny1()*g->Ny2()*g->SubProcesses();
+    }
+  }
   trim();
   int trim_size = size();
   std::cout <<"grid::Write()"
@@ -1153,15 +1769,21 @@ void appl::grid::Write(const std::string& filename,
   
 
   // internal grids
+  std::vector<std::string> names;
+  std::vector<igrid*>      grids;
   for( int iorder=0 ; iorder<m_order ; iorder++ ) {
     for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {
       char name[128];  sprintf(name, "weight[alpha-%d][%03d]", iorder, iobs);
       // std::cout << "writing grid " << name << std::endl;
-      //   _size += m_grids[iorder][iobs]->size();
-      m_grids[iorder][iobs]->write(name);
-      //   trim_size += m_grids[iorder][iobs]->size();
+      names.push_back( name );
+      grids.push_back( m_grids[iorder][iobs] );
     }
   }
+
+  if ( format==ROOTSPARSE ) { 
+    for ( unsigned i=0 ; i<grids.size() ; i++ ) grids[i]->writesparse( names[i] );
+  }
+  else writeigrids( names, grids, m_iothreads );
  
   
   //  d.pop();
@@ -1250,6 +1872,278 @@ void appl::grid::Write(const std::string& filename,
 
 
 
+// the state flags, as stored in the grid files 
+std::vector<double> appl::grid::state() const { 
+  std::vector<double> setup(12,0); // add a few extra just in case 
+  setup[0] = m_run;
+  setup[1] = ( m_optimised  ? 1 : 0 );
+  setup[2] = ( m_symmetrise ? 1 : 0 );
+  setup[3] =   m_leading_order ;
+  setup[4] =   m_order ;
+  setup[5] =   m_cmsScale ;
+  setup[6] = ( m_normalised ? 1 : 0 );
+  setup[7] = ( m_applyCorrections ? 1 : 0 );
+
+  if ( m_genpdf[0]->getckmsum().size()==0 ) setup[8] = 0;
+  else                                      setup[8] = 1;
+
+  setup[9] = (int)m_type;
+
+  setup[10] = m_userdata.size();
+
+  return setup;
+}
+
+
+// set the state flags read from a file, older files have fewer entries 
+void appl::grid::setstate(const std::vector<double>& setup) { 
+
+  if ( setup.size()<5 ) throw exception( "grid::grid() incomplete grid state" ); 
+
+  m_run        = setup[0];
+  m_optimised  = ( setup[1]!=0 ? true : false );
+  m_symmetrise = ( setup[2]!=0 ? true : false );  
+
+  m_leading_order = int(setup[3]+0.5);  
+  m_order         = int(setup[4]+0.5);  
+
+  if ( setup.size()>5 ) m_cmsScale = setup[5];
+  else                  m_cmsScale = 0;
+ 
+  if ( setup.size()>6 ) m_normalised = ( setup[6]!=0 ? true : false );
+  else                  m_normalised = true;
+
+  if ( setup.size()>7 ) m_applyCorrections = ( setup[7]!=0 ? true : false );
+  else                  m_applyCorrections = false;
+
+  if ( setup.size()>9 ) m_type = (CALCULATION)int( setup[9]+0.5 );
+  else                  m_type = STANDARD;
+}
+
+
+void appl::grid::setupgenpdf( const std::vector<std::vector<int> >& combinations, 
+			      const std::vector<std::vector<double> >& ckm, 
+			      const std::vector<std::vector<double> >& ckm2 ) { 
+
+  if ( combinations.size()>0 ) { 
+    /// one combination per order or one overall
+    std::vector<std::string> namevec = parse( m_genpdfname, ":" );
+    for ( unsigned i=0 ; i<namevec.size() && i<combinations.size() ; i++ ) addpdf( namevec[i], combinations[i] );
+  }
+  else { 
+    /// of just create the generic from the file
+    if ( contains(m_genpdfname, ".dat") ) addpdf(m_genpdfname);
+  }
+
+  /// retrieve the pdf routine 
+  findgenpdf( m_genpdfname );
+
+  // set the ckm matrices 
+  if      ( ckm.size()>0 )  setckm( ckm );
+  else if ( ckm2.size()>0 ) setckm2( ckm2 );
+}
+
+
+
+/// the reference histograms in the native files, with the under and 
+/// overflow bins, written without any scaling so they read back exactly
+
+static void writereference( appl::binarywriter& w, const TH1D* h ) { 
+  const int N = h->GetNbinsX();
+  std::vector<double> limits(N+1);
+  std::vector<double> contents(N+2);
+  std::vector<double> errors(N+2);
+  for ( int i=0 ; i<=N ; i++ ) limits[i] = h->GetBinLowEdge(i+1);
+  for ( int i=0 ; i<N+2 ; i++ ) { 
+    contents[i] = h->GetBinContent(i);
+    errors[i]   = h->GetBinError(i);
+  }
+  w.writestring( h->GetName() );
+  w.writestring( h->GetTitle() );
+  w.writevector( limits );
+  w.writevector( contents );
+  w.writevector( errors );
+}
+
+static TH1D* readreference( appl::binaryfile& f ) { 
+  std::string name  = f.readstring();
+  std::string title = f.readstring();
+  std::vector<double> limits   = f.readvector<double>();
+  std::vector<double> contents = f.readvector<double>();
+  std::vector<double> errors   = f.readvector<double>();
+  if ( limits.size()<2 || contents.size()!=limits.size()+1 || errors.size()!=contents.size() ) { 
+    throw appl::grid::exception( "grid::grid() bad reference histogram in native file" );
+  }
+  TH1D* h = new TH1D( name.c_str(), title.c_str(), limits.size()-1, &limits[0] );
+  h->SetDirectory(0);
+  for ( unsigned i=0 ; i<contents.size() ; i++ ) { 
+    h->SetBinContent( i, contents[i] );
+    h->SetBinError( i, errors[i] );
+  }
+  return h;
+}
+
+
+// read the native binary file - the igrids use the trimmed weights in 
+// place in the memory map, which is kept until the grid is deleted
+void appl::grid::readbinary(const std::string& filename) { 
+
+  struct timeval tstart = appl_timer_start();
+
+  std::cout << "appl::grid() reading native grid from file " << filename;
+
+  m_binaryfile = new binaryfile( filename );
+
+  binaryfile& f = *m_binaryfile;
+
+  m_transform     = f.readstring();
+  m_genpdfname    = f.readstring();
+  std::string _version = f.readstring();
+  m_documentation = f.readstring();
+
+  std::cout << "\tversion " << _version;
+  if ( _version != m_version ) std::cout  << "(transformed to " << m_version << ")";
+  std::cout << std::endl;
+
+  if ( getDocumentation()!="" ) std::cout << getDocumentation() << std::endl; 
+
+  setstate( f.readvector<double>() );
+
+  if ( m_order<=0 || m_order>MAXGRIDS ) throw exception( "grid::grid() bad number of orders in native file" );
+
+  /// the 3x3 ckm matrix, if one is used
+  std::vector<std::vector<double> > _ckm;
+  std::vector<double> ckmflat = f.readvector<double>();
+  if ( ckmflat.size()==9 ) { 
+    _ckm = std::vector<std::vector<double> >(3, std::vector<double>(3) );
+    for ( int ic=0 ; ic<3 ; ic++ ) { 
+      for ( int id=0 ; id<3 ; id++ ) _ckm[ic][id] = ckmflat[ic*3+id]; 
+    }
+  }
+
+  /// the pdf combinations for each order if needed
+  int ncombinations = f.readint();
+  if ( ncombinations<0 || ncombinations>m_order ) throw exception( "grid::grid() bad pdf combinations in native file" );
+  std::vector<std::vector<int> > _combinations( ncombinations );
+  for ( int i=0 ; i<ncombinations ; i++ ) _combinations[i] = f.readvector<int>();
+
+  if ( m_genpdfname=="basic" ) { 
+    m_genpdfname = "basic.config"; 
+    addpdf(m_genpdfname);
+  }
+
+  setupgenpdf( _combinations, _ckm, std::vector<std::vector<double> >() );
+
+  /// the reference histograms 
+  bool combined = ( f.readint()!=0 );
+  m_obs_bins = readreference( f );
+  if ( combined ) m_obs_bins_combined = readreference( f );
+  else            m_obs_bins_combined = m_obs_bins;
+
+  m_obs_bins->SetName("referenceInternal");
+  if ( m_normalised && m_optimised ) m_read = true;
+
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    m_grids[iorder] = new igrid*[Nobs_internal()]();  
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {
+      m_grids[iorder][iobs] = new igrid( f );
+      m_grids[iorder][iobs]->setparent( this ); 
+    }
+  }
+
+  /// bin-by-bin corrections and their labels
+  int ncorrections = f.readint();
+  for ( int i=0 ; i<ncorrections ; i++ ) { 
+    m_corrections.push_back( f.readvector<double>() ); 
+    m_applyCorrection.push_back(false);
+  }
+
+  int nlabels = f.readint();
+  for ( int i=0 ; i<nlabels ; i++ ) m_correctionLabels.push_back( f.readstring() );
+
+  /// bins to be combined
+  m_combine = f.readvector<int>();
+  if ( m_combine.size() ) combineReference();
+
+  m_userdata = f.readvector<double>();
+
+  /// the weights are already trimmed
+  m_trimmed = true;
+
+  double tstop = appl_timer_stop( tstart );
+
+  unsigned usize = size();
+
+  std::cout << "appl::grid() read grid, size ";
+  if ( usize>1024*10 ) std::cout << usize/1024/1024 << " MB";
+  else                 std::cout << usize/1024      << " kB";
+  std::cout << "\tin " << tstop << " ms" << std::endl;
+}
+
+
+// write the native binary file, in the order it is read by readbinary()
+void appl::grid::writebinary(const std::string& filename) { 
+
+  trim();
+
+  binarywriter w( filename );
+
+  w.writestring( m_transform );
+  w.writestring( m_genpdfname );
+  w.writestring( m_version );
+  w.writestring( m_documentation );
+
+  w.writevector( state() );
+
+  /// only the 3x3 ckm matrix, as for the ROOT files
+  std::vector<double> ckmflat;
+  if ( m_genpdf[0]->getckmsum().size()>0 ) { 
+    const std::vector<std::vector<double> >& _ckm = m_genpdf[0]->getckm();
+    for ( int ic=0 ; ic<3 ; ic++ ) { 
+      for ( int id=0 ; id<3 ; id++ ) ckmflat.push_back( _ckm[ic][id] );
+    }
+  }
+  w.writevector( ckmflat );
+
+  /// encode the pdf combination if appropriate
+  if ( contains( m_genpdfname, ".config" ) ) { 
+    std::vector<std::string> namevec = parse( m_genpdfname, ":" );
+    int ncombinations = ( int(namevec.size())<m_order ? namevec.size() : m_order ); 
+    w.writeint( ncombinations );
+    for ( int i=0 ; i<ncombinations ; i++ ) w.writevector( dynamic_cast<lumi_pdf*>(m_genpdf[i])->serialise() );
+  }
+  else w.writeint( 0 );
+
+  /// the reference histograms
+  bool combined = ( m_obs_bins_combined!=m_obs_bins );
+  w.writeint( combined ? 1 : 0 );
+  writereference( w, m_obs_bins );
+  if ( combined ) writereference( w, m_obs_bins_combined );
+
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) m_grids[iorder][iobs]->write( w );
+  }
+
+  /// bin-by-bin corrections and their labels
+  w.writeint( m_corrections.size() );
+  for ( unsigned i=0 ; i<m_corrections.size() ; i++ ) { 
+    const std::vector<double>& c = m_corrections[i]; 
+    w.writevector( c );
+  }
+
+  w.writeint( m_correctionLabels.size() );
+  for ( unsigned i=0 ; i<m_correctionLabels.size() ; i++ ) w.writestring( m_correctionLabels[i] );
+
+  w.writevector( m_combine );
+  w.writevector( m_userdata );
+
+  w.close();
+
+  if ( !w.good() ) throw exception( "grid::Write() error writing file " + filename );
+}
+
+
+
 // takes pdf as the pdf lib wrapper for the pdf set for the convolution.
 // type specifies which sort of partons should be included:
 
@@ -1272,6 +2166,8 @@ std::vector<double> appl::grid::vconvolute(void (*pdf1)(const double& , const do
 					   double Escale )
 { 
 
+  resettransient();
+
   NodeCache cache1( pdf1 );
   NodeCache cache2;
 
@@ -1308,22 +2204,10 @@ std::vector<double> appl::grid::vconvolute(void (*pdf1)(const double& , const do
   // need to initialise it again, and do so if required
   if ( fscale_factor!=1 || m_dynamicScale ) {
 
-    if ( pdf2==0 || pdf1==pdf2 ) { 
-
-      if ( hoppet == 0 ) { 
-	double Qmax = 15000;
-	if ( m_cmsScale>Qmax ) Qmax = m_cmsScale;
-	hoppet = new hoppet_init( Qmax );
-      } 
+    if ( pdf2==0 || pdf1==pdf2 ) setupSplitting( pdf1, m_cmsScale );
 
-      bool newpdf = hoppet->compareCache( pdf1 );
-      
-      if ( newpdf ) hoppet->fillCache( pdf1 );
-
-    }
-
-  }
-#endif
+  }
+#endif
 
   std::string label;
   
@@ -1333,6 +2217,9 @@ std::vector<double> appl::grid::vconvolute(void (*pdf1)(const double& , const do
   } 
   
   
+  /// the standard convolution only reads the igrids for the bins it needs
+  if ( m_type!=STANDARD ) load();
+
   if ( m_type==STANDARD ) { 
 
     static bool first = true;
@@ -1341,293 +2228,1023 @@ std::vector<double> appl::grid::vconvolute(void (*pdf1)(const double& , const do
 
     //    std::cout << "standard convolution" << std::endl;
 
-    for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {  
+    /// first collect the igrid convolutions needed for each bin, these are 
+    /// then calculated, possibly in parallel, and the terms for each bin 
+    /// summed in order, so the result is independent of the number of threads
+    std::vector<term>     terms;
+    std::vector<int>      bins;
+    std::vector<unsigned> first_term;
 
-      /// here we see whether we need to emulate a dynamic scale by simply 
-      /// changing the renormalisation and factorisation scale terms to give 
-      /// what a dynamic scale would be in this bin
- 
-      if ( m_bin!=-1 && iobs!=m_bin ) continue;
+    standard_terms( terms, bins, first_term, label, nloops, rscale_factor, fscale_factor, Escale );
 
-      double dynamic_factor = 1;
+    convolute_terms( terms, _pdf1, _pdf2, alphas );
 
-      if ( m_dynamicScale ) {
-	double var = m_obs_bins->GetBinCenter(iobs+1);
-	dynamic_factor = var/m_dynamicScale;
-	//	if ( first ) std::cout << "grid::vconvolute() bin " << iobs << "\tscale " << var << "\tdynamicScale " << m_dynamicScale << "\t scale factor " << dynamic_factor << std::endl;
-      } 
+    for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
 
-      /// now do the convolution proper
+      int iobs = bins[ibin];
 
-      double dsigma = 0;
-     
+      double dsigma = terms[first_term[ibin]].dsigma;
+      for ( unsigned it=first_term[ibin]+1 ; it<first_term[ibin+1] ; it++ ) dsigma += terms[it].dsigma;
+
+      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+    }
+
+    first = false;
+    
+  }
+  else if ( m_type==AMCATNLO ) {  
+
+    //    std::cout << "amc@NLO convolution" << std::endl;
+    
+    for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {  
+
+      double dsigma = 0; 
+      
       if ( nloops==0 ) {
-	label = "lo      ";
+	  /// this is the amcatnlo LO calculation (without FKS shower)
+	  label = "lo";
+	  /// work out how to call from the igrid - maybe just implement additional 
+	  double dsigma_B = m_grids[3][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[3], alphas, m_leading_order,   0, rscale_factor, fscale_factor,  Escale );
+ 
+   	  dsigma = dsigma_B;
+      }
+      else if ( nloops==1 || nloops==-1 ) {
+	  /// this is the amcatnlo NLO calculation (without FKS shower)
+	  /// Next-to-leading order contribution
+	  label = "nlo only"; /// for the time being ...
 
-	/// leading order cross section
+	  // Scale independent contribution
+	  double dsigma_0 = m_grids[0][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
+	  dsigma = dsigma_0;
 
-	if ( subproc()==-1 ) {  
-	  dsigma = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, 0, dynamic_factor*rscale_factor, dynamic_factor*rscale_factor, Escale);
-	}
-	else { 
-	  /// fixme: for the subproceses, this is technically incorrect - the "LO" contribution 
-	  ///        includes the scale dependent "NLO" terms that are proportional to the LO 
-	  ///        coefficient functions - it could use the strict "LO" part without the scale 
-	  ///        dependent parts using order "0" rather than order "1" but see the comment 
-	  ///        for the "NLO only" contribution. The reason for this is that the subprocesses
-	  ///        can be different for LO and NLO, so this NLO part with "LO coefficients", 
-	  ///        can have different subprocesses from the actual NLO part, so the correct 
-	  ///        LO/NLO separation is only guaranteed for the full convolution, and not by 
-	  ///        subprocess
-	  dsigma = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, 1, dynamic_factor*rscale_factor, dynamic_factor*rscale_factor, Escale);
-	}
+	  // Renormalization scale dependent contribution
+	  if ( rscale_factor!=1 ) { 
+	    double dsigma_R = m_grids[1][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
+	    dsigma += dsigma_R*std::log(rscale_factor*rscale_factor);
+	  }
 
+	  // Factorization scale dependent contribution
+	  if ( fscale_factor!=1 ) { 
+	    double dsigma_F = m_grids[2][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[2], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
+	    dsigma += dsigma_F*std::log(fscale_factor*fscale_factor);
+	  }
+      
+	  /// Add the LO contribution if we want full NLO 
+	  /// rather than specific NLO contribution only  
+	  if ( nloops==1 ) { 
+	    /// this is the amcatnlo NLO calculation (without FKS shower)
+	    label = "nlo";
+	    /// work out how to call from the igrid - maybe just implement additional 
+	    /// convolution routines and call them here
+	    double dsigma_B = m_grids[3][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[3], alphas, m_leading_order,   0,  rscale_factor, fscale_factor,  Escale );	
+	    dsigma += dsigma_B;
+	  }
+      }
+      else if ( nloops==-2 ) { 
+        /// Only the convolution from the W0 grid
+        label = "nlo_w0";
+	double dsigma_0 = m_grids[0][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
+	dsigma = dsigma_0;
+      }
+      else if ( nloops==-3 ) {
+	/// Only the convolution from the WR grid
+	label = "nlo_wR";
+	double dsigma_R = m_grids[1][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, rscale_factor, fscale_factor,  Escale );
+	dsigma = dsigma_R * std::log(rscale_factor*rscale_factor)  ;
+      }
+      else if ( nloops==-4 ) { 
+        /// Only the convolution from the WF grid
+        label = "nlo_wF";
+	double dsigma_F = m_grids[2][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[2], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
+	dsigma = dsigma_F * std::log(fscale_factor*fscale_factor) ;
+      }
+      else { 
+	throw grid::exception( std::cerr << "invalid value for nloops " << nloops ); 
+      }
+
+      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+    }
+  }
+  else if ( m_type == SHERPA ) { 
+    
+    //    std::cout << "sherpa convolution" << std::endl;
+
+    for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {  
+    
+      double dsigma = 0; 
+  
+      if ( nloops==0 ) {
+	label = "lo      ";
+	// leading order cross section
+	dsigma = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, 0, 1, 1, Escale);
       }
       else if ( nloops==1 ) { 
 	label = "nlo     ";
 	// next to leading order cross section
-	// std::cout << "convolute() nloop=1" << std::endl;
 	// leading order contribution and scale dependent born dependent terms
-	double dsigma_lo  = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, 1, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale);
-	// std::cout << "dsigma_lo=" << dsigma_lo << std::endl;
-	// next to leading order contribution
-	//      double dsigma_nlo = m_grids[1][iobs]->convolute(pdf, m_genpdf, alphas, m_leading_order+1, 0);
-	// GPS: the NLO piece must use the same rscale_factor and fscale_factor as
-	//      the LO piece -- that's the convention that defines how NLO calculations
-	//      are done.
-	double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale);
-	// std::cout << "dsigma_nlo=" << dsigma_nlo << std::endl;
+
+	// will eventually add the other nlo terms ...
+	double dsigma_lo  = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order,   0, rscale_factor, fscale_factor, Escale);
+	double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, rscale_factor, fscale_factor, Escale);
+  
 	dsigma = dsigma_lo + dsigma_nlo;
       }
-      else if ( nloops==-1 ) {
-	label = "nlo only";
-
-	// nlo contribution only 
-	if ( subproc()==-1 ) { 
-	  double dsigma_log = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, -1, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale);
-	  double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1,  0, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale);
-	  dsigma = dsigma_nlo + dsigma_log;
-	}
-	else { 
-	  /// fixme: this is technically incorrect - the "LO" component contains the 
-	  ///        scale dependent NLO contribution dependent on the LO coefficient
-	  ///        functions. This part is difficult to include for individual 
-	  ///        subprocesses, since different subprocesses can be present 
-	  ///        at LO and NLO, so speifying subprocess X at NLO does not 
-	  ///        neccessarily correspond to subprocess X at LO, so adding the 
-	  ///        subprocesses - so these terms are only strict LO And NLO when 
-	  ///        *not* specifying subprocess
-	  dsigma = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1,  0, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale);
-	}
+      else if ( nloops==-1 ) { 
+	label = "nlo     ";
+	// next to leading order cross section
+	// leading order contribution and scale dependent born dependent terms
 
-      } 
-      else if ( nloops==2 ) {
-	// FIXME: not implemented completely yet - no scale variation
-	//      return hvec;
-	label = "nnlo    ";
-	// next to next to leading order contribution 
-	// NB: NO scale dependendent parts so only  muR=muF=mu
-	double dsigma_lo  = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, 0);
-	// next to leading order contribution      
-	double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0);
-	// next to next to leading order contribution
-	double dsigma_nnlo = m_grids[2][iobs]->convolute( _pdf1, _pdf2, m_genpdf[2], alphas, m_leading_order+2, 0);
-	dsigma = dsigma_lo + dsigma_nlo + dsigma_nnlo;
+	double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, rscale_factor, fscale_factor, Escale);
+
+	dsigma = dsigma_nlo;
       }
-      else if ( nloops==-2 ) {
-	label = "nnlo only";
-	// next to next to leading order contribution
-	dsigma = m_grids[2][iobs]->convolute( _pdf1, _pdf2, m_genpdf[2], alphas, m_leading_order+2, 0);
+
+
+      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+    }
+
+  }
+
+  /// now combine bins if required ...
+
+  correctAndCombine( hvec );
+
+  //  double _ctime = appl_timer_stop(_ctimer);
+  //  std::cout << "grid::convolute() " << label << " convolution time=" << _ctime << " ms" << std::endl;
+  
+  cache1.stats();
+  if ( cache2.ncalls() ) cache2.stats();
+  
+  return hvec;
+}
+
+
+
+
+TH1D* appl::grid::convolute(void (*pdf)(const double& , const double&, double* ), 
+			    double (*alphas)(const double& ), 
+			    int     nloops, 
+			    double  rscale_factor,
+			    double  fscale_factor,
+			    double Escale )
+{
+  return convolute( pdf, 0, alphas, nloops, rscale_factor, fscale_factor, Escale );
+}
+
+
+
+
+/// collect the igrid convolutions for each bin for the standard convolution
+void appl::grid::standard_terms( std::vector<term>& terms, 
+				 std::vector<int>& bins, std::vector<unsigned>& first_term, 
+				 std::string& label, 
+				 int nloops, double rscale_factor, double fscale_factor, double Escale ) { 
+
+  for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {  
+
+    /// here we see whether we need to emulate a dynamic scale by simply 
+    /// changing the renormalisation and factorisation scale terms to give 
+    /// what a dynamic scale would be in this bin
+ 
+    if ( m_bin!=-1 && iobs!=m_bin ) continue;
+
+    double dynamic_factor = 1;
+
+    if ( m_dynamicScale ) {
+      double var = m_obs_bins->GetBinCenter(iobs+1);
+      dynamic_factor = var/m_dynamicScale;
+      //	if ( first ) std::cout << "grid::vconvolute() bin " << iobs << "\tscale " << var << "\tdynamicScale " << m_dynamicScale << "\t scale factor " << dynamic_factor << std::endl;
+    } 
+
+    bins.push_back( iobs );
+    first_term.push_back( terms.size() );
+
+    load( iobs );
+
+    /// now do the convolution proper
+
+    if ( nloops==0 ) {
+      label = "lo      ";
+
+      /// leading order cross section
+
+      if ( subproc()==-1 ) {  
+	terms.push_back( term( m_grids[0][iobs], m_genpdf[0], m_leading_order, 0, dynamic_factor*rscale_factor, dynamic_factor*rscale_factor, Escale ) );
       }
       else { 
-	throw grid::exception( std::cerr << "invalid value for nloops " << nloops ); 
+	/// fixme: for the subproceses, this is technically incorrect - the "LO" contribution 
+	///        includes the scale dependent "NLO" terms that are proportional to the LO 
+	///        coefficient functions - it could use the strict "LO" part without the scale 
+	///        dependent parts using order "0" rather than order "1" but see the comment 
+	///        for the "NLO only" contribution. The reason for this is that the subprocesses
+	///        can be different for LO and NLO, so this NLO part with "LO coefficients", 
+	///        can have different subprocesses from the actual NLO part, so the correct 
+	///        LO/NLO separation is only guaranteed for the full convolution, and not by 
+	///        subprocess
+	terms.push_back( term( m_grids[0][iobs], m_genpdf[0], m_leading_order, 1, dynamic_factor*rscale_factor, dynamic_factor*rscale_factor, Escale ) );
+      }
+
+    }
+    else if ( nloops==1 ) { 
+      label = "nlo     ";
+      // next to leading order cross section
+      // std::cout << "convolute() nloop=1" << std::endl;
+      // leading order contribution and scale dependent born dependent terms
+      terms.push_back( term( m_grids[0][iobs], m_genpdf[0], m_leading_order, 1, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale ) );
+      // next to leading order contribution
+      //      double dsigma_nlo = m_grids[1][iobs]->convolute(pdf, m_genpdf, alphas, m_leading_order+1, 0);
+      // GPS: the NLO piece must use the same rscale_factor and fscale_factor as
+      //      the LO piece -- that's the convention that defines how NLO calculations
+      //      are done.
+      terms.push_back( term( m_grids[1][iobs], m_genpdf[1], m_leading_order+1, 0, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale ) );
+    }
+    else if ( nloops==-1 ) {
+      label = "nlo only";
+
+      // nlo contribution only 
+      if ( subproc()==-1 ) { 
+	terms.push_back( term( m_grids[0][iobs], m_genpdf[0], m_leading_order, -1, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale ) );
+	terms.push_back( term( m_grids[1][iobs], m_genpdf[1], m_leading_order+1, 0, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale ) );
+      }
+      else { 
+	/// fixme: this is technically incorrect - the "LO" component contains the 
+	///        scale dependent NLO contribution dependent on the LO coefficient
+	///        functions. This part is difficult to include for individual 
+	///        subprocesses, since different subprocesses can be present 
+	///        at LO and NLO, so speifying subprocess X at NLO does not 
+	///        neccessarily correspond to subprocess X at LO, so adding the 
+	///        subprocesses - so these terms are only strict LO And NLO when 
+	///        *not* specifying subprocess
+	terms.push_back( term( m_grids[1][iobs], m_genpdf[1], m_leading_order+1, 0, dynamic_factor*rscale_factor, dynamic_factor*fscale_factor, Escale ) );
+      }
+
+    } 
+    else if ( nloops==2 ) {
+      // FIXME: not implemented completely yet - no scale variation
+      //      return hvec;
+      label = "nnlo    ";
+      // next to next to leading order contribution 
+      // NB: NO scale dependendent parts so only  muR=muF=mu
+      terms.push_back( term( m_grids[0][iobs], m_genpdf[0], m_leading_order, 0 ) );
+      // next to leading order contribution      
+      terms.push_back( term( m_grids[1][iobs], m_genpdf[1], m_leading_order+1, 0 ) );
+      // next to next to leading order contribution
+      terms.push_back( term( m_grids[2][iobs], m_genpdf[2], m_leading_order+2, 0 ) );
+    }
+    else if ( nloops==-2 ) {
+      label = "nnlo only";
+      // next to next to leading order contribution
+      terms.push_back( term( m_grids[2][iobs], m_genpdf[2], m_leading_order+2, 0 ) );
+    }
+    else { 
+      throw grid::exception( std::cerr << "invalid value for nloops " << nloops ); 
+    }
+  }
+
+  first_term.push_back( terms.size() );
+}
+
+
+
+/// calculate all the igrid convolutions - without threads this is just the 
+/// serial convolution, otherwise the pdf tables are all set up first, in 
+/// this thread, so that the pdf and alphas functions need not be thread safe, 
+/// and then the convolutions of the weights are shared out between the threads
+void appl::grid::convolute_terms( std::vector<term>& terms, 
+				  NodeCache* pdf0, NodeCache* pdf1, double (*alphas)(const double& ) ) { 
+
+  /// the pdf and alpha_s tables are shared between all the igrids, 
+  /// so the pdf is only evaluated once for each distinct node, and  
+  /// with the persistent cache, only for the first convolution 
+  nodetables  _tables;
+  nodetables& tables = ( m_cache ? *m_cache : _tables );
+
+  /// serially, without the persistent cache, only the tables for the igrid  
+  /// being convoluted, and for the next, are held at any time, so that only 
+  /// consecutive igrids with the same nodes, eg for an unoptimised grid, 
+  /// share their tables
+  if ( m_threads<=1 && m_cache==0 ) { 
+    term* last = 0;
+    for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+      term& t = terms[i];
+      t.dsigma = 0;
+      tables.mark();
+      bool setup = t.m_g->convolute_setup( tables, pdf0, pdf1, alphas, t.m_nloop, t.m_rscale_factor, t.m_fscale_factor, t.m_Escale );
+      appl::memory transient = tables.memory() + t.m_g->transient();
+      if ( last ) { 
+	transient += last->m_g->transient();
+	last->run();
+	last->m_g->convolute_cleanup();
+      }
+      m_transient = std::max( m_transient, transient );
+      tables.sweep();
+      last = ( setup ? &t : 0 );
+    }
+    if ( last ) { 
+      last->run();
+      last->m_g->convolute_cleanup();
+    }
+    return;
+  }
+
+  std::vector<threadpool::task*> tasks;
+  tasks.reserve( terms.size() );
+
+  /// the tables used now are those kept when the cache is limited 
+  tables.mark();
+
+  for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+    term& t = terms[i];
+    t.dsigma = 0;
+    /// an empty grid has no tables and contributes nothing
+    if ( t.m_g->convolute_setup( tables, pdf0, pdf1, alphas, t.m_nloop, t.m_rscale_factor, t.m_fscale_factor, t.m_Escale ) ) tasks.push_back( &t );
+  }
+
+  /// with threads all the tables are held until all the convolutions are done
+  appl::memory transient = tables.memory();
+  for ( unsigned i=0 ; i<tasks.size() ; i++ ) transient += static_cast<term*>(tasks[i])->m_g->transient();
+  m_transient = std::max( m_transient, transient );
+
+  if ( m_threads<=1 ) { 
+    for ( unsigned i=0 ; i<tasks.size() ; i++ ) tasks[i]->run();
+  }
+  else { 
+    if ( m_threadpool==0 ) m_threadpool = new threadpool( m_threads );
+    m_threadpool->run( tasks );
+  }
+
+  for ( unsigned i=0 ; i<tasks.size() ; i++ ) static_cast<term*>(tasks[i])->m_g->convolute_cleanup();
+
+  if ( m_cache ) m_cache->evict();
+}
+
+
+
+/// sum the separate contributions from the terms for each bin, in order, and 
+/// apply the corrections and combine the bins for each contribution, returning 
+/// xsec[iobs][ipart]
+std::vector<std::vector<double> > appl::grid::combine_parts( const std::vector<term>& terms, 
+							     const std::vector<int>& bins, const std::vector<unsigned>& first_term, 
+							     int Nparts, double scale ) { 
+
+  std::vector<std::vector<double> > xsec;
+
+  for ( int ip=0 ; ip<Nparts ; ip++ ) { 
+
+    std::vector<double> hvec;
+
+    for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
+
+      int iobs = bins[ibin];
+
+      double dsigma = 0;
+      for ( unsigned it=first_term[ibin] ; it<first_term[ibin+1] ; it++ ) { 
+	const std::vector<double>& dparts = terms[it].dparts;
+	if ( unsigned(ip)>=dparts.size() ) continue;
+	if ( it==first_term[ibin] ) dsigma  = dparts[ip];
+	else                        dsigma += dparts[ip];
+      }
+
+      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+      hvec.push_back( scale*dsigma/deltaobs );
+    }
+
+    correctAndCombine( hvec );
+
+    if ( xsec.size()==0 ) xsec.resize( hvec.size(), std::vector<double>(Nparts,0) );
+    
+    for ( unsigned iobs=0 ; iobs<hvec.size() ; iobs++ ) xsec[iobs][ip] = hvec[iobs];
+  }
+
+  return xsec;
+}
+
+
+
+/// apply the corrections and combine the bins 
+void appl::grid::correctAndCombine( std::vector<double>& hvec ) { 
+
+  std::vector<bool> applied(m_corrections.size(),false);
+
+  /// apply corrrections on the *uncombined* bins
+  if ( getApplyCorrections() ) applyCorrections(hvec, applied);
+  else { 
+    for ( unsigned i=m_corrections.size() ; i-- ; ) if ( getApplyCorrection(i) ) applied[i] = applyCorrection(i,hvec);
+  }
+
+
+  /// combine bins if required
+  if ( m_combine.size()!=0 ) { 
+    combineBins( hvec );
+
+    /// apply additional corrrections on the *combined* bins
+    /// NB: Only apply those that have not already been applied
+    if ( getApplyCorrections() ) applyCorrections(hvec, applied);
+    else { 
+      for ( unsigned i=m_corrections.size() ; i-- ; ) if ( getApplyCorrection(i) && !applied[i] ) applied[i] = applyCorrection(i,hvec);
+    }
+  }
+
+  /// check all corrections have been applied correctly
+  if ( getApplyCorrections() ) { 
+    unsigned appliedcorrections = 0;
+    for ( unsigned i=applied.size() ; i-- ; ) if ( applied[i] ) appliedcorrections++;
+    if ( appliedcorrections!=applied.size() ) throw grid::exception( std::cerr << "correction vector size does not match data "  ); 
+  }
+  else { 
+    unsigned Ncorrections = 0;
+    unsigned appliedcorrections = 0;
+    for ( unsigned i=m_corrections.size() ; i-- ; ) { 
+      if ( getApplyCorrection(i) ) { 
+	Ncorrections++;
+	if ( applied[i] ) appliedcorrections++;
       }
+    }
+    if ( appliedcorrections!=Ncorrections ) throw grid::exception( std::cerr << "correction vector size does not match data "  ); 
+  }
+}
+
+
+
+/// the pdfs are convoluted a chunk at a time, so that the memory for 
+/// the node caches and pdf tables, a few MB for each pdf, is bounded 
+/// however many members a pdf set has, while each pass over the 
+/// weights is still shared by many pdfs
+static const unsigned vpdfchunk = 32;
+
+
+/// perform the convolution for several pdfs at once 
+std::vector<std::vector<double> > appl::grid::vconvolute(const std::vector<void (*)(const double& , const double&, double* )>& pdfs, 
+							 double (*alphas)(const double& ), 
+							 int     nloops, 
+							 double  rscale_factor,
+							 double  fscale_factor,
+							 double  Escale ) 
+{
+
+  resettransient();
+
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::vconvolute() multiple pdf convolution only for standard grids" ); 
+
+  const unsigned Npdf = pdfs.size();
+
+  std::vector<std::vector<double> > xsec;
+
+  /// the splitting function tables need the hoppet evolution to be set 
+  /// up for each pdf in turn, so do the convolutions one pdf at a time
+  if ( nloops!=0 && ( fscale_factor!=1 || m_dynamicScale ) ) { 
+    for ( unsigned ipdf=0 ; ipdf<Npdf ; ipdf++ ) { 
+      std::vector<double> hvec = vconvolute( pdfs[ipdf], alphas, nloops, rscale_factor, fscale_factor, Escale );
+      if ( xsec.size()==0 ) xsec.resize( hvec.size(), std::vector<double>(Npdf,0) );
+      for ( unsigned iobs=0 ; iobs<hvec.size() ; iobs++ ) xsec[iobs][ipdf] = hvec[iobs];
+    }
+    return xsec;
+  }
+
+  if ( nloops>=m_order ) { 
+    std::cerr << "too many loops for grid nloops=" << nloops << "\tgrid=" << m_order << std::endl;   
+    return xsec;
+  } 
+
+  double Escale2 = 1;
+  if ( Escale!=1 ) Escale2 = Escale*Escale;
+  
+  double invNruns = 1;
+  if ( (!m_normalised) && run() ) invNruns /= double(run());
+
+  std::string label;
+
+  std::vector<term>     terms;
+  std::vector<int>      bins;
+  std::vector<unsigned> first_term;
+
+  standard_terms( terms, bins, first_term, label, nloops, rscale_factor, fscale_factor, Escale );
+
+  /// each igrid convolution for a chunk of the pdfs at once, the node 
+  /// caches and the igrid pdf tables are only held for the one chunk
+  std::vector<std::vector<double> > dsigmas( terms.size(), std::vector<double>(Npdf,0) );
+  for ( unsigned i0=0 ; i0<Npdf ; i0+=vpdfchunk ) { 
+
+    unsigned i1 = std::min( i0+vpdfchunk, Npdf );
+
+    std::vector<NodeCache*> caches(i1-i0);
+    for ( unsigned ipdf=i0 ; ipdf<i1 ; ipdf++ ) caches[ipdf-i0] = new NodeCache( pdfs[ipdf] );
+
+    for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+      term& t = terms[i];
+      std::vector<double> d = t.m_g->convolute( caches, t.m_genpdf, alphas, t.m_lo_order, t.m_nloop, t.m_rscale_factor, t.m_fscale_factor, t.m_Escale );
+      for ( unsigned ipdf=i0 ; ipdf<i1 ; ipdf++ ) dsigmas[i][ipdf] = d[ipdf-i0];
+    }
+
+    for ( unsigned ipdf=0 ; ipdf<caches.size() ; ipdf++ ) delete caches[ipdf];
+  }
+
+  /// sum the terms for each pdf exactly as for the single pdf convolution
+  for ( unsigned ipdf=0 ; ipdf<Npdf ; ipdf++ ) { 
+
+    std::vector<double> hvec;
+
+    for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
+
+      int iobs = bins[ibin];
+
+      double dsigma = dsigmas[first_term[ibin]][ipdf];
+      for ( unsigned it=first_term[ibin]+1 ; it<first_term[ibin+1] ; it++ ) dsigma += dsigmas[it][ipdf];
+
+      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+    }
+
+    correctAndCombine( hvec );
+
+    if ( xsec.size()==0 ) xsec.resize( hvec.size(), std::vector<double>(Npdf,0) );
+    
+    for ( unsigned iobs=0 ; iobs<hvec.size() ; iobs++ ) xsec[iobs][ipdf] = hvec[iobs];
+  }
+
+  return xsec;
+}
+
+
+
+
+/// the convolution for several scale factor pairs in a single pass over 
+/// each igrid - the terms for each pair are the same igrid convolutions 
+/// with different scale factors, so each term is calculated for all the 
+/// pairs at once
+
+std::vector<std::vector<double> > appl::grid::vconvolute(void (*pdf)(const double& , const double&, double* ), 
+							 double (*alphas)(const double& ), 
+							 int     nloops, 
+							 const std::vector<std::pair<double,double> >& scales, 
+							 double  Escale ) 
+{
+
+  resettransient();
+
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::vconvolute() scale variation convolution only for standard grids" ); 
+
+  const unsigned Nscales = scales.size();
+
+  std::vector<std::vector<double> > xsec;
+
+  if ( nloops>=m_order ) { 
+    std::cerr << "too many loops for grid nloops=" << nloops << "\tgrid=" << m_order << std::endl;   
+    return xsec;
+  } 
+
+  if ( Nscales==0 ) return xsec;
+
+#ifdef HAVE_HOPPET
+  if ( nloops!=0 ) { 
+    bool split = m_dynamicScale;
+    for ( unsigned is=0 ; is<Nscales ; is++ ) if ( scales[is].second!=1 ) split = true;
+    if ( split ) setupSplitting( pdf, m_cmsScale );
+  }
+#endif
+
+  double Escale2 = 1;
+  if ( Escale!=1 ) Escale2 = Escale*Escale;
+  
+  double invNruns = 1;
+  if ( (!m_normalised) && run() ) invNruns /= double(run());
+
+  std::string label;
+
+  /// the terms are the same for each scale pair, only the scale factors differ
+  std::vector<std::vector<term> > terms( Nscales );
+  std::vector<int>      bins;
+  std::vector<unsigned> first_term;
+
+  for ( unsigned is=0 ; is<Nscales ; is++ ) { 
+    bins.clear();
+    first_term.clear();
+    standard_terms( terms[is], bins, first_term, label, nloops, scales[is].first, scales[is].second, Escale );
+  }
+
+  NodeCache cache( pdf );
+  cache.reset();
+
+  const unsigned Nterms = terms[0].size();
+
+  std::vector<std::vector<double> > dsigmas( Nterms );
+  std::vector<std::pair<double,double> > factors( Nscales );
+  for ( unsigned i=0 ; i<Nterms ; i++ ) { 
+    for ( unsigned is=0 ; is<Nscales ; is++ ) factors[is] = std::pair<double,double>( terms[is][i].m_rscale_factor, terms[is][i].m_fscale_factor ); 
+    term& t = terms[0][i];
+    dsigmas[i] = t.m_g->convolute( &cache, 0, t.m_genpdf, alphas, t.m_lo_order, t.m_nloop, factors, t.m_Escale );
+  }
+
+  /// sum the terms for each scale pair exactly as for the single convolution
+  for ( unsigned is=0 ; is<Nscales ; is++ ) { 
+
+    std::vector<double> hvec;
+
+    for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
+
+      int iobs = bins[ibin];
+
+      double dsigma = dsigmas[first_term[ibin]][is];
+      for ( unsigned it=first_term[ibin]+1 ; it<first_term[ibin+1] ; it++ ) dsigma += dsigmas[it][is];
+
+      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+    }
+
+    correctAndCombine( hvec );
+
+    if ( xsec.size()==0 ) xsec.resize( hvec.size(), std::vector<double>(Nscales,0) );
+    
+    for ( unsigned iobs=0 ; iobs<hvec.size() ; iobs++ ) xsec[iobs][is] = hvec[iobs];
+  }
+
+  return xsec;
+}
+
+
+
+/// the convolution and its jacobian - the jacobians of the igrid 
+/// convolutions are summed for each bin, and then the bin corrections 
+/// and combination, which are linear, are applied to the jacobians by 
+/// applying them to each unit vector in turn
+
+std::vector<double> appl::grid::vconvolute_jacobian(std::vector<std::vector<pdfnode> >& jacobian, 
+						    void (*pdf)(const double& , const double&, double* ), 
+						    double (*alphas)(const double& ), 
+						    int     nloops, 
+						    double  rscale_factor, 
+						    double  Escale ) 
+{
+
+  resettransient();
+
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::vconvolute_jacobian() jacobian only for standard grids" ); 
+
+  /// the emulated dynamic scale needs the splitting functions
+  if ( m_dynamicScale && nloops!=0 ) throw grid::exception( std::cerr << "grid::vconvolute_jacobian() no jacobian with dynamic scale" ); 
+
+  jacobian.clear();
+
+  std::vector<double> hvec;
+
+  if ( nloops>=m_order ) { 
+    std::cerr << "too many loops for grid nloops=" << nloops << "\tgrid=" << m_order << std::endl;   
+    return hvec;
+  } 
+
+  double Escale2 = 1;
+  if ( Escale!=1 ) Escale2 = Escale*Escale;
+  
+  double invNruns = 1;
+  if ( (!m_normalised) && run() ) invNruns /= double(run());
+
+  std::string label;
+
+  std::vector<term>     terms;
+  std::vector<int>      bins;
+  std::vector<unsigned> first_term;
+
+  standard_terms( terms, bins, first_term, label, nloops, rscale_factor, 1, Escale );
+
+  /// folding moves the weights between the beams, only the sum is kept
+  for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+    if ( terms[i].m_g->folded() ) throw grid::exception( std::cerr << "grid::vconvolute_jacobian() not available for folded grids" ); 
+  }
+
+  NodeCache cache( pdf );
+  cache.reset();
+
+  /// the jacobian for each bin before any corrections or combination
+  std::vector<std::vector<pdfnode> > _jacobian( bins.size() );
+
+  for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
+
+    int iobs = bins[ibin];
+
+    double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+    double norm     = invNruns*Escale2/deltaobs;
+
+    double dsigma = 0;
+
+    std::vector<pdfnode> nodes;
+
+    for ( unsigned it=first_term[ibin] ; it<first_term[ibin+1] ; it++ ) { 
+      term& t = terms[it];
+      double _dsigma = t.m_g->jacobian( &cache, 0, t.m_genpdf, alphas, t.m_lo_order, t.m_nloop, 
+					t.m_rscale_factor, t.m_fscale_factor, t.m_Escale, nodes );
+      if ( it==first_term[ibin] ) dsigma  = _dsigma;
+      else                        dsigma += _dsigma;
+    }
+
+    hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+
+    /// merge the nodes from the different igrids for this bin
+    std::map<std::pair<int,std::pair<double,double> >, unsigned> index;
+
+    for ( unsigned in=0 ; in<nodes.size() ; in++ ) { 
+      std::pair<int,std::pair<double,double> > key( nodes[in].beam, std::pair<double,double>( nodes[in].x, nodes[in].Q ) );
+      std::map<std::pair<int,std::pair<double,double> >, unsigned>::iterator itr = index.find( key );
+      if ( itr==index.end() ) { 
+	index.insert( std::make_pair( key, _jacobian[ibin].size() ) );
+	_jacobian[ibin].push_back( nodes[in] );
+	for ( int ip=0 ; ip<14 ; ip++ ) _jacobian[ibin].back().d[ip] *= norm;
+      }
+      else { 
+	pdfnode& n = _jacobian[ibin][itr->second];
+	for ( int ip=0 ; ip<14 ; ip++ ) n.d[ip] += nodes[in].d[ip]*norm;
+      }
+    }
+  }
+
+  /// the bin corrections and combination for each bin 
+  std::vector<std::vector<double> > weights( bins.size() );
+  for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
+    weights[ibin] = std::vector<double>( bins.size(), 0 );
+    weights[ibin][ibin] = 1;
+    correctAndCombine( weights[ibin] );
+  }
+
+  correctAndCombine( hvec );
+
+  jacobian.resize( hvec.size() );
+
+  for ( unsigned iobs=0 ; iobs<hvec.size() ; iobs++ ) { 
+
+    std::map<std::pair<int,std::pair<double,double> >, unsigned> index;
+
+    for ( unsigned ibin=0 ; ibin<bins.size() ; ibin++ ) { 
+
+      double w = weights[ibin][iobs];
+      if ( w==0 ) continue;
+
+      for ( unsigned in=0 ; in<_jacobian[ibin].size() ; in++ ) { 
+	const pdfnode& node = _jacobian[ibin][in];
+	std::pair<int,std::pair<double,double> > key( node.beam, std::pair<double,double>( node.x, node.Q ) );
+	std::map<std::pair<int,std::pair<double,double> >, unsigned>::iterator itr = index.find( key );
+	if ( itr==index.end() ) { 
+	  index.insert( std::make_pair( key, jacobian[iobs].size() ) );
+	  jacobian[iobs].push_back( node );
+	  for ( int ip=0 ; ip<14 ; ip++ ) jacobian[iobs].back().d[ip] *= w;
+	}
+	else { 
+	  pdfnode& n = jacobian[iobs][itr->second];
+	  for ( int ip=0 ; ip<14 ; ip++ ) n.d[ip] += node.d[ip]*w;
+	}
+      }
+    }
+  }
+
+  return hvec;
+}
+
+
+
+/// the partial sums for each igrid convolution in the standard convolution, 
+/// the scale factors for the terms are the emulated dynamic scale factors, 
+/// multiplied by the rscale_factor in vconvolute_partialsums() 
+
+void appl::grid::setupPartialSums(void (*pdf)(const double& , const double&, double* ), 
+				  int     nloops, 
+				  double  fscale_factor, 
+				  double  Escale ) 
+{
+
+  resettransient();
+
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::setupPartialSums() partial sums only for standard grids" ); 
+
+  if ( nloops>=m_order ) throw grid::exception( std::cerr << "grid::setupPartialSums() too many loops for grid nloops=" << nloops << "\tgrid=" << m_order ); 
+
+  clearPartialSums();
+
+#ifdef HAVE_HOPPET
+  if ( nloops!=0 && ( fscale_factor!=1 || m_dynamicScale ) ) setupSplitting( pdf, m_cmsScale );
+#endif
+
+  m_partialsums = new partialsums;
+  m_partialsums->nloops        = nloops;
+  m_partialsums->fscale_factor = fscale_factor;
+  m_partialsums->Escale        = Escale;
+
+  std::string label;
+
+  /// for the leading order, both scales are set by the rscale_factor
+  double rscale_factor = ( nloops==0 ? fscale_factor : 1 );
+
+  standard_terms( m_partialsums->terms, m_partialsums->bins, m_partialsums->first_term, label, nloops, rscale_factor, fscale_factor, Escale );
+
+  NodeCache cache( pdf );
+  cache.reset();
+
+  std::vector<term>& terms = m_partialsums->terms;
+
+  m_partialsums->S0.resize( terms.size() );
+  m_partialsums->SF.resize( terms.size() );
+
+  for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+    term& t = terms[i];
+    t.m_g->partialsums( &cache, 0, t.m_genpdf, t.m_nloop, t.m_fscale_factor, t.m_Escale, m_partialsums->S0[i], m_partialsums->SF[i] );
+  }
+}
+
+
+
+std::vector<double> appl::grid::vconvolute_partialsums(double (*alphas)(const double& ), double rscale_factor ) 
+{
+
+  resettransient();
+
+  if ( m_partialsums==0 ) throw grid::exception( std::cerr << "grid::vconvolute_partialsums() partial sums not set up" ); 
+
+  const partialsums& p = *m_partialsums;
+
+  if ( p.nloops==0 && rscale_factor!=p.fscale_factor ) { 
+    throw grid::exception( std::cerr << "grid::vconvolute_partialsums() leading order partial sums are for rscale_factor " << p.fscale_factor );
+  }
+
+  double Escale2 = 1;
+  if ( p.Escale!=1 ) Escale2 = p.Escale*p.Escale;
+  
+  double invNruns = 1;
+  if ( (!m_normalised) && run() ) invNruns /= double(run());
+
+  std::vector<double> dsigmas( p.terms.size(), 0 );
+  for ( unsigned i=0 ; i<p.terms.size() ; i++ ) { 
+    const term& t = p.terms[i];
+    double _rscale_factor = ( p.nloops==0 ? t.m_rscale_factor : t.m_rscale_factor*rscale_factor );
+    dsigmas[i] = t.m_g->convolute( p.S0[i], p.SF[i], alphas, t.m_lo_order, t.m_nloop, _rscale_factor, t.m_fscale_factor );
+  }
+
+  std::vector<double> hvec;
+
+  for ( unsigned ibin=0 ; ibin<p.bins.size() ; ibin++ ) { 
+
+    int iobs = p.bins[ibin];
+
+    double dsigma = dsigmas[p.first_term[ibin]];
+    for ( unsigned it=p.first_term[ibin]+1 ; it<p.first_term[ibin+1] ; it++ ) dsigma += dsigmas[it];
+
+    double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
+    hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+  }
+
+  correctAndCombine( hvec );
+
+  return hvec;
+}
+
 
-      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
-      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
-    }
 
-    first = false;
-    
-  }
-  else if ( m_type==AMCATNLO ) {  
+void appl::grid::clearPartialSums() { 
+  if ( m_partialsums ) delete m_partialsums;
+  m_partialsums = 0;
+}
 
-    //    std::cout << "amc@NLO convolution" << std::endl;
-    
-    for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {  
 
-      double dsigma = 0; 
-      
-      if ( nloops==0 ) {
-	  /// this is the amcatnlo LO calculation (without FKS shower)
-	  label = "lo";
-	  /// work out how to call from the igrid - maybe just implement additional 
-	  double dsigma_B = m_grids[3][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[3], alphas, m_leading_order,   0, rscale_factor, fscale_factor,  Escale );
- 
-   	  dsigma = dsigma_B;
-      }
-      else if ( nloops==1 || nloops==-1 ) {
-	  /// this is the amcatnlo NLO calculation (without FKS shower)
-	  /// Next-to-leading order contribution
-	  label = "nlo only"; /// for the time being ...
 
-	  // Scale independent contribution
-	  double dsigma_0 = m_grids[0][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
-	  dsigma = dsigma_0;
+/// the standard 7 or 9 point scale variations, the central 
+/// scale first, then the factors of two, or one half   
+std::vector<std::pair<double,double> > appl::grid::scaleVariations(int npoints) { 
 
-	  // Renormalization scale dependent contribution
-	  if ( rscale_factor!=1 ) { 
-	    double dsigma_R = m_grids[1][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
-	    dsigma += dsigma_R*std::log(rscale_factor*rscale_factor);
-	  }
+  if ( npoints!=7 && npoints!=9 ) throw grid::exception( std::cerr << "grid::scaleVariations() only 7 or 9 point variations, not " << npoints ); 
 
-	  // Factorization scale dependent contribution
-	  if ( fscale_factor!=1 ) { 
-	    double dsigma_F = m_grids[2][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[2], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
-	    dsigma += dsigma_F*std::log(fscale_factor*fscale_factor);
-	  }
-      
-	  /// Add the LO contribution if we want full NLO 
-	  /// rather than specific NLO contribution only  
-	  if ( nloops==1 ) { 
-	    /// this is the amcatnlo NLO calculation (without FKS shower)
-	    label = "nlo";
-	    /// work out how to call from the igrid - maybe just implement additional 
-	    /// convolution routines and call them here
-	    double dsigma_B = m_grids[3][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[3], alphas, m_leading_order,   0,  rscale_factor, fscale_factor,  Escale );	
-	    dsigma += dsigma_B;
-	  }
-      }
-      else if ( nloops==-2 ) { 
-        /// Only the convolution from the W0 grid
-        label = "nlo_w0";
-	double dsigma_0 = m_grids[0][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
-	dsigma = dsigma_0;
-      }
-      else if ( nloops==-3 ) {
-	/// Only the convolution from the WR grid
-	label = "nlo_wR";
-	double dsigma_R = m_grids[1][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, rscale_factor, fscale_factor,  Escale );
-	dsigma = dsigma_R * std::log(rscale_factor*rscale_factor)  ;
-      }
-      else if ( nloops==-4 ) { 
-        /// Only the convolution from the WF grid
-        label = "nlo_wF";
-	double dsigma_F = m_grids[2][iobs]->amc_convolute( _pdf1, _pdf2, m_genpdf[2], alphas, m_leading_order+1, 0,  rscale_factor, fscale_factor,  Escale );
-	dsigma = dsigma_F * std::log(fscale_factor*fscale_factor) ;
-      }
-      else { 
-	throw grid::exception( std::cerr << "invalid value for nloops " << nloops ); 
-      }
+  static const double factors[3] = { 1, 0.5, 2 };
 
-      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
-      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
+  std::vector<std::pair<double,double> > scales;
+  for ( int ir=0 ; ir<3 ; ir++ ) { 
+    for ( int jf=0 ; jf<3 ; jf++ ) { 
+      /// the 7 point variation excludes the opposite variations
+      if ( npoints==7 && factors[ir]*factors[jf]==1 && ir!=jf ) continue;
+      scales.push_back( std::pair<double,double>( factors[ir], factors[jf] ) );
     }
   }
-  else if ( m_type == SHERPA ) { 
-    
-    //    std::cout << "sherpa convolution" << std::endl;
 
-    for ( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) {  
-    
-      double dsigma = 0; 
-  
-      if ( nloops==0 ) {
-	label = "lo      ";
-	// leading order cross section
-	dsigma = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order, 0, 1, 1, Escale);
-      }
-      else if ( nloops==1 ) { 
-	label = "nlo     ";
-	// next to leading order cross section
-	// leading order contribution and scale dependent born dependent terms
+  return scales;
+}
 
-	// will eventually add the other nlo terms ...
-	double dsigma_lo  = m_grids[0][iobs]->convolute( _pdf1, _pdf2, m_genpdf[0], alphas, m_leading_order,   0, rscale_factor, fscale_factor, Escale);
-	double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, rscale_factor, fscale_factor, Escale);
-  
-	dsigma = dsigma_lo + dsigma_nlo;
-      }
-      else if ( nloops==-1 ) { 
-	label = "nlo     ";
-	// next to leading order cross section
-	// leading order contribution and scale dependent born dependent terms
 
-	double dsigma_nlo = m_grids[1][iobs]->convolute( _pdf1, _pdf2, m_genpdf[1], alphas, m_leading_order+1, 0, rscale_factor, fscale_factor, Escale);
 
-	dsigma = dsigma_nlo;
-      }
+/// all the subprocesses in a single pass - the terms are those for a single 
+/// subprocess, but each igrid convolution then calculates all subprocesses 
 
+std::vector<std::vector<double> > appl::grid::vconvolute_subprocs(void (*pdf)(const double& , const double&, double* ), 
+								  double (*alphas)(const double& ), 
+								  int     nloops, 
+								  double  rscale_factor, double Escale ) 
+{ 
 
-      double deltaobs = m_obs_bins->GetBinLowEdge(iobs+2)-m_obs_bins->GetBinLowEdge(iobs+1);      
-      hvec.push_back( invNruns*Escale2*dsigma/deltaobs );
-    }
+  resettransient();
 
-  }
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::vconvolute_subprocs() subprocess convolution only for standard grids" ); 
 
-  /// now combine bins if required ...
+  std::vector<std::vector<double> > xsec;
 
-  std::vector<bool> applied(m_corrections.size(),false);
+  if ( nloops>=m_order ) { 
+    std::cerr << "too many loops for grid nloops=" << nloops << "\tgrid=" << m_order << std::endl;   
+    return xsec;
+  } 
 
-  /// apply corrrections on the *uncombined* bins
-  if ( getApplyCorrections() ) applyCorrections(hvec, applied);
-  else { 
-    for ( unsigned i=m_corrections.size() ; i-- ; ) if ( getApplyCorrection(i) ) applied[i] = applyCorrection(i,hvec);
-  }
+  /// as in vconvolute_subproc(), both scales are set by the rscale_factor
+  double fscale_factor = rscale_factor;
 
+#ifdef HAVE_HOPPET
+  if ( fscale_factor!=1 || m_dynamicScale ) setupSplitting( pdf, m_cmsScale );
+#endif
 
-  /// combine bins if required
-  if ( m_combine.size()!=0 ) { 
-    combineBins( hvec );
+  double Escale2 = 1;
+  if ( Escale!=1 ) Escale2 = Escale*Escale;
+  
+  double invNruns = 1;
+  if ( (!m_normalised) && run() ) invNruns /= double(run());
 
-    /// apply additional corrrections on the *combined* bins
-    /// NB: Only apply those that have not already been applied
-    if ( getApplyCorrections() ) applyCorrections(hvec, applied);
-    else { 
-      for ( unsigned i=m_corrections.size() ; i-- ; ) if ( getApplyCorrection(i) && !applied[i] ) applied[i] = applyCorrection(i,hvec);
-    }
-  }
+  std::string label;
 
-  /// check all corrections have been applied correctly
-  if ( getApplyCorrections() ) { 
-    unsigned appliedcorrections = 0;
-    for ( unsigned i=applied.size() ; i-- ; ) if ( applied[i] ) appliedcorrections++;
-    if ( appliedcorrections!=applied.size() ) throw grid::exception( std::cerr << "correction vector size does not match data "  ); 
+  std::vector<term>     terms;
+  std::vector<int>      bins;
+  std::vector<unsigned> first_term;
+
+  /// the terms for a selected subprocess
+  int subproc = m_subproc;
+  m_subproc = 0;
+  standard_terms( terms, bins, first_term, label, nloops, rscale_factor, fscale_factor, Escale );
+  m_subproc = subproc;
+
+  /// folding moves the weights to the conjugate subprocesses 
+  for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+    if ( terms[i].m_g->folded() ) throw grid::exception( std::cerr << "grid::vconvolute_subprocs() not available for folded grids" ); 
   }
-  else { 
-    unsigned Ncorrections = 0;
-    unsigned appliedcorrections = 0;
-    for ( unsigned i=m_corrections.size() ; i-- ; ) { 
-      if ( getApplyCorrection(i) ) { 
-	Ncorrections++;
-	if ( applied[i] ) appliedcorrections++;
-      }
-    }
-    if ( appliedcorrections!=Ncorrections ) throw grid::exception( std::cerr << "correction vector size does not match data "  ); 
+
+  int Nproc = 0;
+  for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+    terms[i].m_subprocs = true;
+    terms[i].dparts.resize( terms[i].m_g->SubProcesses(), 0 );
+    if ( terms[i].m_g->SubProcesses()>Nproc ) Nproc = terms[i].m_g->SubProcesses();
   }
 
-  //  double _ctime = appl_timer_stop(_ctimer);
-  //  std::cout << "grid::convolute() " << label << " convolution time=" << _ctime << " ms" << std::endl;
-  
-  cache1.stats();
-  if ( cache2.ncalls() ) cache2.stats();
-  
-  return hvec;
+  NodeCache cache( pdf );
+  cache.reset();
+
+  convolute_terms( terms, &cache, 0, alphas );
+
+  return combine_parts( terms, bins, first_term, Nproc, invNruns*Escale2 );
 }
 
 
 
+/// the contributions with no, one and two incoming photons in a single pass 
+std::vector<std::vector<double> > appl::grid::vconvolute_photons(void (*pdf)(const double& , const double&, double* ), 
+								 double (*alphas)(const double& ), 
+								 int     nloops, 
+								 double  rscale_factor,
+								 double  fscale_factor,
+								 double  Escale ) 
+{ 
 
-TH1D* appl::grid::convolute(void (*pdf)(const double& , const double&, double* ), 
-			    double (*alphas)(const double& ), 
-			    int     nloops, 
-			    double  rscale_factor,
-			    double  fscale_factor,
-			    double Escale )
-{
-  return convolute( pdf, 0, alphas, nloops, rscale_factor, fscale_factor, Escale );
-}
+  resettransient();
+
+  if ( m_type!=STANDARD ) throw grid::exception( std::cerr << "grid::vconvolute_photons() photon convolution only for standard grids" ); 
+
+  std::vector<std::vector<double> > xsec;
+
+  if ( nloops>=m_order ) { 
+    std::cerr << "too many loops for grid nloops=" << nloops << "\tgrid=" << m_order << std::endl;   
+    return xsec;
+  } 
+
+#ifdef HAVE_HOPPET
+  if ( fscale_factor!=1 || m_dynamicScale ) setupSplitting( pdf, m_cmsScale );
+#endif
+
+  double Escale2 = 1;
+  if ( Escale!=1 ) Escale2 = Escale*Escale;
+  
+  double invNruns = 1;
+  if ( (!m_normalised) && run() ) invNruns /= double(run());
+
+  std::string label;
+
+  std::vector<term>     terms;
+  std::vector<int>      bins;
+  std::vector<unsigned> first_term;
 
+  standard_terms( terms, bins, first_term, label, nloops, rscale_factor, fscale_factor, Escale );
+
+  for ( unsigned i=0 ; i<terms.size() ; i++ ) { 
+    if ( terms[i].m_g->isDISgrid() ) throw grid::exception( std::cerr << "grid::vconvolute_photons() not available for DIS grids" ); 
+    terms[i].m_photons = true;
+    terms[i].dparts.resize( 3, 0 );
+  }
+
+  NodeCache cache( pdf );
+  cache.reset();
+
+  convolute_terms( terms, &cache, 0, alphas );
+
+  return combine_parts( terms, bins, first_term, 3, invNruns*Escale2 );
+}
 
 
 
@@ -1640,6 +3257,14 @@ std::vector<double> appl::grid::vconvolute_subproc(int subproc,
 						   int     nloops, 
 						   double  rscale_factor, double Escale ) 
 { 
+  /// folding moves the weights to the conjugate subprocesses 
+  load();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
+      if ( m_grids[iorder][iobs]->folded() ) throw grid::exception( std::cerr << "grid::vconvolute_subproc() not available for folded grids" ); 
+    }
+  }
+
   /// set the subprocess index - this is tested by the 
   /// igrid convolution
   m_subproc = subproc;
@@ -1743,6 +3368,7 @@ TH1D* appl::grid::convolute_subproc(int subproc,
 
 void appl::grid::optimise(bool force) {
   if ( !force && m_optimised ) return;
+  load();
   m_optimised = true;
   m_read = false;
   for ( int iorder=0 ; iorder<m_order ; iorder++ ) { 
@@ -1761,6 +3387,7 @@ void appl::grid::optimise(int NQ2, int Nx) {  optimise(NQ2, Nx, Nx);  }
 
 
 void appl::grid::optimise(int NQ2, int Nx1, int Nx2) {
+  load();
   m_optimised = true;
   m_read = false;
   for ( int iorder=0 ; iorder<m_order ; iorder++ ) { 
@@ -1797,6 +3424,8 @@ void appl::grid::redefine(int iobs, int iorder,
 	      << "\tNx=" << Nx  << "\txmin=" <<            xmin  << "\txmax=" <<            xmax << std::endl; 
   }
   
+  load( iobs );
+
   igrid* oldgrid = m_grids[iorder][iobs];
   
   //  m_grids[iorder][iobs]->redefine(NQ2, Q2min, Q2max, Nx, xmin, xmax);
@@ -1912,14 +3541,29 @@ void appl::grid::setRange(double lower, double upper, double xScaleFactor) {
   
   int _Nobs = m_obs_bins->GetNbinsX();
 
+  /// for a lazily read grid, the igrids not yet read must still be 
+  /// read from their original bins in the file
+  if ( m_lazyfile ) pthread_mutex_lock( &m_lazyfile->lock );
+
   for ( int iorder=0 ; iorder<m_order ; iorder++ ) { 
     m_grids[iorder] = new igrid*[_Nobs];
     int iobs = 0;
     for ( int igrid=0 ; igrid<h->GetNbinsX() ; igrid++ ) {
       if ( used[igrid] ) m_grids[iorder][iobs++] = grids[iorder][igrid];
-      else               delete grids[iorder][igrid];                           
+      else { 
+	if ( m_lazyfile && grids[iorder][igrid]==0 ) m_lazyfile->unread--;
+	delete grids[iorder][igrid];                           
+      }
     }
   }
+
+  if ( m_lazyfile ) { 
+    std::vector<int> bins;
+    for ( unsigned i=0 ; i<used.size() ; i++ ) if ( used[i] ) bins.push_back( m_lazyfile->bins[i] );
+    m_lazyfile->bins = bins;
+    if ( m_lazyfile->unread==0 ) m_lazyfile->close();
+    pthread_mutex_unlock( &m_lazyfile->lock );
+  }
   
   m_obs_bins_combined = m_obs_bins; 
 
@@ -1988,13 +3632,122 @@ void appl::grid::addCorrection(TH1D* h, const std::string& label, double scale,
 // find the number of words used for storage
 int appl::grid::size() const { 
     int _size = 0;
-    for( int iorder=0 ; iorder<2 ; iorder++ ) {
-      for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) _size += m_grids[iorder][iobs]->size();
+    for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+      for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) if ( m_grids[iorder][iobs] ) _size += m_grids[iorder][iobs]->size();
     }
     return _size;
 }
 
 
+/// the grid itself, the internal grids, and the persistent node tables 
+/// if the grid owns them - the reference histograms and the pdf 
+/// combinations are not included 
+appl::memory appl::grid::memory() const { 
+  appl::memory m( sizeof(grid), 1 );
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    m += appl::memory( Nobs_internal()*sizeof(igrid*), 1 );
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) if ( m_grids[iorder][iobs] ) m += m_grids[iorder][iobs]->memory();
+  }
+  if ( m_cache && m_ownCache ) m += appl::memory( sizeof(nodetables), 1 ) + m_cache->memory();
+  return m;
+}
+
+appl::memory appl::grid::memory(int iorder, int iobs) const { 
+  if ( m_grids[iorder][iobs]==0 ) return appl::memory();
+  return m_grids[iorder][iobs]->memory();
+}
+
+appl::memory appl::grid::memory(int iorder, int iobs, int ip) const { 
+  if ( m_grids[iorder][iobs]==0 ) return appl::memory();
+  return m_grids[iorder][iobs]->memory(ip);
+}
+
+
+/// the tables for all the igrids together if they were set up at once, 
+/// otherwise for the igrid with the largest tables
+appl::memory appl::grid::peakmemory() const { 
+  appl::memory m = m_transient;
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) if ( m_grids[iorder][iobs] ) m = std::max( m, m_grids[iorder][iobs]->transient() );
+  }
+  return m;
+}
+
+/// read the igrids for bin iobs of a lazily read grid if they have not 
+/// already been read - the lock is always taken, since another thread 
+/// may be reading them at the same time
+void appl::grid::load(int ilower, int iupper) const { 
+
+  if ( m_lazyfile==0 ) return;
+
+  pthread_mutex_lock( &m_lazyfile->lock );
+
+  try { 
+    std::vector<std::string> names;
+    std::vector<igrid**>     slots;
+
+    for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+      for( int iobs=ilower ; iobs<=iupper ; iobs++ ) {
+	if ( m_grids[iorder][iobs] ) continue;
+	char name[128];  sprintf(name, (m_lazyfile->dirname+"/weight[alpha-%d][%03d]").c_str(), iorder, m_lazyfile->bins[iobs] );
+	names.push_back( name );
+	slots.push_back( &m_grids[iorder][iobs] );
+      }
+    }
+
+    if ( names.size() ) { 
+      std::vector<igrid*> grids = readigrids( *m_lazyfile->file, names, m_iothreads );
+      
+      for ( unsigned i=0 ; i<grids.size() ; i++ ) { 
+	grids[i]->setparent( const_cast<grid*>(this) ); 
+	*slots[i] = grids[i];
+      }
+
+      m_lazyfile->unread -= grids.size();
+      if ( m_lazyfile->unread==0 ) m_lazyfile->close();
+    }
+  }
+  catch (...) { 
+    pthread_mutex_unlock( &m_lazyfile->lock );
+    throw;
+  }
+
+  pthread_mutex_unlock( &m_lazyfile->lock );
+}
+
+void appl::grid::prefetch(int ilower, int iupper) { 
+  if ( ilower<0 ) ilower = 0;
+  if ( iupper>=Nobs_internal() ) iupper = Nobs_internal()-1;
+  load( ilower, iupper );
+}
+
+
+void appl::grid::resettransient() { 
+  m_transient = appl::memory();
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) if ( m_grids[iorder][iobs] ) m_grids[iorder][iobs]->resettransient();
+  }
+}
+
+
+std::ostream& appl::grid::printmemory(std::ostream& s) const { 
+  s << "grid memory\n";
+  s << std::setw(6) << "order" << std::setw(6) << "bin" << std::setw(14) << "bytes" << std::setw(12) << "allocations" << "\n";
+  for( int iorder=0 ; iorder<m_order ; iorder++ ) {
+    appl::memory total;
+    for( int iobs=0 ; iobs<Nobs_internal() ; iobs++ ) { 
+      appl::memory m = memory( iorder, iobs );
+      s << std::setw(6) << iorder << std::setw(6) << iobs << std::setw(14) << m.bytes << std::setw(12) << m.allocations << "\n";
+      total += m;
+    }
+    s << std::setw(6) << iorder << std::setw(6) << "all" << std::setw(14) << total.bytes << std::setw(12) << total.allocations << "\n";
+  }
+  s << "total:     " << memory()     << "\n";
+  s << "transient: " << peakmemory() << std::endl;
+  return s;
+}
+
+
 /// apply corrections to a std::vector
 void appl::grid::applyCorrections(std::vector<double>& v, std::vector<bool>& applied) {
  
@@ -2038,6 +3791,8 @@ void appl::grid::shrink(const std::string& name, int ckmcharge) {
 
   std::cout << "appl::grid::shrink()" << std::endl;
 
+  load();
+
   std::string label[3] = { "LO", "NLO", "NNLO" };
 
   std::string genpdfname="";
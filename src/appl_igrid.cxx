@@ -12,10 +12,13 @@
 #include <iostream>
 #include <iomanip>
 #include <cmath>
+#include <algorithm>
 
 
 #include "appl_igrid.h"
 #include "appl_grid/appl_grid.h"
+#include "appl_grid/appl_nodetables.h"
+#include "appl_grid/appl_binary.h"
 
 #include "hoppet_init.h"
 
@@ -55,11 +58,19 @@ appl::igrid::igrid() :
   m_transvar(transvar),
   m_reweight(false),
   m_symmetrise(false),
+  m_folded(false),
   m_optimised(false),
   m_weight(0),
+  m_nodes(NULL),
+  m_compiled(false),
+  m_cprecision(0),
+  m_factorised(false),
+  m_fresidual(0),
   m_fg1(0),     m_fg2(0),
   m_fsplit1(0), m_fsplit2(0),
-  m_alphas(0) { 
+  m_alphas(0),
+  m_sharedtables(false),
+  m_DISgrid(false) { 
 
   //  std::cout << "igrid() (default) Ntau=" << m_Ntau << "\t" << fQ2(m_taumin) << " - " << fQ2(m_taumax) << std::endl;
 
@@ -81,11 +92,18 @@ appl::igrid::igrid(int NQ2, double Q2min, double Q2max, int Q2order,
   m_transvar(transvar),
   m_reweight(false),
   m_symmetrise(false), 
+  m_folded(false),
   m_optimised(false),
   m_weight(0),
+  m_nodes(NULL),
+  m_compiled(false),
+  m_cprecision(0),
+  m_factorised(false),
+  m_fresidual(0),
   m_fg1(0),     m_fg2(0),  
   m_fsplit1(0), m_fsplit2(0),
   m_alphas(0),
+  m_sharedtables(false),
   m_DISgrid(disflag)   
 {
   //  std::cout << "igrid::igrid() transform=" << m_transform << std::endl;
@@ -167,11 +185,31 @@ appl::igrid::igrid(const appl::igrid& g) :
   m_transvar(g.m_transvar),
   m_reweight(g.m_reweight),
   m_symmetrise(g.m_symmetrise),
+  m_folded(g.m_folded),
+  m_conjugate(g.m_conjugate),
   m_optimised(g.m_optimised),
   m_weight(NULL),
+  m_nodes(NULL),
+  m_compiled(g.m_compiled),
+  m_ctau(g.m_ctau),
+  m_cy1(g.m_cy1),
+  m_cy2(g.m_cy2),
+  m_cweight(g.m_cweight),
+  m_cprecision(g.m_cprecision),
+  m_cweightf(g.m_cweightf),
+  m_cweight16(g.m_cweight16),
+  m_cscale(g.m_cscale),
+  m_factorised(g.m_factorised),
+  m_fresidual(g.m_fresidual),
+  m_fslice(g.m_fslice),
+  m_fbox(g.m_fbox),
+  m_fbase(g.m_fbase),
+  m_ffactor(g.m_ffactor),
   m_fg1(NULL),     m_fg2(NULL),
   m_fsplit1(NULL), m_fsplit2(NULL),
-  m_alphas(NULL)   
+  m_alphas(NULL),
+  m_sharedtables(false),
+  m_DISgrid(g.m_DISgrid)
 {
   init_fmap();
   if ( m_fmap.find(m_transform)==m_fmap.end() ) throw exception("igrid::igrid() transform " + m_transform + " not found\n");
@@ -181,12 +219,182 @@ appl::igrid::igrid(const appl::igrid& g) :
 
   m_weight = new SparseMatrix3d*[m_Nproc];
   for( int ip=0 ; ip<m_Nproc ; ip++ )   m_weight[ip] = new SparseMatrix3d(*g.m_weight[ip]);
+  if ( g.m_nodes ) m_nodes = new tsparse3d<double>(*g.m_nodes);
   //  construct();
 }
 
 
+// the number of values in each chunk of the sparse weights in a ROOT file
+static const size_t sparsechunk = 65536;
+
+
+// write weight iw of each node of a matrix to the current root directory, 
+// as its occupied ranges, then its values a chunk at a time, so that the 
+// only memory needed beyond the matrix itself is for the ranges and one 
+// chunk. The ranges are the tightest around the non-zero values, the same 
+// as for a weight read from a histogram, whether or not the matrix is 
+// trimmed or interleaved. Returns the memory that was needed
+static appl::memory writesparsematrix( const std::string& name, const tsparse3d<double>& m, int iw ) { 
+
+  const int Nx = m.Nx();
+  const int Ny = m.Ny();
+  const int Nz = m.Nz();
+  const int Nw = m.Nw();
+
+  std::vector<int> ylo( Nx, Ny ),     yhi( Nx, Ny-1 );
+  std::vector<int> zlo( Nx*Ny, Nz ),  zhi( Nx*Ny, Nz-1 );
+
+  int    lx = Nx;
+  int    ux = Nx-1;
+  size_t n  = 0;
+
+  for ( int i=m.xmin() ; i<=m.xmax() ; i++ ) { 
+    for ( int j=m.ylo(i) ; j<=m.yhi(i) ; j++ ) { 
+      int r = i*Ny+j;
+      const double* v = m.row(i,j);
+      for ( int k=m.zlo(i,j) ; k<=m.zhi(i,j) ; k++, v+=Nw ) { 
+	if ( v[iw]==0 ) continue;
+	if ( zlo[r]>zhi[r] ) zlo[r] = k;
+	zhi[r] = k;
+      }
+      if ( zlo[r]>zhi[r] ) continue;
+      n += zhi[r]-zlo[r]+1;
+      if ( ylo[i]>yhi[i] ) ylo[i] = j;
+      yhi[i] = j;
+    }
+    if ( ylo[i]>yhi[i] ) continue;
+    if ( lx>ux ) lx = i;
+    ux = i;
+  }
+
+  // the x range and number of values, the y range for each x bin, 
+  // and the z range for each row 
+  size_t nlayout = 3;
+  for ( int i=lx ; i<=ux ; i++ ) nlayout += 2 + 2*( yhi[i]>=ylo[i] ? yhi[i]-ylo[i]+1 : 0 );
+
+  TVectorT<double> layout(nlayout);
+
+  int p = 0;
+  layout(p++) = lx;
+  layout(p++) = ux;
+  layout(p++) = n;
+  for ( int i=lx ; i<=ux ; i++ ) { 
+    layout(p++) = ylo[i];
+    layout(p++) = yhi[i];
+    for ( int j=ylo[i] ; j<=yhi[i] ; j++ ) { 
+      layout(p++) = zlo[i*Ny+j];
+      layout(p++) = zhi[i*Ny+j];
+    }
+  }
+
+  layout.Write( name.c_str() );
+
+  // the values, row by row, split across the chunks 
+  TVectorT<double>* chunk = 0;
+  size_t nchunk  = 0;
+  size_t ichunk  = 0;
+  size_t written = 0;
+
+  for ( int i=lx ; i<=ux ; i++ ) { 
+    for ( int j=ylo[i] ; j<=yhi[i] ; j++ ) { 
+      int r = i*Ny+j;
+      if ( zlo[r]>zhi[r] ) continue;
+      const double* v = m.row(i,j) + (zlo[r]-m.zlo(i,j))*Nw;
+      for ( int k=zlo[r] ; k<=zhi[r] ; k++, v+=Nw ) { 
+	if ( chunk==0 ) { 
+	  nchunk = std::min( sparsechunk, n-written );
+	  chunk  = new TVectorT<double>(nchunk);
+	  ichunk = 0;
+	}
+	(*chunk)(ichunk++) = v[iw];
+	written++;
+	if ( ichunk==nchunk ) { 
+	  char cname[32];  sprintf( cname, "[%lu]", (unsigned long)((written-1)/sparsechunk) );
+	  chunk->Write( (name+cname).c_str() );
+	  delete chunk;
+	  chunk = 0;
+	}
+      }
+    }
+  }
+
+  return appl::memory( (ylo.capacity()+yhi.capacity()+zlo.capacity()+zhi.capacity())*sizeof(int) + 
+		       (nlayout+std::min(sparsechunk,n))*sizeof(double), 5+(n ? 1 : 0) );
+}
+
+
+// read a weight written by writesparsematrix(), with the ranges already 
+// read, checking that it is consistent, so that a damaged file can not 
+// give access outside the values 
+static bool readsparsematrix( TFile& f, const std::string& name, const TVectorT<double>& _layout, tsparse3d<double>& m ) { 
+
+  std::vector<double> layout( _layout.GetNoElements() );
+  for ( unsigned i=0 ; i<layout.size() ; i++ ) layout[i] = _layout(i);
+
+  const int Nx = m.Nx();
+  const int Ny = m.Ny();
+  const int Nz = m.Nz();
+
+  std::vector<int> ylo( Nx, Ny ),     yhi( Nx, Ny-1 );
+  std::vector<int> zlo( Nx*Ny, Nz ),  zhi( Nx*Ny, Nz-1 );
+  std::vector<int> offset( Nx*Ny, 0 );
+
+  if ( layout.size()<3 ) return false;
+
+  size_t p  = 0;
+  int    lx = int(layout[p++]);
+  int    ux = int(layout[p++]);
+  double n  = layout[p++];
+
+  if ( lx<0 || ( lx<=ux && ux>=Nx ) ) return false;
+
+  size_t nvalues = 0;
+
+  for ( int i=lx ; i<=ux ; i++ ) { 
+    if ( p+2>layout.size() ) return false;
+    ylo[i] = int(layout[p++]);
+    yhi[i] = int(layout[p++]);
+    if ( ylo[i]>yhi[i] ) continue;
+    if ( ylo[i]<0 || yhi[i]>=Ny ) return false;
+    for ( int j=ylo[i] ; j<=yhi[i] ; j++ ) { 
+      int r = i*Ny+j;
+      if ( p+2>layout.size() ) return false;
+      int _zlo = int(layout[p++]);
+      int _zhi = int(layout[p++]);
+      if ( _zlo>_zhi ) continue;
+      if ( _zlo<0 || _zhi>=Nz ) return false;
+      zlo[r]    = _zlo;
+      zhi[r]    = _zhi;
+      offset[r] = nvalues;
+      nvalues  += _zhi-_zlo+1;
+    }
+  }
+
+  if ( p!=layout.size() || double(nvalues)!=n ) return false;
+
+  std::vector<double> values;
+  values.reserve( nvalues );
+
+  for ( size_t ic=0 ; values.size()<nvalues ; ic++ ) { 
+    char cname[32];  sprintf( cname, "[%lu]", (unsigned long)ic );
+    TVectorT<double>* chunk = (TVectorT<double>*)f.Get( (name+cname).c_str() );
+    if ( chunk==0 || chunk->GetNoElements()<=0 || values.size()+chunk->GetNoElements()>nvalues ) { 
+      delete chunk;
+      return false;
+    }
+    for ( int i=0 ; i<chunk->GetNoElements() ; i++ ) values.push_back( (*chunk)(i) );
+    delete chunk;
+  }
+
+  m.assign( lx, ux, &ylo[0], &yhi[0], &zlo[0], &zhi[0], &offset[0], ( nvalues ? &values[0] : (const double*)0 ), nvalues, false );
+
+  return true;
+}
+
+
+
 // read from a file 
-appl::igrid::igrid(TFile& f, const std::string& s) :
+appl::igrid::igrid(TFile& f, const std::string& s, bool deferred) :
   mfy(0),  mfx(0),  
   m_parent(0),
   m_Ny1(0),   m_y1min(0),   m_y1max(0),   m_deltay1(0),   
@@ -199,11 +407,18 @@ appl::igrid::igrid(TFile& f, const std::string& s) :
   m_transvar(transvar),
   m_reweight(false),
   m_symmetrise(false),
+  m_folded(false),
   m_optimised(false),
   m_weight(NULL), 
+  m_nodes(NULL),
+  m_compiled(false),
+  m_cprecision(0),
+  m_factorised(false),
+  m_fresidual(0),
   m_fg1(NULL),     m_fg2(NULL),
   m_fsplit1(NULL), m_fsplit2(NULL),    
-  m_alphas(NULL) 
+  m_alphas(NULL),
+  m_sharedtables(false)
 { 
   //  std::cout << "igrid::igrid()" << std::endl;
   
@@ -229,83 +444,373 @@ appl::igrid::igrid(TFile& f, const std::string& s) :
   TVectorT<double>* setup=(TVectorT<double>*)f.Get((s+"/Parameters").c_str());
   //  f.GetObject((s+"/Parameters").c_str(), setup);
 
-  // NB: round integer variables to nearest integer 
-  //     in case (unlikely) truncation error during 
-  //     conversion to double when they were stored
-  m_Ny1      = int((*setup)(0)+0.5);  
-  m_y1min    = (*setup)(1);
-  m_y1max    = (*setup)(2);
+  std::vector<double> parameters( setup->GetNoElements() );
+  for ( unsigned i=0 ; i<parameters.size() ; i++ ) parameters[i] = (*setup)(i);
 
-  m_Ny2      = int((*setup)(3)+0.5);  
-  m_y2min    = (*setup)(4);
-  m_y2max    = (*setup)(5);
+  setparameters( parameters );
 
-  m_yorder   = int((*setup)(6)+0.5);
+  delete setup;
 
-  m_Ntau     = int((*setup)(7)+0.5);
-  m_taumin   = (*setup)(8);
-  m_taumax   = (*setup)(9);
-  m_tauorder = int((*setup)(10)+0.5);
+  // the subprocesses with the beams exchanged, for filling a folded grid
+  if ( m_folded ) { 
+    TVectorT<double>* conjugate=(TVectorT<double>*)f.Get((s+"/Conjugates").c_str());
+    if ( conjugate==0 ) throw exception("igrid::igrid() cannot read subprocess conjugates for folded grid " + s );
+    m_conjugate.resize( conjugate->GetNoElements() );
+    for ( unsigned ip=0 ; ip<m_conjugate.size() ; ip++ ) m_conjugate[ip] = int((*conjugate)(ip)+0.5);
+    delete conjugate;
+  }
 
-  m_transvar = (*setup)(11);
+  //  std::cout << "igrid::igrid() read setup" << std::endl;
 
-  m_Nproc    = int((*setup)(12)+0.5);
+  //  int rawsize=0;
+  //  int trimsize=0;
 
-  m_reweight   = ((*setup)(13)!=0 ? true : false );
-  m_symmetrise = ((*setup)(14)!=0 ? true : false );
-  m_optimised  = ((*setup)(15)!=0 ? true : false );
-  m_DISgrid    =  ( setup->GetNoElements()>16 && (*setup)[16]!=0 ) ;
+  m_weight = new SparseMatrix3d*[m_Nproc];
+  for( int ip=0 ; ip<m_Nproc ; ip++ ) m_weight[ip] = NULL;
+
+  // the destructor is not called if reading fails
+  try { 
+    for( int ip=0 ; ip<m_Nproc ; ip++ ) {
+
+      // weights stored sparsely are read directly, nothing to decode 
+      char sname[128];  sprintf(sname,"/sparse[%i]", ip );
+      TVectorT<double>* layout = (TVectorT<double>*)f.Get((s+sname).c_str());
+      if ( layout ) { 
+	m_weight[ip] = new SparseMatrix3d(m_Ntau, m_taumin, m_taumax, 
+					  m_Ny1,  m_y1min,  m_y1max, 
+					  m_Ny2,  m_y2min,  m_y2max, true ); 
+	bool good = false;
+	try { good = readsparsematrix( f, s+sname, *layout, *m_weight[ip] ); }
+	catch (...) { delete layout; throw; }
+	delete layout;
+	if ( !good ) throw exception("igrid::igrid() bad sparse weights " + s + sname );
+	// the values as read, and the grid built from them
+	m_transient = std::max( m_transient, memory(ip)+memory(ip) );
+	continue;
+      }
 
+      // the histogram is read and decoded later  
+      if ( deferred ) continue;
 
-  delete setup;
+      // get storage histogram
+      TH3D* htmp = readhistogram( f, s, ip );
 
-  //  std::cout << "igrid::igrid() read setup" << std::endl;
+      // create grid, already trimmed
+      m_weight[ip]=new SparseMatrix3d(htmp);
+
+      // the histogram, and the grid built from it
+      m_transient = std::max( m_transient, histmemory() + memory(ip) );
+
+      // delete storage histogram
+      delete htmp;
+
+      // DON'T trim on reading unless the user wants it!!
+      // he can trim himself if need be!! 
+      // rawsize += m_weight[ip]->size();
+      // m_weight[ip]->trim(); // trim the grid and do some book keeping
+      // trimsize += m_weight[ip]->size();
+    }
+  }
+  catch (...) { 
+    deleteweights();
+    throw;
+  }
+}
+
+
+
+
+// read the weight histogram for a single subprocess, detached from the file
+TH3D* appl::igrid::readhistogram(TFile& f, const std::string& s, int ip) { 
+
+  char name[128];  sprintf(name,"/weight[%i]", ip );
+  TH3D* h = (TH3D*)f.Get((s+name).c_str()); 
+  if ( h==0 ) throw exception("igrid::readhistogram() cannot read weights " + s + name );
+  h->SetDirectory(0);
+
+  // only ever one histogram for each subprocess 
+  m_transient = std::max( m_transient, histmemory() );
+
+  return h;
+}
+
+
+// build the weights for a subprocess from its histogram - no file access at all
+void appl::igrid::decode(int ip, TH3D* h) { 
+  // create grid, already trimmed
+  delete m_weight[ip];
+  m_weight[ip]=new SparseMatrix3d(h);
+}
+
+
+
+
+// the setup parameters stored with each grid
+std::vector<double> appl::igrid::parameters() const { 
+
+  std::vector<double> setup(20,0); // a few spare
+
+  setup[0]  = m_Ny1;
+  setup[1]  = m_y1min;
+  setup[2]  = m_y1max;
+
+  setup[3]  = m_Ny2;
+  setup[4]  = m_y2min;
+  setup[5]  = m_y2max;
+
+  setup[6]  = m_yorder;
+
+  setup[7]  = m_Ntau;
+  setup[8]  = m_taumin;
+  setup[9]  = m_taumax;
+  setup[10] = m_tauorder;
+
+  setup[11] = m_transvar;
+
+  setup[12] = m_Nproc;
+ 
+  setup[13] = ( m_reweight   ? 1 : 0 );
+  setup[14] = ( m_symmetrise ? 1 : 0 );
+  setup[15] = ( m_optimised  ? 1 : 0 );
+  setup[16] = ( m_DISgrid    ? 1 : 0 );
+  setup[17] = ( m_folded     ? 1 : 0 );
+
+  return setup;
+}
+
+
+void appl::igrid::setparameters(const std::vector<double>& setup) { 
+
+  if ( setup.size()<16 ) throw exception("igrid::setparameters() too few parameters");
+
+  // NB: round integer variables to nearest integer 
+  //     in case (unlikely) truncation error during 
+  //     conversion to double when they were stored
+  m_Ny1      = int(setup[0]+0.5);  
+  m_y1min    = setup[1];
+  m_y1max    = setup[2];
+
+  m_Ny2      = int(setup[3]+0.5);  
+  m_y2min    = setup[4];
+  m_y2max    = setup[5];
+
+  m_yorder   = int(setup[6]+0.5);
+
+  m_Ntau     = int(setup[7]+0.5);
+  m_taumin   = setup[8];
+  m_taumax   = setup[9];
+  m_tauorder = int(setup[10]+0.5);
+
+  m_transvar = setup[11];
+
+  m_Nproc    = int(setup[12]+0.5);
+
+  m_reweight   = ( setup[13]!=0 ? true : false );
+  m_symmetrise = ( setup[14]!=0 ? true : false );
+  m_optimised  = ( setup[15]!=0 ? true : false );
+  m_DISgrid    = ( setup.size()>16 && setup[16]!=0 );
+  m_folded     = ( setup.size()>17 && setup[17]!=0 );
 
-  // create grids
   m_deltay1   = (m_y1max-m_y1min)/(m_Ny1-1);
   m_deltay2   = (m_y2max-m_y2min)/(m_Ny2-1);
 
   m_deltatau = (m_taumax-m_taumin)/(m_Ntau-1);
-  
-  //  int rawsize=0;
-  //  int trimsize=0;
+}
 
-  m_weight = new SparseMatrix3d*[m_Nproc];
 
-  for( int ip=0 ; ip<m_Nproc ; ip++ ) {
-    char name[128];  sprintf(name,"/weight[%i]", ip );
-    // get storage histogram
-    TH3D* htmp = (TH3D*)f.Get((s+name).c_str()); 
- 
-    //    std::cout << "igrid::igrid() read " << name << std::endl;
 
-    // create grid
-    m_weight[ip]=new SparseMatrix3d(htmp);
+// a trimmed matrix is written as its occupied ranges, then the values of 
+// the occupied rows in order, so it can be read back with the values in 
+// place, with no rearrangement 
+static void writematrix( appl::binarywriter& w, const tsparse3d<double>& m ) { 
 
-    // save some space
-    m_weight[ip]->trim();
-    // delete storage histogram
-    delete htmp;
+  const int Nx = m.Nx();
+  const int Ny = m.Ny();
+  const int Nz = m.Nz();
+  const int Nw = m.Nw();
+
+  std::vector<int> ylo( Nx, Ny ),     yhi( Nx, Ny-1 );
+  std::vector<int> zlo( Nx*Ny, Nz ),  zhi( Nx*Ny, Nz-1 );
+  std::vector<int> offset( Nx*Ny, 0 );
+
+  size_t n = 0;
+  for ( int i=m.xmin() ; i<=m.xmax() ; i++ ) { 
+    ylo[i] = m.ylo(i);
+    yhi[i] = m.yhi(i);
+    for ( int j=ylo[i] ; j<=yhi[i] ; j++ ) { 
+      int r = i*Ny+j;
+      zlo[r]    = m.zlo(i,j);
+      zhi[r]    = m.zhi(i,j);
+      offset[r] = n;
+      if ( zlo[r]<=zhi[r] ) n += (zhi[r]-zlo[r]+1)*Nw;
+    }
+  }
+
+  w.writeint( Nx );
+  w.writeint( Ny );
+  w.writeint( Nz );
+  w.writeint( Nw );
+
+  w.writeint( m.xmin() );
+  w.writeint( m.xmax() );
+
+  w.writevector( ylo );
+  w.writevector( yhi );
+  w.writevector( zlo );
+  w.writevector( zhi );
+  w.writevector( offset );
+
+  // the values a row at a time, never copying the whole matrix
+  w.startarray( n );
+  for ( int i=m.xmin() ; i<=m.xmax() ; i++ ) { 
+    for ( int j=ylo[i] ; j<=yhi[i] ; j++ ) { 
+      int r = i*Ny+j;
+      if ( zlo[r]<=zhi[r] ) w.append( m.row(i,j), (zhi[r]-zlo[r]+1)*Nw );
+    }
+  }
+  w.finish();
+}
+
+
+// read a matrix written by writematrix(), checking that it is consistent, 
+// so that a damaged file can not give access outside the values
+static bool readmatrix( appl::binaryfile& f, tsparse3d<double>& m, bool mapped ) { 
+
+  const int Nx = m.Nx();
+  const int Ny = m.Ny();
+  const int Nz = m.Nz();
+  const int Nw = m.Nw();
+
+  if ( f.readint()!=Nx || f.readint()!=Ny || f.readint()!=Nz || f.readint()!=Nw ) return false;
+
+  int lx = f.readint();
+  int ux = f.readint();
+
+  size_t n[5];
+  const int* ylo    = f.readarray<int>( n[0] );
+  const int* yhi    = f.readarray<int>( n[1] );
+  const int* zlo    = f.readarray<int>( n[2] );
+  const int* zhi    = f.readarray<int>( n[3] );
+  const int* offset = f.readarray<int>( n[4] );
+
+  size_t nvalues;
+  const double* values = f.readarray<double>( nvalues );
+
+  if ( n[0]!=size_t(Nx) || n[1]!=size_t(Nx) ) return false;
+  for ( int i=2 ; i<5 ; i++ ) if ( n[i]!=size_t(Nx*Ny) ) return false;
+
+  if ( lx<0 || ( lx<=ux && ux>=Nx ) ) return false;
+
+  for ( int i=lx ; i<=ux ; i++ ) { 
+    if ( ylo[i]<0 || ( ylo[i]<=yhi[i] && yhi[i]>=Ny ) ) return false;
+    for ( int j=ylo[i] ; j<=yhi[i] ; j++ ) { 
+      int r = i*Ny+j;
+      if ( zlo[r]>zhi[r] ) continue;
+      if ( zlo[r]<0 || zhi[r]>=Nz || offset[r]<0 || size_t(offset[r])+(zhi[r]-zlo[r]+1)*Nw>nvalues ) return false;
+    }
+  }
+
+  m.assign( lx, ux, ylo, yhi, zlo, zhi, offset, values, nvalues, mapped );
+
+  return true;
+}
+
+
+// read from a native binary file
+appl::igrid::igrid(binaryfile& f, bool mapped) :
+  mfy(0),  mfx(0),  
+  m_parent(0),
+  m_Ny1(0),   m_y1min(0),   m_y1max(0),   m_deltay1(0),   
+  m_Ny2(0),   m_y2min(0),   m_y2max(0),   m_deltay2(0),   
+  m_yorder(0),   
+  m_Ntau(0), m_taumin(0), m_taumax(0), m_deltatau(0), m_tauorder(0), 
+  m_Nproc(0),
+  m_transform(""), 
+  m_transvar(transvar),
+  m_reweight(false),
+  m_symmetrise(false),
+  m_folded(false),
+  m_optimised(false),
+  m_weight(NULL), 
+  m_nodes(NULL),
+  m_compiled(false),
+  m_cprecision(0),
+  m_factorised(false),
+  m_fresidual(0),
+  m_fg1(NULL),     m_fg2(NULL),
+  m_fsplit1(NULL), m_fsplit2(NULL),    
+  m_alphas(NULL),
+  m_sharedtables(false)
+{ 
+  m_transform = f.readstring();
 
-    // DON'T trim on reading unless the user wants it!!
-    // he can trim himself if need be!! 
-    // rawsize += m_weight[ip]->size();
-    // m_weight[ip]->trim(); // trim the grid and do some book keeping
-    // trimsize += m_weight[ip]->size();
+  init_fmap();
+  if ( m_fmap.find(m_transform)==m_fmap.end() ) throw exception("igrid::igrid() transform " + m_transform + " not found\n");
+  mfx = m_fmap.find(m_transform)->second.mfx;
+  mfy = m_fmap.find(m_transform)->second.mfy;
+
+  setparameters( f.readvector<double>() );
+
+  if ( m_Nproc<=0 || m_Ntau<=0 || m_Ny1<=0 || m_Ny2<=0 ) throw exception("igrid::igrid() bad grid dimensions in native file");
+
+  std::vector<int> conjugate = f.readvector<int>();
+  if ( m_folded ) { 
+    if ( int(conjugate.size())!=m_Nproc ) throw exception("igrid::igrid() cannot read subprocess conjugates for folded grid");
+    m_conjugate = conjugate;
+  }
+
+  bool _interleaved = ( f.readint()!=0 );
+
+  m_weight = new SparseMatrix3d*[m_Nproc];
+  construct();
+
+  /// the destructor is not called if the constructor throws, 
+  /// so the weights must be deleted here
+  try { 
+    if ( _interleaved ) { 
+      m_nodes = new tsparse3d<double>( m_Ntau, m_Ny1, m_Ny2, m_Nproc, true );
+      if ( !readmatrix( f, *m_nodes, mapped ) ) throw exception("igrid::igrid() bad interleaved weights in native file");
+    }
+    else { 
+      for( int ip=0 ; ip<m_Nproc ; ip++ ) {
+	if ( !readmatrix( f, *m_weight[ip], mapped ) ) throw exception("igrid::igrid() bad weights in native file");
+      }
+    }
+  }
+  catch (...) { 
+    deleteweights();
+    throw;
   }
 }
 
 
+// write to a native binary file - as the file is read, the transform, 
+// the parameters, the subprocess conjugates, and the weights 
+void appl::igrid::write(binarywriter& w) { 
+
+  trim();
+
+  w.writestring( m_transform );
+  w.writevector( parameters() );
+  w.writevector( m_conjugate );
+
+  w.writeint( m_nodes ? 1 : 0 );
+
+  if ( m_nodes ) writematrix( w, *m_nodes );
+  else for ( int ip=0 ; ip<m_Nproc ; ip++ ) writematrix( w, *m_weight[ip] );
+}
+
 
 
 // constructor common internals 
 void appl::igrid::construct() 
 {
-  // Initialize histograms representing the weight grid
+  // Initialize histograms representing the weight grid, the storage 
+  // is only allocated for the rows of the grids as they are filled
   for( int ip=0 ; ip<m_Nproc ; ip++ ) {
     m_weight[ip] = new SparseMatrix3d(m_Ntau, m_taumin,   m_taumax,    
     				      m_Ny1,  m_y1min,    m_y1max, 
-    				      m_Ny2,  m_y2min,    m_y2max ); 
+    				      m_Ny2,  m_y2min,    m_y2max, true ); 
     
   }  
 }
@@ -324,6 +829,24 @@ void appl::igrid::deletepdftable() {
 
   //  std::cout << "deleting pdf tables" << std::endl;
 
+  // tables are views into shared nodetables, so only 
+  // delete the views, the tables themselves belong
+  // to the nodetables
+  if ( m_sharedtables ) { 
+    if ( m_fg2 && m_fg2!=m_fg1 ) { 
+      for ( int i=0 ; i<m_Ntau ; i++ ) delete[] m_fg2[i];
+      delete[] m_fg2;
+    }
+    if ( m_fg1 ) { 
+      for ( int i=0 ; i<m_Ntau ; i++ ) delete[] m_fg1[i];
+      delete[] m_fg1;
+    }
+    m_fg1    = m_fg2 = NULL;
+    m_alphas = NULL;
+    m_sharedtables = false;
+    return;
+  }
+
   if ( m_fg1 ) { 
     for ( int i=0 ; i<m_Ntau ; i++ ) {
       for ( int j=0 ; j<Ny1() ; j++ )  delete[] m_fg1[i][j];
@@ -391,6 +914,8 @@ void appl::igrid::deleteweights() {
     delete[] m_weight;
     // m_weight=NULL;
   }
+  if ( m_nodes ) delete m_nodes;
+  m_nodes = NULL;
 }
 
 
@@ -398,45 +923,19 @@ void appl::igrid::deleteweights() {
 
 // write to file
 void appl::igrid::write(const std::string& name) { 
-  Directory d(name);
-  d.push();
-
-  // using a TH1D to store the transform pair tag since I don't know how 
-  // to write a TString to a root file
-  // TH1D* _transform = new TH1D("Transform", m_transform.c_str(), 1, 0, 1);
-  //  _transform->Write();
-
-  // write the name of the transform pair
-  TFileString("Transform",m_transform).Write();
-
 
-  TVectorT<double>* setup=new TVectorT<double>(20); // a few spare
+  // the separate grids are needed for the histograms
+  bool _interleaved = interleaved();
+  deinterleave();
 
-  (*setup)(0)  = m_Ny1;
-  (*setup)(1)  = m_y1min;
-  (*setup)(2)  = m_y1max;
+  // one histogram at a time, and the separate grids if they were rebuilt
+  m_transient = histmemory();
+  if ( _interleaved ) for ( int ip=0 ; ip<m_Nproc ; ip++ ) m_transient += memory(ip);
 
-  (*setup)(3)  = m_Ny2;
-  (*setup)(4)  = m_y2min;
-  (*setup)(5)  = m_y2max;
-
-  (*setup)(6)  = m_yorder;
-
-  (*setup)(7)  = m_Ntau;
-  (*setup)(8)  = m_taumin;
-  (*setup)(9)  = m_taumax;
-  (*setup)(10) = m_tauorder;
-
-  (*setup)(11) = m_transvar;
-
-  (*setup)(12) = m_Nproc;
- 
-  (*setup)(13) = ( m_reweight   ? 1 : 0 );
-  (*setup)(14) = ( m_symmetrise ? 1 : 0 );
-  (*setup)(15) = ( m_optimised  ? 1 : 0 );
-  (*setup)(16) = ( m_DISgrid    ? 1 : 0 );
+  Directory d(name);
+  d.push();
 
-  setup->Write("Parameters");
+  writesetup();
 
   int igridsize     = 0;
   int igridtrimsize = 0;
@@ -470,6 +969,88 @@ void appl::igrid::write(const std::string& name) {
 #endif
 
   d.pop();
+
+  if ( _interleaved ) interleave();
+}
+
+
+// the transform, setup parameters and conjugates, to the current directory
+void appl::igrid::writesetup() const { 
+
+  // using a TH1D to store the transform pair tag since I don't know how 
+  // to write a TString to a root file
+  // TH1D* _transform = new TH1D("Transform", m_transform.c_str(), 1, 0, 1);
+  //  _transform->Write();
+
+  // write the name of the transform pair
+  TFileString("Transform",m_transform).Write();
+
+
+  std::vector<double> parameters = this->parameters();
+
+  TVectorT<double>* setup=new TVectorT<double>(parameters.size());
+  for ( unsigned i=0 ; i<parameters.size() ; i++ ) (*setup)(i) = parameters[i];
+
+  setup->Write("Parameters");
+
+  delete setup;
+
+  if ( m_folded ) { 
+    TVectorT<double>* conjugate=new TVectorT<double>(m_Nproc);
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) (*conjugate)(ip) = m_conjugate[ip];
+    conjugate->Write("Conjugates");
+    delete conjugate;
+  }
+}
+
+
+// the empty weight histogram for a subprocess, detached from any directory
+TH3D* appl::igrid::histogram(int ip) { 
+
+  char hname[128];
+  sprintf(hname,"weight[%d]", ip);
+  TH3D* h = m_weight[ip]->newTH3D(hname);
+  h->SetDirectory(0);
+
+  // only ever one histogram for each subprocess 
+  m_transient = std::max( m_transient, histmemory() );
+
+  return h;
+}
+
+
+// fill the weight histogram for a subprocess - no file or directory 
+// access at all, and nothing shared with the other subprocesses
+void appl::igrid::encode(int ip, TH3D* h) { 
+  m_weight[ip]->trim();
+  m_weight[ip]->fillTH3D(h);
+}
+
+
+// write to the current root directory, with the weights stored sparsely
+void appl::igrid::writesparse(const std::string& name) { 
+
+  Directory d(name);
+  d.push();
+
+  writesetup();
+
+  // straight from the interleaved weights if need be, no copies 
+  m_transient = appl::memory();
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+    char sname[128];  sprintf(sname,"sparse[%d]", ip);
+    if ( m_nodes ) m_transient = std::max( m_transient, writesparsematrix( sname, *m_nodes, ip ) );
+    else           m_transient = std::max( m_transient, writesparsematrix( sname, *m_weight[ip], 0 ) );
+  }
+
+  d.pop();
+}
+
+
+// write a filled weight histogram to the current directory, and delete it
+void appl::igrid::writehistogram(TH3D* h) const { 
+  h->Write();
+  delete h;
 }
 
 
@@ -478,6 +1059,7 @@ void appl::igrid::write(const std::string& name) {
 
 void appl::igrid::fill(const double x1, const double x2, const double Q2, const double* weight) 
 {  
+  if ( m_compiled || m_factorised ) uncompile();
 
   // find preferred vertex for low end of interpolation range
   int k1=fk1(x1);
@@ -515,8 +1097,30 @@ void appl::igrid::fill(const double x1, const double x2, const double Q2, const
 
 	if ( m_reweight ) fI_factor *= invwfun;
 
+	int iy1 = k1+i1;
+	int iy2 = k2+i2;
+
+	// for a folded grid, nodes below the diagonal go to the 
+	// conjugate subprocesses at the mirrored node
+	const int* conj = NULL;
+	if ( m_folded && iy1>iy2 ) { 
+	  std::swap( iy1, iy2 );
+	  conj = &m_conjugate[0];
+	}
+
+	// all the subprocesses for the node together 
+	if ( m_nodes ) { 
+	  double* w = m_nodes->node(k3+i3, iy1, iy2);
+	  if ( conj ) for( int ip=0 ; ip<m_Nproc ; ip++ ) w[conj[ip]] += weight[ip] * fI_factor;
+	  else        for( int ip=0 ; ip<m_Nproc ; ip++ ) w[ip]       += weight[ip] * fI_factor;
+	  continue;
+	}
+
 	for( int ip=0 ; ip<m_Nproc ; ip++ ) {
 	  
+	  // don't create nodes for subprocesses with nothing to add
+	  if ( weight[ip]==0 ) continue;
+
 	  fillweight = weight[ip] * fI_factor;
 
 	  // this method only works for grids where the x1, x2 axes are identical 
@@ -530,7 +1134,7 @@ void appl::igrid::fill(const double x1, const double x2, const double Q2, const
 
 	  //	  std::cout << "weight[" << ip << "]=" << weight[ip] << "\tfillweight=" << fillweight << std::endl;;
 
-	  (*m_weight[ip])(k3+i3, k1+i1, k2+i2) += fillweight;	  
+	  (*m_weight[ conj ? conj[ip] : ip ])(k3+i3, iy1, iy2) += fillweight;	  
 	  //  }	  
 	  
 	  //	  m_weight[ip]->print();	  
@@ -545,11 +1149,25 @@ void appl::igrid::fill(const double x1, const double x2, const double Q2, const
 
 void appl::igrid::fill_phasespace(const double x1, const double x2, const double Q2, const double* weight) { 
 
+  if ( m_compiled || m_factorised ) uncompile();
+
   int k1=fk1(x1);
   int k2=fk2(x2);
   int k3=fkappa(Q2);
 
-  for ( int ip=0 ; ip<m_Nproc ; ip++ ) (*m_weight[ip])(k3, k1, k2) += weight[ip];
+  const int* conj = NULL;
+  if ( m_folded && k1>k2 ) { 
+    std::swap( k1, k2 );
+    conj = &m_conjugate[0];
+  }
+
+  if ( m_nodes ) { 
+    double* w = m_nodes->node(k3, k1, k2);
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) w[ conj ? conj[ip] : ip ] += weight[ip];
+    return;
+  }
+
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) (*m_weight[ conj ? conj[ip] : ip ])(k3, k1, k2) += weight[ip];
 
 } 
 
@@ -565,14 +1183,555 @@ void appl::igrid::fill_index(const int ix1, const int ix2, const int iQ2, const
 
   //  for ( int ip=0 ; ip<m_Nproc ; ip++ ) (*m_weight[ip])(i3, k1, k2) += weight[ip];
 
-  for ( int ip=0 ; ip<m_Nproc ; ip++ ) (*m_weight[ip])(iQ2, ix1, ix2) += weight[ip];
+  if ( m_compiled || m_factorised ) uncompile();
+
+  int k1 = ix1;
+  int k2 = ix2;
+
+  const int* conj = NULL;
+  if ( m_folded && k1>k2 ) { 
+    std::swap( k1, k2 );
+    conj = &m_conjugate[0];
+  }
+
+  if ( m_nodes ) { 
+    double* w = m_nodes->node(iQ2, k1, k2);
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) w[ conj ? conj[ip] : ip ] += weight[ip];
+    return;
+  }
+
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) (*m_weight[ conj ? conj[ip] : ip ])(iQ2, k1, k2) += weight[ip];
 
 } 
 
 
 
-void appl::igrid::setuppdf(double (*alphas)(const double&),
-			   NodeCache* pdf0,
+// build the flat list of the non-zero nodes, in the same order that the 
+// nodes are visited in the convolution, so that the compiled convolution 
+// gives exactly the same result as the convolution over the sparse grids
+double appl::igrid::compile(int precision) { 
+
+  // anything else would be stored as the 16 bit weights, and later 
+  // dispatched on as something else entirely
+  if ( precision<0 || precision>2 ) throw exception( std::cerr << "igrid::compile() unknown precision " << precision );
+
+  uncompile();
+
+  trim();
+
+  std::vector<double> sig(m_Nproc);
+
+  m_ctau.reserve(Ntau()+1);
+  m_ctau.push_back(0);
+
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+    for ( int iy1=Ny1() ; iy1-- ;  ) {            
+      for ( int iy2=Ny2() ; iy2-- ;  ) { 
+	const double* w = weights( itau, iy1, iy2, &sig[0] );
+	if ( w ) { 
+	  m_cy1.push_back(iy1);
+	  m_cy2.push_back(iy2);
+	  m_cweight.insert( m_cweight.end(), w, w+m_Nproc );
+	}
+      }
+    }
+    m_ctau.push_back( m_cy1.size() );
+  }
+
+  m_compiled = true;
+
+  if ( precision==0 ) return 0;
+
+  // convert to the reduced precision, keeping track of the 
+  // largest deviation from the double precision weights
+  double deviation = 0;
+
+  int Nnodes = m_cy1.size();
+
+  if ( precision==1 ) m_cweightf.resize( m_cweight.size() );
+  else { 
+    m_cweight16.resize( m_cweight.size() );
+    m_cscale.resize( Nnodes );
+  }
+
+  for ( int inode=0 ; inode<Nnodes ; inode++ ) { 
+    const double* w = &m_cweight[inode*m_Nproc];
+    double wmax = 0;
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) if ( std::fabs(w[ip])>wmax ) wmax = std::fabs(w[ip]);
+    if ( wmax==0 ) wmax = 1;
+    if ( precision==1 ) { 
+      float* wf = &m_cweightf[inode*m_Nproc];
+      for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+	wf[ip] = float(w[ip]);
+	double d = std::fabs(wf[ip]-w[ip])/wmax;
+	if ( d>deviation ) deviation = d;
+      }
+    }
+    else { 
+      short* w16 = &m_cweight16[inode*m_Nproc];
+      double scale = wmax/32767;
+      // weights too small to scale, ie denormal, are stored as zero 
+      if ( scale==0 ) { 
+	m_cscale[inode] = 0;
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) w16[ip] = 0;
+	if ( deviation<1 ) deviation = 1;
+	continue;
+      }
+      m_cscale[inode] = scale;
+      for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+	double q = std::floor( w[ip]/scale + 0.5 );
+	if ( q> 32767 ) q =  32767;
+	if ( q<-32767 ) q = -32767;
+	w16[ip] = short(q);
+	double d = std::fabs(w16[ip]*scale-w[ip])/wmax;
+	if ( d>deviation ) deviation = d;
+      }
+    }
+  }
+
+  std::vector<double>().swap(m_cweight);
+
+  m_cprecision = precision;
+
+  return deviation;
+}
+
+
+// discard the compiled node list and any factorised weights, releasing the memory 
+void appl::igrid::uncompile() { 
+  m_compiled = false;
+  std::vector<int>().swap(m_ctau);
+  std::vector<int>().swap(m_cy1);
+  std::vector<int>().swap(m_cy2);
+  std::vector<double>().swap(m_cweight);
+  std::vector<float>().swap(m_cweightf);
+  std::vector<short>().swap(m_cweight16);
+  std::vector<double>().swap(m_cscale);
+  m_cprecision = 0;
+  unfactorise();
+}
+
+
+// discard only the factorised weights, keeping any compiled node list 
+void appl::igrid::unfactorise() { 
+  m_factorised = false;
+  m_fresidual  = 0;
+  std::vector<int>().swap(m_fslice);
+  std::vector<int>().swap(m_fbox);
+  std::vector<int>().swap(m_fbase);
+  std::vector<double>().swap(m_ffactor);
+}
+
+
+// approximate the weights for each tau and subprocess by a sum of rank 1 
+// terms u(y1)v(y2), using adaptive cross approximation with full pivoting 
+// on the occupied y1, y2 range of the slice - each term removes the 
+// largest remaining element, until the residual is below the tolerance 
+// relative to the norm of the weights in the slice
+double appl::igrid::factorise(double tolerance) { 
+
+  trim();
+
+  unfactorise();
+
+  m_fslice.reserve( Ntau()*m_Nproc+1 );
+  m_fslice.push_back(0);
+
+  std::vector<double> sig(m_Nproc);
+  std::vector<double> R;
+
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+
+    // the occupied y1, y2 range for each subprocess at this tau
+    std::vector<int> y1lo(m_Nproc,Ny1()), y1hi(m_Nproc,-1);
+    std::vector<int> y2lo(m_Nproc,Ny2()), y2hi(m_Nproc,-1);
+
+    for ( int iy1=0 ; iy1<Ny1() ; iy1++ ) {            
+      for ( int iy2=0 ; iy2<Ny2() ; iy2++ ) { 
+	const double* w = weights( itau, iy1, iy2, &sig[0] );
+	if ( !w ) continue;
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+	  if ( w[ip]==0 ) continue;
+	  if ( iy1<y1lo[ip] ) y1lo[ip] = iy1;
+	  if ( iy1>y1hi[ip] ) y1hi[ip] = iy1;
+	  if ( iy2<y2lo[ip] ) y2lo[ip] = iy2;
+	  if ( iy2>y2hi[ip] ) y2hi[ip] = iy2;
+	}
+      }
+    }
+
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+
+      int n1 = ( y1hi[ip]<y1lo[ip] ? 0 : y1hi[ip]-y1lo[ip]+1 );
+      int n2 = ( y2hi[ip]<y2lo[ip] ? 0 : y2hi[ip]-y2lo[ip]+1 );
+
+      if ( n1==0 || n2==0 ) n1 = n2 = 0;
+
+      m_fbox.push_back( n1 ? y1lo[ip] : 0 );
+      m_fbox.push_back( n1 );
+      m_fbox.push_back( n2 ? y2lo[ip] : 0 );
+      m_fbox.push_back( n2 );
+      m_fbase.push_back( m_ffactor.size() );
+
+      int rank = 0;
+
+      if ( n1 ) { 
+
+	// the residual, starting from the weights themselves
+	R.assign( n1*n2, 0 );
+	double norm = 0;
+	for ( int i=0 ; i<n1 ; i++ ) { 
+	  for ( int j=0 ; j<n2 ; j++ ) { 
+	    const double* w = weights( itau, y1lo[ip]+i, y2lo[ip]+j, &sig[0] );
+	    if ( w ) norm += ( R[i*n2+j] = w[ip] )*w[ip];
+	  }
+	}
+	norm = std::sqrt(norm);
+
+	double residual = norm;
+	double wmax     = 0;
+
+	while ( residual>tolerance*norm && rank<std::min(n1,n2) ) { 
+
+	  // pivot on the largest remaining element, stopping once 
+	  // what remains is only rounding error
+	  int imax = 0;
+	  for ( int k=1 ; k<n1*n2 ; k++ ) if ( std::fabs(R[k])>std::fabs(R[imax]) ) imax = k;
+	  if ( rank==0 ) wmax = std::fabs(R[imax]);
+	  if ( std::fabs(R[imax])<=1e-14*wmax ) break;
+
+	  int i0 = imax/n2;
+	  int j0 = imax%n2;
+	  double pivot = R[imax];
+
+	  int base = m_ffactor.size();
+	  m_ffactor.resize( base+n1+n2 );
+	  double* u = &m_ffactor[base];
+	  double* v = u+n1;
+	  for ( int i=0 ; i<n1 ; i++ ) u[i] = R[i*n2+j0];
+	  for ( int j=0 ; j<n2 ; j++ ) v[j] = R[i0*n2+j]/pivot;
+
+	  residual = 0;
+	  for ( int i=0 ; i<n1 ; i++ ) { 
+	    for ( int j=0 ; j<n2 ; j++ ) { 
+	      double& r = R[i*n2+j];
+	      r -= u[i]*v[j];
+	      residual += r*r;
+	    }
+	  }
+	  residual = std::sqrt(residual);
+
+	  rank++;
+	}
+
+	if ( norm>0 && residual/norm>m_fresidual ) m_fresidual = residual/norm;
+      }
+
+      m_fslice.push_back( m_fslice.back()+rank );
+    }
+  }
+
+  m_factorised = true;
+
+  return m_fresidual;
+}
+
+
+// the largest number of rank 1 terms for any tau and subprocess
+int appl::igrid::rank() const { 
+  int r = 0;
+  for ( unsigned i=1 ; i<m_fslice.size() ; i++ ) r = std::max( r, m_fslice[i]-m_fslice[i-1] ); 
+  return r;
+}
+
+
+// the contributions of the weights to the convolution with the reference 
+// pdf, for choosing the threshold for prune()
+double appl::igrid::contributions(NodeCache* pdf0, appl_pdf* genpdf, double (*alphas)(const double& ), 
+				  int lo_order, std::vector<double>& c) { 
+
+  if ( isDISgrid() ) throw exception("igrid::contributions() no pruning for DIS grids");
+
+  // grid is empty
+  if ( !convolute_setup( pdf0, 0, alphas ) ) return 0;
+
+  m_transient = std::max( m_transient, tablememory( false, false ) );
+
+  int Nremoved = 0;
+  double dsigma = prunenodes( genpdf, lo_order, 0, &c, Nremoved );
+
+  deletepdftable();
+
+  return dsigma;
+}
+
+
+// remove the weights with negligible contributions to the convolution 
+// with the reference pdf - the separate subprocess grids are modified 
+// directly, and interleaved again afterwards if needed 
+double appl::igrid::prune(NodeCache* pdf0, appl_pdf* genpdf, double (*alphas)(const double& ), 
+			  int lo_order, double threshold, int& Nremoved) { 
+
+  Nremoved = 0;
+
+  if ( isDISgrid() ) throw exception("igrid::prune() no pruning for DIS grids");
+
+  bool _interleaved = interleaved();
+  deinterleave();
+
+  double removed = 0;
+
+  if ( convolute_setup( pdf0, 0, alphas ) ) { 
+
+    m_transient = std::max( m_transient, tablememory( false, false ) );
+
+    removed = prunenodes( genpdf, lo_order, threshold, NULL, Nremoved );
+
+    deletepdftable();
+
+    if ( Nremoved ) { 
+      uncompile();
+      trim();
+    }
+  }
+
+  if ( _interleaved ) interleave();
+
+  return removed;
+}
+
+
+double appl::igrid::prunenodes( appl_pdf* genpdf, int lo_order, double threshold, 
+				std::vector<double>* c, int& Nremoved ) { 
+
+  double* sig = new double[m_Nproc];  // weights from grid
+  double* H   = new double[m_Nproc];  // generalised pdf  
+
+  // the convolution, or the sum of the contributions removed
+  double dsigma = 0;
+
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+
+    double _alphas = 1;    
+    for ( int iorder=0 ; iorder<lo_order ; iorder++ ) _alphas *= m_alphas[itau];
+
+    for ( int iy1=Ny1() ; iy1-- ;  ) {            
+      for ( int iy2=Ny2() ; iy2-- ;  ) { 
+
+	const double* w = weights( itau, iy1, iy2, sig );
+
+	if ( !w ) continue;
+
+	genpdf->evaluate( m_fg1[itau][iy1], m_fg2[itau][iy2], H );
+
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+	  if ( w[ip]==0 || H[ip]==0 ) continue;
+	  double contribution = _alphas*w[ip]*H[ip];
+	  if ( c ) { 
+	    c->push_back( std::fabs(contribution) );
+	    dsigma += contribution;
+	  }
+	  else if ( std::fabs(contribution)<threshold ) { 
+	    (*m_weight[ip])(itau,iy1,iy2) = 0;
+	    dsigma += contribution;
+	    Nremoved++;
+	  }
+	}
+      }
+    }
+  }
+
+  delete[] sig;
+  delete[] H;
+
+  return dsigma;
+}
+
+
+
+// the memory for the weights of a single subprocess
+appl::memory appl::igrid::memory(int ip) const { 
+  if ( m_weight==NULL || m_weight[ip]==NULL ) return appl::memory();
+  return appl::memory( sizeof(SparseMatrix3d) + m_weight[ip]->bytes(), 1 + m_weight[ip]->allocations() );
+}
+
+
+// the memory for everything held by the grid - the weights, the  
+// interleaved, compiled and factorised forms, and any pdf tables
+appl::memory appl::igrid::memory() const { 
+
+  appl::memory m( sizeof(igrid), 1 );
+
+  if ( m_weight ) { 
+    m += appl::memory( m_Nproc*sizeof(SparseMatrix3d*), 1 );
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) m += memory(ip);
+  }
+
+  if ( m_nodes ) m += appl::memory( sizeof(tsparse3d<double>) + m_nodes->bytes(), 1 + m_nodes->allocations() );
+
+  m += vectormemory(m_conjugate);
+
+  m += vectormemory(m_ctau) + vectormemory(m_cy1) + vectormemory(m_cy2) + vectormemory(m_cweight);
+  m += vectormemory(m_cweightf) + vectormemory(m_cweight16) + vectormemory(m_cscale);
+
+  m += vectormemory(m_fslice) + vectormemory(m_fbox) + vectormemory(m_fbase) + vectormemory(m_ffactor);
+
+  if ( m_fg1 ) m += tablememory( m_fsplit1!=NULL, m_sharedtables );
+
+  return m;
+}
+
+
+// the pdf tables from setuppdf() are an array of Ntau pointers, to arrays 
+// of Ny pointers, to the 14 values for each node, for each beam, unless 
+// the grid is symmetric, and the same again for the splitting functions, 
+// with the alpha_s values - the views into the shared tables have the 
+// same arrays of pointers, but not the values themselves
+appl::memory appl::igrid::tablememory(bool split, bool shared) const { 
+
+  const int Nbeams = ( isSymmetric() ? 1 : 2 );
+
+  appl::memory m;
+
+  for ( int ibeam=0 ; ibeam<Nbeams ; ibeam++ ) { 
+    int Ny = ( ibeam==0 ? Ny1() : Ny2() );
+    appl::memory table( Ntau()*sizeof(double**) + Ntau()*Ny*sizeof(double*), 1 + Ntau() );
+    if ( !shared ) table += appl::memory( Ntau()*Ny*14*sizeof(double), Ntau()*Ny );
+    m += table;
+    if ( split ) m += table;
+  }
+
+  if ( !shared ) m += appl::memory( Ntau()*sizeof(double), 1 );
+
+  return m;
+}
+
+
+// the histograms written for each subprocess have all the 
+// bins, including the underflow and overflow bins - from the setup, 
+// since the weights need not have been read yet
+appl::memory appl::igrid::histmemory() const { 
+  return appl::memory( sizeof(TH3D) + (m_Ntau+2)*(m_Ny1+2)*(m_Ny2+2)*sizeof(double), 2 );
+}
+
+
+
+// move the weights from the separate subprocess grids into a single 
+// grid with the m_Nproc weights for each node stored together - only 
+// the occupied nodes are created, and the grid is trimmed if the 
+// separate grids were
+void appl::igrid::interleave() { 
+
+  if ( m_nodes ) return;
+
+  bool trimmed = true;
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) if ( !m_weight[ip]->trimmed() ) trimmed = false;
+
+  m_nodes = new tsparse3d<double>( Ntau(), Ny1(), Ny2(), m_Nproc, true );
+
+  for ( int itau=0 ; itau<Ntau() ; itau++ ) { 
+    for ( int iy1=0 ; iy1<Ny1() ; iy1++ ) { 
+
+      // the occupied range over all the subprocesses for this row 
+      int iy2min = Ny2();
+      int iy2max = -1;
+      for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+	const SparseMatrix3d* g = m_weight[ip];
+	if ( itau<g->xmin() || itau>g->xmax() ) continue;
+	if ( iy1<g->ylo(itau) || iy1>g->yhi(itau) ) continue;
+	if ( g->zlo(itau,iy1)<iy2min ) iy2min = g->zlo(itau,iy1);
+	if ( g->zhi(itau,iy1)>iy2max ) iy2max = g->zhi(itau,iy1);
+      }
+      
+      if ( iy2min>iy2max ) continue;
+
+      // create the full row before filling it
+      m_nodes->node( itau, iy1, iy2max );
+      m_nodes->node( itau, iy1, iy2min );
+
+      for ( int iy2=iy2min ; iy2<=iy2max ; iy2++ ) { 
+	double* w = m_nodes->node( itau, iy1, iy2 );
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) w[ip] = (*(const SparseMatrix3d*)m_weight[ip])(itau,iy1,iy2);
+      }
+    }
+  }
+
+  if ( trimmed ) m_nodes->trim();
+
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) m_weight[ip]->clear();
+}
+
+
+// restore the separate subprocess grids from the interleaved grid 
+void appl::igrid::deinterleave() { 
+
+  if ( m_nodes==NULL ) return;
+
+  bool trimmed = m_nodes->trimmed();
+
+  for ( int itau=m_nodes->xmin() ; itau<=m_nodes->xmax() ; itau++ ) { 
+    for ( int iy1=m_nodes->ylo(itau) ; iy1<=m_nodes->yhi(itau) ; iy1++ ) { 
+      const double* w = m_nodes->row(itau,iy1);
+      for ( int iy2=m_nodes->zlo(itau,iy1) ; iy2<=m_nodes->zhi(itau,iy1) ; iy2++, w+=m_Nproc ) { 
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) if ( w[ip] ) (*m_weight[ip])(itau,iy1,iy2) = w[ip];
+      }
+    }
+  }
+
+  if ( trimmed ) for ( int ip=0 ; ip<m_Nproc ; ip++ ) m_weight[ip]->trim();
+
+  delete m_nodes;
+  m_nodes = NULL;
+}
+
+
+// since sigma = sum W_ip(y1,y2) H_ip(f(y1),f(y2)), and with identical 
+// x1 and x2 axes, H_ip(f(y1),f(y2)) = H_jp(f(y2),f(y1)) for the conjugate
+// subprocess jp, the weight W_ip(y1,y2) for y1>y2 can be added to 
+// W_jp(y2,y1) instead, leaving only the y1<=y2 half of the grid
+bool appl::igrid::fold(const std::vector<int>& conjugate) { 
+
+  if ( int(conjugate.size())!=m_Nproc || isDISgrid() ) return false;
+
+  if ( Ny1()!=Ny2() || y1min()!=y2min() || y1max()!=y2max() ) return false;
+
+  bool _interleaved = interleaved();
+  deinterleave();
+  uncompile();
+
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+    SparseMatrix3d* w = m_weight[ip];
+    SparseMatrix3d* c = m_weight[conjugate[ip]];
+    for ( int itau=w->xmin() ; itau<=w->xmax() ; itau++ ) { 
+      for ( int iy1=w->ylo(itau) ; iy1<=w->yhi(itau) ; iy1++ ) { 
+	int iy2max = w->zhi(itau,iy1);
+	if ( iy2max>=iy1 ) iy2max = iy1-1;
+	for ( int iy2=w->zlo(itau,iy1) ; iy2<=iy2max ; iy2++ ) { 
+	  double v = (*(const SparseMatrix3d*)w)(itau,iy1,iy2);
+	  if ( v==0 ) continue;
+	  (*w)(itau,iy1,iy2)  = 0;
+	  (*c)(itau,iy2,iy1) += v;
+	}
+      }
+    }
+  }
+
+  // remove the emptied half of the grid
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) m_weight[ip]->trim();
+
+  m_folded    = true;
+  m_conjugate = conjugate;
+
+  if ( _interleaved ) interleave();
+
+  return true;
+}
+
+
+
+
+void appl::igrid::setuppdf(double (*alphas)(const double&),
+			   NodeCache* pdf0,
 			   NodeCache* pdf1,
 			   int _nloop,
 			   double rscale_factor,
@@ -584,6 +1743,8 @@ void appl::igrid::setuppdf(double (*alphas)(const double&),
 
   if ( pdf1==0 ) pdf1 = pdf0;
 
+  if ( m_folded && pdf1!=pdf0 ) throw exception("igrid::setuppdf() folded grid needs the same pdf for both beams");
+
   bool initialise_hoppet = false;
 
 #ifdef HAVE_HOPPET
@@ -763,6 +1924,7 @@ void appl::igrid::setuppdf(double (*alphas)(const double&),
 
   } // loop over itau
 
+  m_transient = std::max( m_transient, tablememory( m_fsplit1!=NULL, false ) );
 }
 
 
@@ -774,218 +1936,1024 @@ void igrid::pdfinterp(double x, double Q2, double* f)
   int k1=fk1(x);
   int k3=fkappa(Q2);
 
-  double u_y1  = ( fy(x)-gety1(k1) )/deltay1();
-  double u_tau = ( ftau(Q2)-gettau(k3))/deltatau();
+  double u_y1  = ( fy(x)-gety1(k1) )/deltay1();
+  double u_tau = ( ftau(Q2)-gettau(k3))/deltatau();
+
+  //  double rint = 0.;
+
+  for ( int i=0 ; i<14 ; i++ ) f[i]=0.;
+
+  double fI_factor;
+
+  for( int i3=0 ; i3<=m_tauorder ; i3++ ) { // interpolation loop in Q2
+   
+    //    double fI3 = fI(i3, m_tauorder, u_tau);
+
+    for( int i1=0 ; i1<=m_yorder ; i1++ ) { // interpolation loop in x1
+      
+      //      double fI1 = fI(i1, m_yorder, u_y1); 
+
+      fI_factor=fI(i1, m_yorder, u_y1) * fI(i3, m_tauorder, u_tau);
+                    
+      for ( int ip1=0 ; ip1<14 ; ip1++ ) { 
+	f[ip1] += fI_factor*m_fg1[k3+i3][std::abs(k1+i1)][ip1];     
+      }
+    }
+  }
+   
+  double fun = weightfun(x); 
+
+  if ( m_reweight ) for ( int ip1=0 ; ip1<14 ; ip1++ ) f[ip1] /= fun;
+
+}
+#endif
+
+
+// the subprocess selected by the parent grid, or -1 for all
+int appl::igrid::subproc() const { 
+  return ( m_parent ? m_parent->subproc() : -1 );
+}
+
+
+// the contribution to the convolution from a single, non-zero node with 
+// subprocess weights sig, and pdf values fA, fB and splitting functions 
+// fsA, fsB at the node - common to the compiled and sparse grid loops
+inline void appl::igrid::convolute_node( double& dsigma, const double* sig, double* H, double* HA, double* HB, double* Hw,
+					 bool evaluate, int subproc, int photons, appl_pdf* genpdf, 
+					 const double* fA,  const double* fB, 
+					 const double* fsA, const double* fsB, 
+					 int lo_order, int _nloop, double rscale_factor, double fscale_factor, 
+					 double _alphas, double alphaplus1 ) const 
+{
+  static const double twopi = 2*M_PI;
+  static const int nc = 3;
+  //TC   const int nf = 6;
+  static const int nf = 5;
+  static double beta0=(11.*nc-2.*nf)/(6.*twopi);
+
+  int nloop = std::abs(_nloop);
+
+  // build the generalised pdfs from the actual pdfs
+  if ( evaluate ) { 
+    if ( photons==-1 ) genpdf->evaluate( fA, fB, H );
+    else               genpdf->evaluatePhotons( fA, fB, H, photons, Hw );
+  }
+	
+  //	  for ( int ip=0 ; ip<m_Nproc ; ip++ ) H[ip] = 1;
+  //    std::cout << "H return" << std::endl;
+  //    for ( int ip=0 ; ip<m_Nproc ; ip++ ) std::cout << "\t" << H[ip] << std::endl;
+
+  //	  for  ( int ipp=0 ; ipp<m_Nproc ; ipp++ ) H[ipp]=1;
+  
+  // do the convolution
+
+  double xsigma=0.;
+
+  if ( subproc!=-1 ) { 
+    int ip=subproc;
+    xsigma+= sig[ip]*H[ip];
+  }
+  else { 
+    for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma+= sig[ip]*H[ip];
+  }
+
+  /// if want NLO part only, don't add in the born term
+  if ( _nloop!=-1 ) dsigma += _alphas*xsigma;
+
+  // now do the convolution for the variation of factorisation and 
+  // renormalisation scales, proportional to the leading order weights
+  if ( nloop==1 ) { 
+    // renormalisation scale dependent bit
+    if ( rscale_factor!=1 ) { 
+      // nlo relative ln mu_R^2 term 
+      dsigma+= alphaplus1*twopi*beta0*lo_order*log(rscale_factor*rscale_factor)*xsigma;
+    }
+
+    // factorisation scale dependent bit
+    // nlo relative ln mu_F^2 term 
+    if ( fscale_factor!=1 ) {
+      if ( evaluate ) { 
+	if ( photons==-1 ) { 
+	  genpdf->evaluate( fA,  fsB, HA);
+	  genpdf->evaluate( fsA, fB,  HB);
+	}
+	else { 
+	  genpdf->evaluatePhotons( fA,  fsB, HA, photons, Hw );
+	  genpdf->evaluatePhotons( fsA, fB,  HB, photons, Hw );
+	}
+      }
+      xsigma=0.;
+
+      if ( subproc!=-1 ) { 
+	int ip=subproc;
+	xsigma += sig[ip]*(HA[ip]+HB[ip]);
+      }
+      else { 
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma += sig[ip]*(HA[ip]+HB[ip]);
+      }
+
+      dsigma -= alphaplus1*log(fscale_factor*fscale_factor)*xsigma;
+      //if (debug) 
+      //cout <<name<<" fscale= " << fscale_factor << " dsigma= "<<dsigma << std::endl;
+    }
+  }
+}
+
+
+// takes pdf as the pdf lib wrapper for the pdf set for the convolution.
+// takes genpdf as a function to form the generalised parton distribution.
+// alphas is a function for the calculation of alpha_s (surprisingly)
+// lo_order is the order of the calculation, ie for inclusive, or two jets, 
+// it's O(alpha_s) (ie lo_order=1) and for 3 jet it would be O(alpha_s^2)
+// (ie lo_order=2)
+// nloop is the number of loops, ie for the leading order component it is
+// 0, for the nlo component, interestingly it is also 0, since the leading order
+// grids are seperate from the nlo grids, if nloop=1 then we must be calculating 
+// {r,f}scale_factor ie f*mu then *scale_factor=f
+// splitting, is the splitting function 
+double appl::igrid::convolute(NodeCache* pdf0,
+			      NodeCache* pdf1,
+			      appl_pdf*  genpdf,
+			      double (*alphas)(const double& ), 
+			      int     lo_order,  
+			      int     _nloop, 
+			      double  rscale_factor,
+			      double  fscale_factor,
+			      double Escale) 
+{ 
+
+  //  m_transvar = m_transvarlocal;
+
+  // grid is empty
+  if ( !convolute_setup( pdf0, pdf1, alphas, _nloop, rscale_factor, fscale_factor, Escale ) ) return 0;
+
+  double dsigma = convolute_weights( genpdf, lo_order, _nloop, rscale_factor, fscale_factor );
+  
+  deletepdftable();
+  
+  //  std::cout << "dsigma " << dsigma << std::endl;
+
+  // NB!!! the return value dsigma must be scaled by Escale*Escale which 
+  // is done in grid::vconvolute. It would be better here, but is reduces 
+  // the number of operations if in grid. 
+  return dsigma; 
+}
+
+
+
+// trim the grid and set up the pdf and alpha_s tables for the 
+// convolution - returns false if the grid is empty, in which 
+// case no tables are created  
+bool appl::igrid::convolute_setup(NodeCache* pdf0,
+				  NodeCache* pdf1,
+				  double (*alphas)(const double& ), 
+				  int     _nloop, 
+				  double  rscale_factor,
+				  double  fscale_factor,
+				  double Escale) 
+{
+  int nloop = std::fabs(_nloop);
+
+  if ( pdf1==0 ) pdf1 = pdf0; 
+
+  // grid is empty
+  if ( emptygrid() )  return false;
+
+  // 
+  //  if ( m_fg1==NULL ) setuppdf(pdf);
+  setuppdf( alphas, pdf0, pdf1, nloop, rscale_factor, fscale_factor, Escale);
+
+  return true;
+}
+
+
+
+// as convolute_setup() above, but the pdf and alpha_s tables are views into 
+// the tables shared between all the igrids, when the splitting functions 
+// are needed, or for the DIS grids, the igrid has its own tables as usual  
+bool appl::igrid::convolute_setup(nodetables& tables, 
+				  NodeCache* pdf0,
+				  NodeCache* pdf1,
+				  double (*alphas)(const double& ), 
+				  int     _nloop, 
+				  double  rscale_factor,
+				  double  fscale_factor,
+				  double Escale) 
+{
+  int nloop = std::fabs(_nloop);
+
+  if ( pdf1==0 ) pdf1 = pdf0; 
+
+  if ( m_folded && pdf1!=pdf0 ) throw exception("igrid::convolute_setup() folded grid needs the same pdf for both beams");
+
+  if ( ( nloop==1 && fscale_factor!=1 ) || isDISgrid() || ( isSymmetric() && pdf1!=pdf0 ) ) { 
+    return convolute_setup( pdf0, pdf1, alphas, _nloop, rscale_factor, fscale_factor, Escale );
+  }
+
+  // grid is empty
+  if ( emptygrid() )  return false;
+
+  std::vector<double> Q(Ntau());
+  for ( int itau=0 ; itau<Ntau() ; itau++ ) Q[itau] = std::sqrt(fQ2(gettau(itau)));
+
+  std::vector<double> x1(Ny1());
+  for ( int iy=0 ; iy<Ny1() ; iy++ ) x1[iy] = fx(gety1(iy));
+
+  m_alphas = tables.alphastable( alphas, Q, rscale_factor );
+
+  int stride = 0;
+  double* fg = tables.pdftable( pdf0, Q, x1, fscale_factor, Escale, m_reweight, stride );
+
+  m_fg1 = new double**[Ntau()];
+  for ( int itau=0 ; itau<Ntau() ; itau++ ) { 
+    m_fg1[itau] = new double*[Ny1()];
+    for ( int iy=0 ; iy<Ny1() ; iy++ ) m_fg1[itau][iy] = fg + (itau*stride+iy)*14;
+  }
+
+  if ( isSymmetric() ) m_fg2 = m_fg1;
+  else { 
+    std::vector<double> x2(Ny2());
+    for ( int iy=0 ; iy<Ny2() ; iy++ ) x2[iy] = fx(gety2(iy));
+    
+    fg = tables.pdftable( pdf1, Q, x2, fscale_factor, Escale, m_reweight, stride );
+
+    m_fg2 = new double**[Ntau()];
+    for ( int itau=0 ; itau<Ntau() ; itau++ ) { 
+      m_fg2[itau] = new double*[Ny2()];
+      for ( int iy=0 ; iy<Ny2() ; iy++ ) m_fg2[itau][iy] = fg + (itau*stride+iy)*14;
+    }
+  }
+
+  m_sharedtables = true;
+
+  m_transient = std::max( m_transient, tablememory( false, true ) );
+
+  return true;
+}
+
+
+
+// trim the grid if required and check whether it is empty 
+bool appl::igrid::emptygrid() { 
+  if ( m_nodes ) { 
+    if ( !m_nodes->trimmed() ) m_nodes->trim();
+    return m_nodes->xmax() - m_nodes->xmin() + 1 == 0;
+  }
+  int size=0;
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+    if ( !m_weight[ip]->trimmed() )  {
+      //  std::cout << "igrid::convolute() naughty, naughty!" << std::endl;
+      m_weight[ip]->trim();
+    }
+    size += m_weight[ip]->xmax() - m_weight[ip]->xmin() + 1;
+  }
+  return size==0;
+}
+
+
+
+// the convolution of the weights with the pdf tables from convolute_setup(), 
+// this only reads the grid and tables, so the convolutions for different
+// igrids can be run concurrently
+double appl::igrid::convolute_weights(appl_pdf*  genpdf,
+				      int     lo_order,  
+				      int     _nloop, 
+				      double  rscale_factor,
+				      double  fscale_factor ) const 
+{ 
+  pdftables t = { m_fg1, m_fg2, m_fsplit1, m_fsplit2, m_alphas, rscale_factor, fscale_factor, subproc(), -1 };
+  double dsigma = 0;
+  convolute_weights( genpdf, lo_order, _nloop, 1, &t, &dsigma );
+  return dsigma;
+}
+
+
+
+// the convolution of the weights with the pdf tables from convolute_setup(), 
+// for each subprocess separately, as for the convolution with the subprocess 
+// selected, but with only a single pass over the weights 
+void appl::igrid::convolute_subprocs(appl_pdf*  genpdf,
+				     int     lo_order,  
+				     int     _nloop, 
+				     double  rscale_factor,
+				     double  fscale_factor, 
+				     double* dsigma ) const 
+{ 
+  std::vector<pdftables> tables(m_Nproc);
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+    pdftables t = { m_fg1, m_fg2, m_fsplit1, m_fsplit2, m_alphas, rscale_factor, fscale_factor, ip, -1 };
+    tables[ip] = t;
+    dsigma[ip] = 0;
+  }
+  convolute_weights( genpdf, lo_order, _nloop, m_Nproc, &tables[0], dsigma );
+}
+
+
+
+// the convolution of the weights with the pdf tables from convolute_setup(), 
+// separately for the pairs of partons with no, one or two incoming photons, 
+// the weights are read once for all three, but the generalised pdfs are 
+// evaluated for each class in turn - for a lumi_pdf these only include the 
+// pairs in that class, so the three together cost about the same as the full 
+// evaluation, but the default appl_pdf::evaluatePhotons() uses the full 
+// evaluate() for each, and twice for a single photon, so four in all
+void appl::igrid::convolute_photons(appl_pdf*  genpdf,
+				    int     lo_order,  
+				    int     _nloop, 
+				    double  rscale_factor,
+				    double  fscale_factor, 
+				    double* dsigma ) const 
+{ 
+  pdftables tables[3];
+  for ( int i=0 ; i<3 ; i++ ) { 
+    pdftables t = { m_fg1, m_fg2, m_fsplit1, m_fsplit2, m_alphas, rscale_factor, fscale_factor, subproc(), i };
+    tables[i] = t;
+    dsigma[i] = 0;
+  }
+  convolute_weights( genpdf, lo_order, _nloop, 3, tables, dsigma );
+}
+
+
+
+// the convolution of the weights with Ntables sets of tables at the same 
+// time, so each weight need only be read once - the cross section for each 
+// set of tables is added to dsigma[i] visiting the nodes in the same 
+// order, so the result is the same as for each set of tables separately.
+// Consecutive sets with the same pdf tables share the generalised pdfs  
+void appl::igrid::convolute_weights(appl_pdf*  genpdf,
+				    int     lo_order,  
+				    int     _nloop, 
+				    int     Ntables, 
+				    const pdftables* tables, 
+				    double* dsigma ) const 
+{ 
+  int nloop = std::fabs(_nloop);
+
+  //char name[]="appl_grid:igrid::convolute(): ";
+  //const bool debug=false;  
+
+  // do the convolution  
+  // if (debug) std::cout<<name<<" nloop= "<<nloop<<endl;
+  //  std::cout << "\torder=" << lo_order << "\tnloop=" << nloop << std::endl;
+
+  std::vector<bool>   split(Ntables,false);
+  std::vector<bool>   evaluate(Ntables,true);
+  std::vector<double> _alphas(Ntables,1);
+  std::vector<double> alphaplus1(Ntables,0);
+
+  bool anysplit = false;
+  for ( int i=0 ; i<Ntables ; i++ ) { 
+    split[i] = ( nloop==1 && tables[i].fscale_factor!=1 );
+    if ( split[i] ) anysplit = true;
+    if ( i>0 && tables[i].fg1==tables[i-1].fg1 && tables[i].fg2==tables[i-1].fg2 && split[i]==split[i-1] && 
+	 tables[i].photons==tables[i-1].photons ) evaluate[i] = false; 
+  }
+
+  // use the factorised weights, unless the splitting functions 
+  // or only the contributions with photons are needed
+  bool photons = false;
+  for ( int i=0 ; i<Ntables ; i++ ) if ( tables[i].photons!=-1 ) photons = true;
+
+  if ( m_factorised && !anysplit ) { 
+    if ( !photons ) { 
+      convolute_factors( genpdf, lo_order, _nloop, Ntables, tables, dsigma );
+      return;
+    }
+  }
+
+  double* sig = new double[m_Nproc];  // weights from grid
+  double* H   = new double[m_Nproc];  // generalised pdf  
+  double* HA  = NULL;  // generalised splitting functions
+  double* HB  = NULL;  // generalised splitting functions
+  if ( anysplit ) { 
+    HA  = new double[m_Nproc];  // generalised splitting functions
+    HB  = new double[m_Nproc];  // generalised splitting functions
+  }
+  double* Hw  = NULL;  // scratch space for the photon pdfs
+  if ( photons ) Hw = new double[m_Nproc];
+
+  const double* fsA = NULL;
+  const double* fsB = NULL;
+
+  // cross section for this igrid  
+
+  // loop over the grid 
+  // 
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+    for ( int i=0 ; i<Ntables ; i++ ) { 
+      double alphas_tmp = tables[i].alphas[itau];
+      _alphas[i] = 1;    
+      for ( int iorder=0 ; iorder<lo_order ; iorder++ ) _alphas[i] *= alphas_tmp;
+      alphaplus1[i] = _alphas[i]*alphas_tmp;
+    }
+
+    // compiled grid, so only need to loop over the non-zero nodes
+    if ( m_compiled ) { 
+      for ( int inode=m_ctau[itau] ; inode<m_ctau[itau+1] ; inode++ ) { 
+	const int iy1 = m_cy1[inode];
+	const int iy2 = m_cy2[inode];
+	const double* w = cweights( inode, sig );
+	for ( int i=0 ; i<Ntables ; i++ ) { 
+	  const pdftables& t = tables[i];
+	  if ( split[i] ) { 
+	    fsA = t.fsplit1[itau][iy1];
+	    fsB = t.fsplit2[itau][iy2];
+	  }
+	  convolute_node( dsigma[i], w, H, HA, HB, Hw, 
+			  evaluate[i], t.subproc, t.photons, genpdf, t.fg1[itau][iy1], t.fg2[itau][iy2], fsA, fsB,
+			  lo_order, _nloop, t.rscale_factor, t.fscale_factor, _alphas[i], alphaplus1[i] );
+	}
+      }
+      continue;
+    }
+
+    //    for ( int iy1=0 ; iy1<Ny1() ; iy1++ ) {            
+    //      for ( int iy2=0 ; iy2<Ny2() ; iy2++ ) { 
+    for ( int iy1=Ny1() ; iy1-- ;  ) {            
+      for ( int iy2=Ny2() ; iy2-- ;  ) { 
+ 	// test if this element is actually filled
+	// if ( !m_weight[0]->trimmed(itau,iy1,iy2) ) continue; 
+	// basic convolution order component for either the born level
+	// or the convolution of the nlo grid with the pdf 
+	const double* w = weights( itau, iy1, iy2, sig );
+	
+	//	for ( int ip=0 ; ip<m_Nproc ; ip++ ) std::cout << "\t" << w[ip]; 
+	//	std::cout << std::endl;
+
+	if ( w ) { 	
+	  for ( int i=0 ; i<Ntables ; i++ ) { 
+	    const pdftables& t = tables[i];
+	    if ( split[i] ) { 
+	      fsA = t.fsplit1[itau][iy1];
+	      fsB = t.fsplit2[itau][iy2];
+	    }
+	    convolute_node( dsigma[i], w, H, HA, HB, Hw, 
+			    evaluate[i], t.subproc, t.photons, genpdf, t.fg1[itau][iy1], t.fg2[itau][iy2], fsA, fsB, 
+			    lo_order, _nloop, t.rscale_factor, t.fscale_factor, _alphas[i], alphaplus1[i] );
+	  }
+	}  // nonzero
+      }  // iy2
+    }  // iy1
+  }  // itau
+  
+  //if (debug)  std::cout << name<<"     convoluted dsigma=" << dsigma << std::endl; 
+  
+  delete[] sig;
+  delete[] H;
+  delete[] HA;
+  delete[] HB;
+  delete[] Hw;
+}
+
+
+
+// the convolution using the factorised weights - the generalised pdfs 
+// are bilinear in the pdfs for the two beams, so each rank 1 term 
+// contributes the generalised pdf of the pdfs summed over y1 with u 
+// and over y2 with v, only the coefficients for each pair of partons 
+// in each subprocess are needed, found from the generalised pdfs with 
+// unit pdfs by appl_pdf::coefficients()
+void appl::igrid::convolute_factors(appl_pdf*  genpdf,
+				    int     lo_order,  
+				    int     _nloop, 
+				    int     Ntables, 
+				    const pdftables* tables, 
+				    double* dsigma ) const 
+{ 
+  static const double twopi = 2*M_PI;
+  static const int nc = 3;
+  static const int nf = 5;
+  static double beta0=(11.*nc-2.*nf)/(6.*twopi);
+
+  int nloop = std::abs(_nloop);
+
+  // the coefficients for each pair of partons, kept by the genpdf when 
+  // the grid is factorised, otherwise found for this convolution only 
+  appl_pdf::bilinear _b;
+  const appl_pdf::bilinear* b = genpdf->coefficients();
+  if ( b==0 || int(b->pairs.size())!=m_Nproc ) { 
+    genpdf->coefficients( _b );
+    b = &_b;
+  }
+
+  const std::vector<std::vector<int> >&    pairs        = b->pairs;
+  const std::vector<std::vector<double> >& coefficients = b->coefficients;
+  const std::vector<std::vector<int> >&    partonsA     = b->partonsA;
+  const std::vector<std::vector<int> >&    partonsB     = b->partonsB;
+
+  double A[14];
+  double B[14];
+
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+
+    double xsigma = 0;
+
+    for ( int i=0 ; i<Ntables ; i++ ) { 
+
+      const pdftables& t = tables[i];
+
+      double alphas_tmp = t.alphas[itau];
+      double _alphas = 1;    
+      for ( int iorder=0 ; iorder<lo_order ; iorder++ ) _alphas *= alphas_tmp;
+      double alphaplus1 = _alphas*alphas_tmp;
+
+      // the coefficient of the weights times the generalised pdfs
+      double c = 0;
+      if ( _nloop!=-1 ) c += _alphas;
+      if ( nloop==1 && t.rscale_factor!=1 ) c += alphaplus1*twopi*beta0*lo_order*log(t.rscale_factor*t.rscale_factor);
+
+      // consecutive sets with the same pdf tables share the sum over the terms
+      if ( i==0 || t.fg1!=tables[i-1].fg1 || t.fg2!=tables[i-1].fg2 || t.subproc!=tables[i-1].subproc ) { 
+
+	xsigma = 0;
+
+	int ipmin = ( t.subproc==-1 ? 0        : t.subproc   );
+	int ipmax = ( t.subproc==-1 ? m_Nproc  : t.subproc+1 );
+
+	for ( int ip=ipmin ; ip<ipmax ; ip++ ) { 
+
+	  int slice = itau*m_Nproc+ip;
+
+	  if ( m_fslice[slice]==m_fslice[slice+1] ) continue;
+
+	  const int  y1lo = m_fbox[4*slice];
+	  const int  n1   = m_fbox[4*slice+1];
+	  const int  y2lo = m_fbox[4*slice+2];
+	  const int  n2   = m_fbox[4*slice+3];
+
+	  const double* u = &m_ffactor[0] + m_fbase[slice];
+
+	  for ( int ir=m_fslice[slice] ; ir<m_fslice[slice+1] ; ir++, u+=n1+n2 ) { 
+
+	    const double* v = u+n1;
+
+	    const std::vector<int>& pa = partonsA[ip];
+	    const std::vector<int>& pb = partonsB[ip];
+
+	    for ( unsigned ia=0 ; ia<pa.size() ; ia++ ) { 
+	      double a = 0;
+	      for ( int k=0 ; k<n1 ; k++ ) a += u[k]*t.fg1[itau][y1lo+k][pa[ia]];
+	      A[pa[ia]] = a;
+	    }
+
+	    for ( unsigned ib=0 ; ib<pb.size() ; ib++ ) { 
+	      double b = 0;
+	      for ( int k=0 ; k<n2 ; k++ ) b += v[k]*t.fg2[itau][y2lo+k][pb[ib]];
+	      B[pb[ib]] = b;
+	    }
+
+	    const std::vector<int>&    pair = pairs[ip];
+	    const std::vector<double>& coefficient = coefficients[ip];
+	    for ( unsigned ic=0 ; ic<pair.size() ; ic++ ) xsigma += coefficient[ic]*A[pair[ic]/14]*B[pair[ic]%14];
+	  }
+	}
+      }
+
+      dsigma[i] += c*xsigma;
+    }
+  }
+}
+
+
+
+// convolute with several pdfs, eg the members of a pdf set, in a single 
+// pass over the weights, returning the cross section for each pdf 
+std::vector<double> appl::igrid::convolute(const std::vector<NodeCache*>& pdfs,
+					   appl_pdf*  genpdf,
+					   double (*alphas)(const double& ), 
+					   int     lo_order,  
+					   int     _nloop, 
+					   double  rscale_factor,
+					   double  fscale_factor,
+					   double  Escale) 
+{ 
+  const int Npdf = pdfs.size();
+
+  std::vector<double> dsigma(Npdf,0);
+
+  if ( Npdf==0 ) return dsigma;
+
+  std::vector<double***> fg1(Npdf,(double***)NULL);
+  std::vector<double***> fg2(Npdf,(double***)NULL);
+  std::vector<double***> fsplit1(Npdf,(double***)NULL);
+  std::vector<double***> fsplit2(Npdf,(double***)NULL);
+
+  // set up the tables for each pdf in turn, taking ownership 
+  // of the pdf tables, the alpha_s table is the same for all
+  bool empty = false;
+  appl::memory held;
+  for ( int ipdf=0 ; ipdf<Npdf && !empty ; ipdf++ ) { 
+    if ( m_alphas ) { 
+      delete[] m_alphas;
+      m_alphas = NULL;
+    }
+    // grid is empty
+    if ( !convolute_setup( pdfs[ipdf], 0, alphas, _nloop, rscale_factor, fscale_factor, Escale ) ) empty = true;
+    else held += tablememory( m_fsplit1!=NULL, false );
+    fg1[ipdf]     = m_fg1;
+    fg2[ipdf]     = m_fg2;
+    fsplit1[ipdf] = m_fsplit1;
+    fsplit2[ipdf] = m_fsplit2;
+    m_fg1     = m_fg2     = NULL;
+    m_fsplit1 = m_fsplit2 = NULL;
+  }
+
+  m_transient = std::max( m_transient, held );
+
+  if ( !empty ) { 
+    std::vector<pdftables> tables(Npdf);
+    for ( int ipdf=0 ; ipdf<Npdf ; ipdf++ ) { 
+      pdftables t = { fg1[ipdf], fg2[ipdf], fsplit1[ipdf], fsplit2[ipdf], m_alphas, rscale_factor, fscale_factor, subproc(), -1 };
+      tables[ipdf] = t;
+    }
+    convolute_weights( genpdf, lo_order, _nloop, Npdf, &tables[0], &dsigma[0] );
+  }
+
+  // now hand the tables back to be deleted
+  for ( int ipdf=0 ; ipdf<Npdf ; ipdf++ ) { 
+    m_fg1     = fg1[ipdf];
+    m_fg2     = fg2[ipdf];
+    m_fsplit1 = fsplit1[ipdf];
+    m_fsplit2 = fsplit2[ipdf];
+    deletepdftable();
+  }
+
+  return dsigma;
+}
+
+
 
-  //  double rint = 0.;
+// convolute for several scale factors in a single pass over the weights, 
+// the scale factors are ordered so that those with the same fscale_factor, 
+// and so the same pdf tables, are adjacent and can share the generalised 
+// pdfs, the weights for each node are only read once
+std::vector<double> appl::igrid::convolute(NodeCache* pdf0,
+					   NodeCache* pdf1,
+					   appl_pdf*  genpdf,
+					   double (*alphas)(const double& ), 
+					   int     lo_order,  
+					   int     _nloop, 
+					   const std::vector<std::pair<double,double> >& scales,
+					   double  Escale) 
+{ 
+  const int Nscales = scales.size();
 
-  for ( int i=0 ; i<14 ; i++ ) f[i]=0.;
+  std::vector<double> dsigma(Nscales,0);
 
-  double fI_factor;
+  if ( Nscales==0 ) return dsigma;
 
-  for( int i3=0 ; i3<=m_tauorder ; i3++ ) { // interpolation loop in Q2
-   
-    //    double fI3 = fI(i3, m_tauorder, u_tau);
+  /// the different factorisation and renormalisation scale factors 
+  std::vector<double> fscales;
+  std::vector<double> rscales;
+  for ( int i=0 ; i<Nscales ; i++ ) { 
+    if ( std::find( rscales.begin(), rscales.end(), scales[i].first  )==rscales.end() ) rscales.push_back( scales[i].first );
+    if ( std::find( fscales.begin(), fscales.end(), scales[i].second )==fscales.end() ) fscales.push_back( scales[i].second );
+  }
 
-    for( int i1=0 ; i1<=m_yorder ; i1++ ) { // interpolation loop in x1
-      
-      //      double fI1 = fI(i1, m_yorder, u_y1); 
+  std::vector<double***> fg1(fscales.size(),(double***)NULL);
+  std::vector<double***> fg2(fscales.size(),(double***)NULL);
+  std::vector<double***> fsplit1(fscales.size(),(double***)NULL);
+  std::vector<double***> fsplit2(fscales.size(),(double***)NULL);
+
+  /// the pdf and splitting function tables for each fscale_factor
+  bool empty = false;
+  appl::memory held;
+  for ( unsigned j=0 ; j<fscales.size() && !empty ; j++ ) { 
+    if ( !convolute_setup( pdf0, pdf1, alphas, _nloop, scales[0].first, fscales[j], Escale ) ) empty = true;
+    else held += tablememory( m_fsplit1!=NULL, false );
+    fg1[j]     = m_fg1;
+    fg2[j]     = m_fg2;
+    fsplit1[j] = m_fsplit1;
+    fsplit2[j] = m_fsplit2;
+    m_fg1     = m_fg2     = NULL;
+    m_fsplit1 = m_fsplit2 = NULL;
+    if ( m_alphas ) { 
+      delete[] m_alphas;
+      m_alphas = NULL;
+    }
+  }
 
-      fI_factor=fI(i1, m_yorder, u_y1) * fI(i3, m_tauorder, u_tau);
-                    
-      for ( int ip1=0 ; ip1<14 ; ip1++ ) { 
-	f[ip1] += fI_factor*m_fg1[k3+i3][std::abs(k1+i1)][ip1];     
+  m_transient = std::max( m_transient, held );
+
+  if ( !empty ) { 
+
+    /// the alpha_s table for each rscale_factor
+    std::vector<double*> alphatables(rscales.size(),(double*)NULL);
+    for ( unsigned j=0 ; j<rscales.size() ; j++ ) alphatables[j] = alphastable( alphas, rscales[j] );
+
+    /// the tables for each scale, grouped by fscale_factor
+    std::vector<pdftables> tables;
+    std::vector<int>       index;
+    for ( unsigned jf=0 ; jf<fscales.size() ; jf++ ) { 
+      for ( int i=0 ; i<Nscales ; i++ ) { 
+	if ( scales[i].second!=fscales[jf] ) continue;
+	int jr = std::find( rscales.begin(), rscales.end(), scales[i].first ) - rscales.begin();
+	pdftables t = { fg1[jf], fg2[jf], fsplit1[jf], fsplit2[jf], alphatables[jr], scales[i].first, scales[i].second, subproc(), -1 };
+	tables.push_back( t );
+	index.push_back( i );
       }
     }
-  }
-   
-  double fun = weightfun(x); 
 
-  if ( m_reweight ) for ( int ip1=0 ; ip1<14 ; ip1++ ) f[ip1] /= fun;
+    std::vector<double> _dsigma(Nscales,0);
+    convolute_weights( genpdf, lo_order, _nloop, Nscales, &tables[0], &_dsigma[0] );
+    for ( int i=0 ; i<Nscales ; i++ ) dsigma[index[i]] = _dsigma[i];
 
-}
-#endif
+    for ( unsigned j=0 ; j<rscales.size() ; j++ ) delete[] alphatables[j];
+  }
 
-// takes pdf as the pdf lib wrapper for the pdf set for the convolution.
-// takes genpdf as a function to form the generalised parton distribution.
-// alphas is a function for the calculation of alpha_s (surprisingly)
-// lo_order is the order of the calculation, ie for inclusive, or two jets, 
-// it's O(alpha_s) (ie lo_order=1) and for 3 jet it would be O(alpha_s^2)
-// (ie lo_order=2)
-// nloop is the number of loops, ie for the leading order component it is
-// 0, for the nlo component, interestingly it is also 0, since the leading order
-// grids are seperate from the nlo grids, if nloop=1 then we must be calculating 
-// {r,f}scale_factor ie f*mu then *scale_factor=f
-// splitting, is the splitting function 
-double appl::igrid::convolute(NodeCache* pdf0,
-			      NodeCache* pdf1,
-			      appl_pdf*  genpdf,
-			      double (*alphas)(const double& ), 
-			      int     lo_order,  
-			      int     _nloop, 
-			      double  rscale_factor,
-			      double  fscale_factor,
-			      double Escale) 
-{ 
+  // now hand the tables back to be deleted
+  for ( unsigned j=0 ; j<fscales.size() ; j++ ) { 
+    m_fg1     = fg1[j];
+    m_fg2     = fg2[j];
+    m_fsplit1 = fsplit1[j];
+    m_fsplit2 = fsplit2[j];
+    deletepdftable();
+  }
 
-  //  m_transvar = m_transvarlocal;
+  return dsigma;
+}
 
-  int nloop = std::fabs(_nloop);
 
-  if ( pdf1==0 ) pdf1 = pdf0; 
 
-  //char name[]="appl_grid:igrid::convolute(): ";
+// the convolution and its derivatives with respect to the pdf values. 
+// Each generalised pdf is bilinear in the pdfs of the two beams, so the 
+// derivative with respect to the pdf for parton a of the first beam is 
+// the generalised pdf with a unit vector for that beam, and similarly 
+// for the second beam 
+double appl::igrid::jacobian(NodeCache* pdf0,
+			     NodeCache* pdf1,
+			     appl_pdf*  genpdf,
+			     double (*alphas)(const double& ), 
+			     int     lo_order,  
+			     int     _nloop, 
+			     double  rscale_factor,
+			     double  fscale_factor,
+			     double  Escale,
+			     std::vector<pdfnode>& nodes ) 
+{ 
   static const double twopi = 2*M_PI;
   static const int nc = 3;
-  //TC   const int nf = 6;
   static const int nf = 5;
   static double beta0=(11.*nc-2.*nf)/(6.*twopi);
-  //const bool debug=false;  
-
-  double alphas_tmp = 0.;  
-  double dsigma  = 0.; //, xsigma = 0.;
-  double _alphas = 1.;
-  double  alphaplus1 = 0.;
-  // do the convolution  
-  // if (debug) std::cout<<name<<" nloop= "<<nloop<<endl;
-  //  std::cout << "\torder=" << lo_order << "\tnloop=" << nloop << std::endl;
-  // is the grid empty
-  int size=0;
-  for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
-    if ( !m_weight[ip]->trimmed() )  {
-      //  std::cout << "igrid::convolute() naughty, naughty!" << std::endl;
-      m_weight[ip]->trim();
-    }
-    size += m_weight[ip]->xmax() - m_weight[ip]->xmin() + 1;
-  }
 
+  int nloop = std::fabs(_nloop);
 
+  if ( nloop==1 && fscale_factor!=1 ) throw exception("igrid::jacobian() no jacobian with factorisation scale variation");
+  if ( isDISgrid() )                  throw exception("igrid::jacobian() no jacobian for DIS grids");
+  if ( m_folded )                     throw exception("igrid::jacobian() no jacobian for folded grids");
 
   // grid is empty
-  if ( size==0 )  return 0;
+  if ( !convolute_setup( pdf0, pdf1, alphas, _nloop, rscale_factor, fscale_factor, Escale ) ) return 0;
 
-  // 
-  //  if ( m_fg1==NULL ) setuppdf(pdf);
-  setuppdf( alphas, pdf0, pdf1, nloop, rscale_factor, fscale_factor, Escale);
+  double dsigma = 0;
+
+  // derivatives with respect to the tables for each beam 
+  std::vector<double> d1( Ntau()*Ny1()*14, 0 );
+  std::vector<double> d2( Ntau()*Ny2()*14, 0 );
+
+  m_transient = std::max( m_transient, tablememory( false, false ) + vectormemory(d1) + vectormemory(d2) );
 
   double* sig = new double[m_Nproc];  // weights from grid
   double* H   = new double[m_Nproc];  // generalised pdf  
-  double* HA  = NULL;  // generalised splitting functions
-  double* HB  = NULL;  // generalised splitting functions
-  if ( nloop==1 && fscale_factor!=1 ) { 
-    HA  = new double[m_Nproc];  // generalised splitting functions
-    HB  = new double[m_Nproc];  // generalised splitting functions
-  }
+  double* HU  = new double[m_Nproc];  // generalised pdf with a unit pdf 
 
-  // cross section for this igrid  
+  double unit[14];
+  for ( int ip=0 ; ip<14 ; ip++ ) unit[ip] = 0;
+
+  int subproc = this->subproc();
 
-  // loop over the grid 
-  // 
   for ( int itau=0 ; itau<Ntau() ; itau++  ) {
-    _alphas  = 1;    
-    alphas_tmp = m_alphas[itau];
+
+    double _alphas = 1;    
+    double alphas_tmp = m_alphas[itau];
     for ( int iorder=0 ; iorder<lo_order ; iorder++ ) _alphas *= alphas_tmp;
-    alphaplus1 = _alphas*alphas_tmp;
+    double alphaplus1 = _alphas*alphas_tmp;
+
+    // the coefficient of the weights times the generalised pdfs
+    double c = 0;
+    if ( _nloop!=-1 ) c += _alphas;
+    if ( nloop==1 && rscale_factor!=1 ) c += alphaplus1*twopi*beta0*lo_order*log(rscale_factor*rscale_factor);
 
-    //    for ( int iy1=0 ; iy1<Ny1() ; iy1++ ) {            
-    //      for ( int iy2=0 ; iy2<Ny2() ; iy2++ ) { 
     for ( int iy1=Ny1() ; iy1-- ;  ) {            
       for ( int iy2=Ny2() ; iy2-- ;  ) { 
- 	// test if this element is actually filled
-	// if ( !m_weight[0]->trimmed(itau,iy1,iy2) ) continue; 
-	bool nonzero = false;
-	// basic convolution order component for either the born level
-	// or the convolution of the nlo grid with the pdf 
-	for ( int ip=0 ; ip<m_Nproc ; ip++ ) {
-	  if ( (sig[ip] = (*(const SparseMatrix3d*)m_weight[ip])(itau,iy1,iy2)) ) nonzero = true;
+
+	const double* w = weights( itau, iy1, iy2, sig );
+
+	if ( !w ) continue;
+
+	const double* fA = m_fg1[itau][iy1];
+	const double* fB = m_fg2[itau][iy2];
+
+	convolute_node( dsigma, w, H, NULL, NULL, NULL, true, subproc, -1, genpdf, fA, fB, NULL, NULL, 
+			lo_order, _nloop, rscale_factor, fscale_factor, _alphas, alphaplus1 );
+
+	double* dA = &d1[(itau*Ny1()+iy1)*14];
+	double* dB = &d2[(itau*Ny2()+iy2)*14];
+
+	for ( int ia=0 ; ia<14 ; ia++ ) { 
+	  unit[ia] = 1;
+
+	  genpdf->evaluate( unit, fB, HU );
+	  double xsigma = 0;
+	  if ( subproc!=-1 ) xsigma = w[subproc]*HU[subproc];
+	  else for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma += w[ip]*HU[ip];
+	  dA[ia] += c*xsigma;
+
+	  genpdf->evaluate( fA, unit, HU );
+	  xsigma = 0;
+	  if ( subproc!=-1 ) xsigma = w[subproc]*HU[subproc];
+	  else for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma += w[ip]*HU[ip];
+	  dB[ia] += c*xsigma;
+
+	  unit[ia] = 0;
 	}
-	
-	//	for ( int ip=0 ; ip<m_Nproc ; ip++ ) std::cout << "\t" << sig[ip]; 
-	//	std::cout << std::endl;
+      }
+    }
+  }
 
-	if ( nonzero ) { 	
-	  // build the generalised pdfs from the actual pdfs
-	  genpdf->evaluate( m_fg1[itau][iy1],  m_fg2[itau][iy2], H );
-	
-	  //	  for ( int ip=0 ; ip<m_Nproc ; ip++ ) H[ip] = 1;
-	  //    std::cout << "H return" << std::endl;
-	  //    for ( int ip=0 ; ip<m_Nproc ; ip++ ) std::cout << "\t" << H[ip] << std::endl;
+  delete[] sig;
+  delete[] H;
+  delete[] HU;
 
-	  //	  for  ( int ipp=0 ; ipp<m_Nproc ; ipp++ ) H[ipp]=1;
-  
-	  // do the convolution
+  deletepdftable();
 
-          double xsigma=0.;
+  // now the derivatives with respect to the pdf values rather than 
+  // the table values, for the nodes with non-zero derivatives
+  for ( int ibeam=0 ; ibeam<2 ; ibeam++ ) { 
 
+    int Ny = ( ibeam==0 ? Ny1() : Ny2() );
+    const std::vector<double>& d = ( ibeam==0 ? d1 : d2 );
 
-	  if ( m_parent && m_parent->subproc()!=-1 ) { 
-	    int ip=m_parent->subproc();
-	    xsigma+= sig[ip]*H[ip];
-	  }
-	  else { 
-	    for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma+= sig[ip]*H[ip];
-	  }
+    for ( int itau=0 ; itau<Ntau() ; itau++ ) { 
 
+      double Q = std::sqrt(fQ2(gettau(itau)));
 
-	  /// if want NLO part only, don't add in the born term
-	  if ( _nloop!=-1 ) dsigma += _alphas*xsigma;
+      for ( int iy=0 ; iy<Ny ; iy++ ) { 
 
-	  // now do the convolution for the variation of factorisation and 
-	  // renormalisation scales, proportional to the leading order weights
-	  if ( nloop==1 ) { 
-	  // renormalisation scale dependent bit
-	    if ( rscale_factor!=1 ) { 
-	      // nlo relative ln mu_R^2 term 
-	      dsigma+= alphaplus1*twopi*beta0*lo_order*log(rscale_factor*rscale_factor)*xsigma;
-  	    }
+	const double* _d = &d[(itau*Ny+iy)*14];
 
-	    // factorisation scale dependent bit
-            // nlo relative ln mu_F^2 term 
-	    if ( fscale_factor!=1 ) {
-	      genpdf->evaluate( m_fg1    [itau][iy1],  m_fsplit2[itau][iy2], HA);
-	      genpdf->evaluate( m_fsplit1[itau][iy1],  m_fg2    [itau][iy2], HB);
-	      xsigma=0.;
-
-	      if ( m_parent && m_parent->subproc()!=-1 ) { 
-		int ip=m_parent->subproc();
-		xsigma += sig[ip]*(HA[ip]+HB[ip]);
-	      }
-	      else { 
-		for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma += sig[ip]*(HA[ip]+HB[ip]);
-	      }
-
-
-	      dsigma -= alphaplus1*log(fscale_factor*fscale_factor)*xsigma;
-	      //if (debug) 
-              //cout <<name<<" fscale= " << fscale_factor << " dsigma= "<<dsigma << std::endl;
-	    }
-	  }
-	}  // nonzero
-      }  // iy2
-    }  // iy1
-  }  // itau
+	bool nonzero = false;
+	for ( int ip=0 ; ip<14 ; ip++ ) if ( _d[ip] ) nonzero = true; 
+	if ( !nonzero ) continue;
+
+	// the table values are x*f(x,Q)/x times the weight function 
+	double x = fx( ibeam==0 ? gety1(iy) : gety2(iy) );
+	double fun = 1;
+	if ( m_reweight ) fun = weightfun(x);
+	x *= Escale;
+	if ( x>=1 ) continue;
+
+	pdfnode n;
+	n.beam = ibeam;
+	n.x    = x;
+	n.Q    = fscale_factor*Q;
+	for ( int ip=0 ; ip<14 ; ip++ ) n.d[ip] = _d[ip]*fun/x;
+	nodes.push_back( n );
+      }
+    }
+  }
+
+  return dsigma;
+}
+
+
+
+// no alpha_s at all, for the partial sums where the alpha_s 
+// table is not used
+static double _noalphas(const double& ) { return 0; }
+
+
+// the per tau sums, S0 and SF, of the weights times the generalised pdfs, 
+// using convolute_node() with unit couplings, and only the terms required, 
+// so the subprocess selection and splitting function terms are exactly 
+// as for the full convolution 
+void appl::igrid::partialsums(NodeCache* pdf0,
+			      NodeCache* pdf1,
+			      appl_pdf*  genpdf,
+			      int     _nloop, 
+			      double  fscale_factor,
+			      double  Escale,
+			      std::vector<double>& S0, 
+			      std::vector<double>& SF ) 
+{ 
+  int nloop = std::fabs(_nloop);
+
+  S0.clear();
+  SF.clear();
+
+  // grid is empty
+  if ( !convolute_setup( pdf0, pdf1, _noalphas, _nloop, 1, fscale_factor, Escale ) ) return;
+
+  S0.resize( Ntau(), 0 );
   
-  //if (debug)  std::cout << name<<"     convoluted dsigma=" << dsigma << std::endl; 
+  bool split = ( nloop==1 && fscale_factor!=1 );
   
+  if ( split ) SF.resize( Ntau(), 0 );
+
+  int subproc = this->subproc();
+
+  double* sig = new double[m_Nproc];  // weights from grid
+  double* H   = new double[m_Nproc];  // generalised pdf  
+  double* HA  = new double[m_Nproc];  // generalised splitting functions
+  double* HB  = new double[m_Nproc];  // generalised splitting functions
+
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+    for ( int iy1=Ny1() ; iy1-- ;  ) {            
+      for ( int iy2=Ny2() ; iy2-- ;  ) { 
+
+	const double* w = weights( itau, iy1, iy2, sig );
+
+	if ( !w ) continue;
+
+	const double* fA = m_fg1[itau][iy1];
+	const double* fB = m_fg2[itau][iy2];
+
+	// the factorisation scale term, with the born term switched off 
+	if ( split ) { 
+	  convolute_node( SF[itau], w, H, HA, HB, NULL, true, subproc, -1, genpdf, fA, fB, m_fsplit1[itau][iy1], m_fsplit2[itau][iy2], 
+			  0, 1, 1, fscale_factor, 0, 1 ); 
+	}
+
+	// the born term only
+	convolute_node( S0[itau], w, H, HA, HB, NULL, !split, subproc, -1, genpdf, fA, fB, NULL, NULL, 
+			0, 0, 1, 1, 1, 0 ); 
+      }
+    }
+  }
+
   delete[] sig;
   delete[] H;
   delete[] HA;
   delete[] HB;
-  
-  deletepdftable();
-  
-  //  std::cout << "dsigma " << dsigma << std::endl;
 
-  // NB!!! the return value dsigma must be scaled by Escale*Escale which 
-  // is done in grid::vconvolute. It would be better here, but is reduces 
-  // the number of operations if in grid. 
-  return dsigma; 
+  deletepdftable();
 }
 
 
 
+// the convolution from the partial sums, the alpha_s dependence 
+// is exactly as in convolute_node() 
+double appl::igrid::convolute(const std::vector<double>& S0, 
+			      const std::vector<double>& SF, 
+			      double (*alphas)(const double& ), 
+			      int     lo_order,  
+			      int     _nloop, 
+			      double  rscale_factor, 
+			      double  fscale_factor ) const 
+{ 
+  static const double twopi = 2*M_PI;
+  static const int nc = 3;
+  static const int nf = 5;
+  static double beta0=(11.*nc-2.*nf)/(6.*twopi);
+
+  // grid is empty
+  if ( S0.size()==0 ) return 0;
+
+  if ( int(S0.size())!=Ntau() ) throw exception("igrid::convolute() partial sums do not match the grid");
+
+  int nloop = std::abs(_nloop);
+
+  double* _alphastable = alphastable( alphas, rscale_factor );
+
+  double dsigma = 0;
+
+  for ( int itau=0 ; itau<Ntau() ; itau++  ) {
+
+    double alphas_tmp = _alphastable[itau];
+    double _alphas = 1;    
+    for ( int iorder=0 ; iorder<lo_order ; iorder++ ) _alphas *= alphas_tmp;
+    double alphaplus1 = _alphas*alphas_tmp;
+
+    /// if want NLO part only, don't add in the born term
+    if ( _nloop!=-1 ) dsigma += _alphas*S0[itau];
+
+    if ( nloop==1 ) { 
+      // nlo relative ln mu_R^2 term 
+      if ( rscale_factor!=1 ) dsigma += alphaplus1*twopi*beta0*lo_order*log(rscale_factor*rscale_factor)*S0[itau];
+      // nlo relative ln mu_F^2 term, the log is already included in SF 
+      if ( fscale_factor!=1 ) dsigma += alphaplus1*SF[itau];
+    }
+  }
+
+  delete[] _alphastable;
+
+  return dsigma;
+}
+
 
 
+// a new alpha_s table, exactly as in setuppdf()
+double* appl::igrid::alphastable( double (*alphas)(const double& ), double rscale_factor ) const { 
+  const double invtwopi = 0.5/(M_PI);
+  double* table = new double[Ntau()];
+  for ( int itau=0 ; itau<m_Ntau ; itau++  ) {
+    double tau = gettau(itau);
+    double Q2  = fQ2(tau);
+    double Q   = std::sqrt(Q2); 
+    table[itau] = alphas(rscale_factor*Q)*invtwopi;
+  }
+  return table;
+}
 
 
 
@@ -1024,19 +2992,7 @@ double appl::igrid::amc_convolute(NodeCache* pdf0,
   // if (debug) std::cout<<name<<" nloop= "<<nloop<<endl;
   //  std::cout << "\torder=" << lo_order << "\tnloop=" << nloop << std::endl;
   // is the grid empty
-  int size=0;
-   for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
-    if ( !m_weight[ip]->trimmed() )  {
-      //  std::cout << "igrid::convolute() naughty, naughty!" << std::endl;
-      m_weight[ip]->trim();
-    }
-    size += m_weight[ip]->xmax() - m_weight[ip]->xmin() + 1;
-  }
-
-
-
-  // grid is empty
-  if ( size==0 )  return 0;
+  if ( emptygrid() )  return 0;
 
   // 
   //  if ( m_fg1==NULL ) setuppdf(pdf);
@@ -1061,21 +3017,30 @@ double appl::igrid::amc_convolute(NodeCache* pdf0,
     for ( int iorder=0 ; iorder<lo_order ; iorder++ ) _alphas *= alphas_tmp;
     //   alphaplus1 = _alphas*alphas_tmp;
 
+    // compiled grid, so only need to loop over the non-zero nodes
+    if ( m_compiled ) { 
+      for ( int inode=m_ctau[itau] ; inode<m_ctau[itau+1] ; inode++ ) { 
+	const double* csig = cweights(inode,sig);
+	genpdf->evaluate( m_fg1[itau][m_cy1[inode]],  m_fg2[itau][m_cy2[inode]], H );
+	double xsigma=0.;
+	for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma+=csig[ip]*H[ip];
+	dsigma += _alphas*xsigma;
+      }
+      continue;
+    }
+
     for ( int iy1=Ny1() ; iy1-- ;  ) {            
       for ( int iy2=Ny2() ; iy2-- ;  ) { 
  	// test if this element is actually filled
 	// if ( !m_weight[0]->trimmed(itau,iy1,iy2) ) continue; 
-	bool nonzero = false;
 	// basic convolution order component for either the born level
 	// or the convolution of the nlo grid with the pdf 
-	for ( int ip=0 ; ip<m_Nproc ; ip++ ) {
-	  if ( (sig[ip] = (*(const SparseMatrix3d*)m_weight[ip])(itau,iy1,iy2)) ) nonzero = true;
-	}
+	const double* w = weights( itau, iy1, iy2, sig );
 	
-	//	for ( int ip=0 ; ip<m_Nproc ; ip++ ) std::cout << "\t" << sig[ip]; 
+	//	for ( int ip=0 ; ip<m_Nproc ; ip++ ) std::cout << "\t" << w[ip]; 
 	//	std::cout << std::endl;
 
-	if ( nonzero ) { 	
+	if ( w ) { 	
 
 	  // build the generalised pdfs from the actual pdfs
 	  genpdf->evaluate( m_fg1[itau][iy1],  m_fg2[itau][iy2], H );
@@ -1083,7 +3048,7 @@ double appl::igrid::amc_convolute(NodeCache* pdf0,
 	  // do the convolution
 
           double xsigma=0.;
-	  for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma+=sig[ip]*H[ip];
+	  for ( int ip=0 ; ip<m_Nproc ; ip++ ) xsigma+=w[ip]*H[ip];
 	  dsigma += _alphas*xsigma;
 
 #if 0	
@@ -1135,6 +3100,9 @@ double appl::igrid::amc_convolute(NodeCache* pdf0,
 
 bool appl::igrid::shrink( const std::vector<int>& keep ) {
  
+  deinterleave();
+  uncompile();
+
   /// save the old grids
   int          Nproc = m_Nproc;
   SparseMatrix3d** w = m_weight;
@@ -1155,6 +3123,20 @@ bool appl::igrid::shrink( const std::vector<int>& keep ) {
   for ( int ip=0 ; ip<Nproc ; ip++ ) if ( w[ip]!=0 ) delete w[ip];
 
   delete[] w; 
+
+  /// renumber the conjugate subprocesses - if a conjugate has been 
+  /// removed, any later fills can no longer be folded
+  if ( m_folded ) { 
+    std::vector<int> index( Nproc, -1 );
+    for ( unsigned ip=0 ; ip<keep.size() ; ip++ ) index[keep[ip]] = ip;
+    std::vector<int> conjugate( m_Nproc );
+    for ( unsigned ip=0 ; ip<keep.size() ; ip++ ) conjugate[ip] = index[m_conjugate[keep[ip]]];
+    if ( std::find( conjugate.begin(), conjugate.end(), -1 )==conjugate.end() ) m_conjugate = conjugate;
+    else { 
+      m_folded = false;
+      m_conjugate.clear();
+    }
+  }
   
   return true;
 }
@@ -1169,6 +3151,9 @@ bool appl::igrid::shrink( const std::vector<int>& keep ) {
    
 void appl::igrid::optimise(int NQ2, int Nx1, int Nx2) {     
 
+  bool _interleaved = interleaved();
+  deinterleave();
+
   std::cout << "\tsize(untrimmed)=" << m_weight[0]->size();
 
   //  std::cout << "ymin=" << gety(0) << "\tymax=" << gety(m_Ny-1) 
@@ -1176,6 +3161,8 @@ void appl::igrid::optimise(int NQ2, int Nx1, int Nx2) {
 
   for ( int i=0 ; i<m_Nproc ; i++ )  m_weight[i]->trim();
 
+  uncompile();
+
   std::cout << "\tsize(trimmed)=" << m_weight[0]->size() << std::endl;
 
 
@@ -1257,6 +3244,18 @@ void appl::igrid::optimise(int NQ2, int Nx1, int Nx2) {
     if ( taumin<=taumax && taumax>tausetmax ) tausetmax = taumax;
 
   }
+
+  // the x1 and x2 axes of a folded grid must stay identical
+  if ( m_folded ) { 
+    if ( Nx1==Nx2 ) { 
+      y1setmin = y2setmin = std::min( y1setmin, y2setmin );
+      y1setmax = y2setmax = std::max( y1setmax, y2setmax );
+    }
+    else { 
+      m_folded = false;
+      m_conjugate.clear();
+    }
+  }
   
   // if grid is empty, do "nothing" ie create the grid with the same
   // limits as before but with the new required number of bins 
@@ -1365,10 +3364,12 @@ void appl::igrid::optimise(int NQ2, int Nx1, int Nx2) {
     delete m_weight[ip];
     m_weight[ip] = new SparseMatrix3d(m_Ntau, m_taumin,   m_taumax,    
 				      m_Ny1,   m_y1min,   m_y1max, 
-				      m_Ny2,   m_y2min,   m_y2max ); 
+				      m_Ny2,   m_y2min,   m_y2max, true ); 
   }   
   
   m_optimised = true;
+
+  if ( _interleaved ) interleave();
 }
 
 
@@ -1410,6 +3411,32 @@ appl::igrid& appl::igrid::operator=(const appl::igrid& g) {
     m_weight[ip] = new SparseMatrix3d(*g.m_weight[ip]);
   }
 
+  if ( m_nodes ) delete m_nodes;
+  m_nodes = ( g.m_nodes ? new tsparse3d<double>(*g.m_nodes) : NULL );
+
+  m_DISgrid   = g.m_DISgrid;
+
+  m_folded    = g.m_folded;
+  m_conjugate = g.m_conjugate;
+
+  m_compiled = g.m_compiled;
+  m_ctau     = g.m_ctau;
+  m_cy1      = g.m_cy1;
+  m_cy2      = g.m_cy2;
+  m_cweight  = g.m_cweight;
+
+  m_cprecision = g.m_cprecision;
+  m_cweightf   = g.m_cweightf;
+  m_cweight16  = g.m_cweight16;
+  m_cscale     = g.m_cscale;
+
+  m_factorised = g.m_factorised;
+  m_fresidual  = g.m_fresidual;
+  m_fslice     = g.m_fslice;
+  m_fbox       = g.m_fbox;
+  m_fbase      = g.m_fbase;
+  m_ffactor    = g.m_ffactor;
+
   return *this;
 }
 
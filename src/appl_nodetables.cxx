@@ -0,0 +1,199 @@
+//
+//   @file    appl_nodetables.cxx
+//
+//            pdf and alpha_s tables at the grid nodes shared between
+//            all the igrids for a convolution
+//
+//   Created: Sat 17 Oct 2026
+
+
+#include <cmath>
+#include <functional>
+
+#include "appl_grid/appl_nodetables.h"
+
+#include "appl_igrid.h"
+#include "Cache.h"
+
+
+bool appl::nodetables::key::operator<(const key& k) const {
+  if ( pdf!=k.pdf )                   return std::less<void (*)(const double& , const double&, double* )>()( pdf, k.pdf );
+  if ( alphas!=k.alphas )             return std::less<double (*)(const double& )>()( alphas, k.alphas );
+  if ( generation!=k.generation )     return generation<k.generation;
+  if ( scale_factor!=k.scale_factor ) return scale_factor<k.scale_factor;
+  if ( beam_scale!=k.beam_scale )     return beam_scale<k.beam_scale;
+  if ( reweight!=k.reweight )         return reweight<k.reweight;
+  if ( Q!=k.Q )                       return Q<k.Q;
+  return x<k.x;
+}
+
+
+void appl::nodetables::clear() {
+  for ( tablemap::iterator itr=m_pdftables.begin()    ; itr!=m_pdftables.end()    ; itr++ ) delete itr->second;
+  for ( tablemap::iterator itr=m_alphastables.begin() ; itr!=m_alphastables.end() ; itr++ ) delete itr->second;
+  m_pdftables.clear();
+  m_alphastables.clear();
+}
+
+
+/// delete the tables not used since the last mark()
+void appl::nodetables::sweep() {
+  tablemap* maps[2] = { &m_pdftables, &m_alphastables };
+  for ( int i=0 ; i<2 ; i++ ) {
+    tablemap& tables = *maps[i];
+    for ( tablemap::iterator itr=tables.begin() ; itr!=tables.end() ; ) {
+      if ( itr->second->stamp==m_stamp ) { 
+	itr++;
+	continue;
+      }
+      delete itr->second;
+      tables.erase( itr++ );
+    }
+  }
+}
+
+
+/// delete the least recently used tables until the limit is reached
+void appl::nodetables::evict() {
+
+  if ( m_maxbytes==0 ) return;
+
+  size_t bytes = memory().bytes;
+  if ( bytes<=m_maxbytes ) return;
+
+  /// order the tables by when they were last used 
+  typedef std::multimap<unsigned long, std::pair<tablemap*, tablemap::iterator> > agemap;
+  agemap tables;
+  tablemap* maps[2] = { &m_pdftables, &m_alphastables };
+  for ( int i=0 ; i<2 ; i++ ) { 
+    for ( tablemap::iterator itr=maps[i]->begin() ; itr!=maps[i]->end() ; itr++ ) { 
+      if ( itr->second->stamp!=m_stamp ) tables.insert( agemap::value_type( itr->second->stamp, std::make_pair( maps[i], itr ) ) );
+    }
+  }
+
+  for ( agemap::iterator itr=tables.begin() ; itr!=tables.end() && bytes>m_maxbytes ; itr++ ) { 
+    tablemap::iterator entry = itr->second.second;
+    bytes -= memory(*entry).bytes;
+    delete entry->second;
+    itr->second.first->erase( entry );
+  }
+}
+
+
+unsigned appl::nodetables::nodes() const {
+  unsigned n = 0;
+  for ( tablemap::const_iterator itr=m_pdftables.begin() ; itr!=m_pdftables.end() ; itr++ ) n += itr->first.Q.size()*itr->first.x.size();
+  return n;
+}
+
+
+appl::memory appl::nodetables::memory(const tablemap::value_type& entry) {
+  /// the map node with the key, and the table
+  return appl::memory( sizeof(tablemap::value_type), 1 ) + vectormemory(entry.first.Q) + vectormemory(entry.first.x)
+    +    appl::memory( sizeof(table), 1 ) + vectormemory(entry.second->values);
+}
+
+
+appl::memory appl::nodetables::memory(const tablemap& tables) {
+  appl::memory m;
+  for ( tablemap::const_iterator itr=tables.begin() ; itr!=tables.end() ; itr++ ) m += memory(*itr);
+  return m;
+}
+
+
+appl::memory appl::nodetables::memory() const {
+  return memory(m_pdftables) + memory(m_alphastables);
+}
+
+
+double* appl::nodetables::pdftable( NodeCache* pdf,
+				    const std::vector<double>& Q, const std::vector<double>& x,
+				    double fscale_factor, double beam_scale, bool reweight,
+				    int& stride ) {
+
+  key k;
+  k.pdf          = pdf->pdf();
+  k.alphas       = 0;
+  k.generation   = m_generation;
+  k.scale_factor = fscale_factor;
+  k.beam_scale   = beam_scale;
+  k.reweight     = reweight;
+  k.Q            = Q;
+  k.x            = x;
+
+  stride = x.size();
+
+  /// is there already a table for these nodes
+  tablemap::iterator itr = m_pdftables.find( k );
+  if ( itr!=m_pdftables.end() ) { 
+    itr->second->stamp = m_stamp;
+    return &itr->second->values[0];
+  }
+
+  /// no, so create a new one
+  table* t = new table;
+  t->stamp = m_stamp;
+  t->values.resize( Q.size()*x.size()*14, 0 );
+
+  bool scale_beams = false;
+  if ( beam_scale!=1 ) scale_beams = true;
+
+  /// exactly as in igrid::setuppdf()
+  for ( unsigned iQ=0 ; iQ<Q.size() ; iQ++ ) {
+    for ( unsigned ix=0 ; ix<x.size() ; ix++ ) {
+
+      double* f  = &t->values[(iQ*x.size()+ix)*14];
+
+      double _x  = x[ix];
+      double fun = 1;
+      if ( reweight ) fun = igrid::weightfun(_x);
+
+      if ( scale_beams ) {
+	_x *= beam_scale;
+	if ( _x>=1 ) continue;
+      }
+
+      pdf->evaluate(_x, fscale_factor*Q[iQ], f);
+
+      double invx = 1/_x;
+      for ( int ip=0 ; ip<14 ; ip++ ) f[ip] *= invx;
+      if ( reweight ) for ( int ip=0 ; ip<14 ; ip++ ) f[ip] *= fun;
+    }
+  }
+
+  m_pdftables.insert( tablemap::value_type( k, t ) );
+
+  return &t->values[0];
+}
+
+
+double* appl::nodetables::alphastable( double (*alphas)(const double& ),
+				       const std::vector<double>& Q, double rscale_factor ) {
+
+  key k;
+  k.pdf          = 0;
+  k.alphas       = alphas;
+  k.generation   = m_generation;
+  k.scale_factor = rscale_factor;
+  k.beam_scale   = 1;
+  k.reweight     = false;
+  k.Q            = Q;
+
+  tablemap::iterator itr = m_alphastables.find( k );
+  if ( itr!=m_alphastables.end() ) { 
+    itr->second->stamp = m_stamp;
+    return &itr->second->values[0];
+  }
+
+  table* t = new table;
+  t->stamp = m_stamp;
+  t->values.resize( Q.size() );
+
+  const double invtwopi = 0.5/(M_PI);
+
+  for ( unsigned iQ=0 ; iQ<Q.size() ; iQ++ ) t->values[iQ] = alphas(rscale_factor*Q[iQ])*invtwopi;
+
+  m_alphastables.insert( tablemap::value_type( k, t ) );
+
+  return &t->values[0];
+}
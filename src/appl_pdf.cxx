@@ -9,6 +9,7 @@
 //   $Id: appl_pdf.cxx, v1.0   Mon Dec 10 01:36:04 GMT 2007 sutt $
 
 #include <fstream>
+#include <cmath>
 
 #include "appl_grid/appl_pdf.h" 
 
@@ -101,6 +102,134 @@ std::ifstream& appl_pdf::openpdf( const std::string& filename ) {
 int appl_pdf::decideSubProcess( const int , const int  ) const { return -1; }
 
 
+bool appl_pdf::conjugates( std::vector<int>& conj ) { 
+
+  conj.clear();
+
+  if ( m_Nproc<=0 ) return false;
+
+  std::vector<double> HAB(2*m_Nproc);
+  std::vector<double> HBA(2*m_Nproc);
+
+  /// compare for two different arbitrary pairs of parton densities, 
+  /// so that an accidental agreement is not taken for a conjugate
+  for ( int it=0 ; it<2 ; it++ ) { 
+    double fA[14];
+    double fB[14];
+    for ( int i=0 ; i<14 ; i++ ) { 
+      fA[i] = 1.5 + std::sin( 1.3*i + 0.7 + 2.1*it );
+      fB[i] = 1.5 + std::sin( 2.9*i + 0.2 + 1.7*it );
+    }
+    evaluate( fA, fB, &HAB[it*m_Nproc] );
+    evaluate( fB, fA, &HBA[it*m_Nproc] );
+  }
+
+  conj.resize( m_Nproc, -1 );
+
+  for ( int i=0 ; i<m_Nproc ; i++ ) { 
+    /// try the subprocess itself first, so symmetric subprocesses map to themselves
+    for ( int j0=0 ; j0<=m_Nproc && conj[i]==-1 ; j0++ ) { 
+      int j = ( j0==0 ? i : j0-1 );
+      bool same = true;
+      for ( int it=0 ; it<2 && same ; it++ ) { 
+	double a = HBA[it*m_Nproc+i];
+	double b = HAB[it*m_Nproc+j];
+	if ( std::fabs(a-b)>1e-12*(std::fabs(a)+std::fabs(b)) ) same = false;
+      }
+      if ( same ) conj[i] = j;
+    }
+    if ( conj[i]==-1 ) { 
+      conj.clear();
+      return false;
+    }
+  }
+
+  /// exchanging the beams twice must give the original subprocess
+  for ( int i=0 ; i<m_Nproc ; i++ ) { 
+    if ( conj[conj[i]]!=i ) { 
+      conj.clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void appl_pdf::evaluatePhotons(const double* fA, const double* fB, double* H, int nphotons, double* work) { 
+
+  /// photon at index 13, LHAPDF code 7 offset by 6 
+  static const int iphoton = 13;
+
+  double pA[14];
+  double pB[14];
+  double gA[14] = { 0 };
+  double gB[14] = { 0 };
+
+  for ( int i=0 ; i<14 ; i++ ) { 
+    pA[i] = fA[i];
+    pB[i] = fB[i];
+  }
+
+  pA[iphoton] = pB[iphoton] = 0;
+  gA[iphoton] = fA[iphoton];
+  gB[iphoton] = fB[iphoton];
+
+  if      ( nphotons==0 ) evaluate( pA, pB, H );
+  else if ( nphotons==2 ) evaluate( gA, gB, H );
+  else if ( nphotons==1 ) { 
+    evaluate( gA, pB, H );
+    evaluate( pA, gB, work );
+    for ( int i=0 ; i<m_Nproc ; i++ ) H[i] += work[i];
+  }
+  else throw exception( std::cerr << "appl_pdf::evaluatePhotons() invalid number of photons " << nphotons );
+}
+
+
+
+void appl_pdf::coefficients( bilinear& b ) { 
+
+  b.pairs        = std::vector<std::vector<int> >(m_Nproc);
+  b.coefficients = std::vector<std::vector<double> >(m_Nproc);
+  b.partonsA     = std::vector<std::vector<int> >(m_Nproc);
+  b.partonsB     = std::vector<std::vector<int> >(m_Nproc);
+
+  std::vector<double> H(m_Nproc);
+
+  double unitA[14] = { 0 };
+  double unitB[14] = { 0 };
+
+  for ( int ia=0 ; ia<14 ; ia++ ) { 
+    unitA[ia] = 1;
+    for ( int ib=0 ; ib<14 ; ib++ ) { 
+      unitB[ib] = 1;
+      evaluate( unitA, unitB, &H[0] );
+      for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+	if ( H[ip]==0 ) continue;
+	b.pairs[ip].push_back( ia*14+ib );
+	b.coefficients[ip].push_back( H[ip] );
+      }
+      unitB[ib] = 0;
+    }
+    unitA[ia] = 0;
+  }
+
+  /// only the sums for the partons that contribute are needed
+  for ( int ip=0 ; ip<m_Nproc ; ip++ ) { 
+    bool usedA[14] = { false };
+    bool usedB[14] = { false };
+    for ( unsigned ic=0 ; ic<b.pairs[ip].size() ; ic++ ) { 
+      usedA[b.pairs[ip][ic]/14] = true;
+      usedB[b.pairs[ip][ic]%14] = true;
+    }
+    for ( int ia=0 ; ia<14 ; ia++ ) { 
+      if ( usedA[ia] ) b.partonsA[ip].push_back(ia);
+      if ( usedB[ia] ) b.partonsB[ip].push_back(ia);
+    }
+  }
+}
+
+
 
 bool appl_pdf::create_map() { 
 
@@ -253,6 +382,8 @@ void appl_pdf::setckm2( const std::vector<std::vector<double> >& ckm2 ) {
   for ( unsigned i=0 ; i<m_ckm2.size() ; i++ ) { 
     for ( unsigned j=0 ; j<m_ckm2[i].size() ; j++ ) m_ckmsum[i] += m_ckm2[i][j]; 
   }  
+  /// the kept coefficients depend on the ckm matrices
+  if ( m_bilinear.pairs.size() ) setupcoefficients();
 } 
 
 
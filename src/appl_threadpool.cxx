@@ -0,0 +1,235 @@
+//
+//   @file    appl_threadpool.cxx
+//
+//            a small, persistent pthreads pool with work stealing
+//
+//   Created: Sat 17 Oct 2026
+
+
+#include <unistd.h>
+
+#include "appl_grid/appl_threadpool.h"
+
+
+namespace {
+
+  /// argument for the worker thread start function
+  struct worker_arg {
+    worker_arg(appl::threadpool* p, int i) : pool(p), id(i) { }
+    appl::threadpool* pool;
+    int               id;
+  };
+
+}
+
+
+appl::threadpool::threadpool(int nthreads) :
+  m_generation(0),
+  m_pending(0),
+  m_starting(0),
+  m_stop(false),
+  m_failed(false)
+{
+  if ( nthreads<1 ) nthreads = 1;
+
+  pthread_mutex_init(&m_lock, 0);
+  pthread_cond_init(&m_start, 0);
+  pthread_cond_init(&m_done, 0);
+
+  for ( int i=0 ; i<nthreads ; i++ ) m_queues.push_back( new queue );
+
+  /// queue 0 belongs to the calling thread, so only need
+  /// to start nthreads-1 workers
+  m_threads.resize(nthreads-1);
+  m_starting = nthreads-1;
+  for ( int i=1 ; i<nthreads ; i++ ) {
+    pthread_create( &m_threads[i-1], 0, start, new worker_arg(this,i) );
+  }
+}
+
+
+appl::threadpool::~threadpool() {
+  pthread_mutex_lock(&m_lock);
+  m_stop = true;
+  pthread_cond_broadcast(&m_start);
+  pthread_mutex_unlock(&m_lock);
+
+  for ( unsigned i=0 ; i<m_threads.size() ; i++ ) pthread_join( m_threads[i], 0 );
+
+  for ( unsigned i=0 ; i<m_queues.size() ; i++ ) delete m_queues[i];
+
+  pthread_cond_destroy(&m_done);
+  pthread_cond_destroy(&m_start);
+  pthread_mutex_destroy(&m_lock);
+}
+
+
+int appl::threadpool::cores() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return ( n>0 ? int(n) : 1 );
+}
+
+
+void appl::threadpool::run(const std::vector<task*>& tasks) {
+
+  if ( tasks.size()==0 ) return;
+
+  /// only one thread, no need for any of the locking
+  if ( m_queues.size()==1 ) {
+    for ( unsigned i=0 ; i<tasks.size() ; i++ ) tasks[i]->run();
+    return;
+  }
+
+  pthread_mutex_lock(&m_lock);
+
+  /// don't hand out new work while any workers are still
+  /// starting, so that no worker can miss a generation
+  while ( m_starting>0 ) pthread_cond_wait(&m_done, &m_lock);
+
+  /// split the tasks into contiguous blocks, one block per
+  /// queue, the stealing then balances the load
+  unsigned N = m_queues.size();
+  for ( unsigned i=0 ; i<N ; i++ ) {
+    unsigned begin = (tasks.size()*i)/N;
+    unsigned end   = (tasks.size()*(i+1))/N;
+    pthread_mutex_lock(&m_queues[i]->lock);
+    for ( unsigned j=begin ; j<end ; j++ ) m_queues[i]->tasks.push_back(tasks[j]);
+    pthread_mutex_unlock(&m_queues[i]->lock);
+  }
+
+  m_pending = tasks.size();
+  m_generation++;
+  pthread_cond_broadcast(&m_start);
+  pthread_mutex_unlock(&m_lock);
+
+  /// the calling thread works too
+  work(0);
+
+  /// all the threads must be finished with the tasks before 
+  /// anything is rethrown
+  pthread_mutex_lock(&m_lock);
+  while ( m_pending>0 ) pthread_cond_wait(&m_done, &m_lock);
+  pthread_mutex_unlock(&m_lock);
+
+  rethrow();
+}
+
+
+appl::threadpool::task* appl::threadpool::next(int i) {
+
+  task* t = 0;
+
+  /// own queue from the front
+  queue* q = m_queues[i];
+  pthread_mutex_lock(&q->lock);
+  if ( !q->tasks.empty() ) {
+    t = q->tasks.front();
+    q->tasks.pop_front();
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  if ( t ) return t;
+
+  /// steal from the back of the other queues
+  unsigned N = m_queues.size();
+  for ( unsigned j=1 ; j<N && t==0 ; j++ ) {
+    queue* v = m_queues[(i+j)%N];
+    pthread_mutex_lock(&v->lock);
+    if ( !v->tasks.empty() ) {
+      t = v->tasks.back();
+      v->tasks.pop_back();
+    }
+    pthread_mutex_unlock(&v->lock);
+  }
+
+  return t;
+}
+
+
+void appl::threadpool::work(int i) {
+  task* t = 0;
+  while ( (t=next(i)) ) {
+    /// nothing may escape from a worker, and the remaining 
+    /// tasks are only taken off the queues once one has failed
+    pthread_mutex_lock(&m_lock);
+    bool failed = m_failed;
+    pthread_mutex_unlock(&m_lock);
+    if ( !failed ) { 
+      try { t->run(); }
+      catch ( ... ) { fail(); }
+    }
+    pthread_mutex_lock(&m_lock);
+    if ( --m_pending==0 ) pthread_cond_broadcast(&m_done);
+    pthread_mutex_unlock(&m_lock);
+  }
+}
+
+
+/// only ever called from within a catch block 
+void appl::threadpool::fail() {
+  pthread_mutex_lock(&m_lock);
+  if ( !m_failed ) { 
+    m_failed = true;
+#if __cplusplus >= 201103L
+    m_exception = std::current_exception();
+#else
+    try { throw; }
+    catch ( std::exception& e ) { m_message = e.what(); }
+    catch ( ... )               { m_message = "unknown exception"; }
+#endif
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+
+/// only called once all the tasks have completed
+void appl::threadpool::rethrow() {
+  pthread_mutex_lock(&m_lock);
+  bool failed = m_failed;
+  m_failed = false;
+#if __cplusplus >= 201103L
+  std::exception_ptr e = m_exception;
+  m_exception = std::exception_ptr();
+#else
+  std::string message = m_message;
+  m_message.clear();
+#endif
+  pthread_mutex_unlock(&m_lock);
+  if ( !failed ) return;
+#if __cplusplus >= 201103L
+  std::rethrow_exception( e );
+#else
+  throw exception( "task failed: " + message );
+#endif
+}
+
+
+void appl::threadpool::worker(int i) {
+
+  pthread_mutex_lock(&m_lock);
+  unsigned long generation = m_generation;
+  if ( --m_starting==0 ) pthread_cond_broadcast(&m_done);
+
+  while ( true ) {
+    while ( !m_stop && generation==m_generation ) pthread_cond_wait(&m_start, &m_lock);
+    if ( m_stop ) break;
+    generation = m_generation;
+    pthread_mutex_unlock(&m_lock);
+
+    work(i);
+
+    pthread_mutex_lock(&m_lock);
+  }
+
+  pthread_mutex_unlock(&m_lock);
+}
+
+
+void* appl::threadpool::start(void* arg) {
+  worker_arg* w = static_cast<worker_arg*>(arg);
+  threadpool* pool = w->pool;
+  int         id   = w->id;
+  delete w;
+  pool->worker(id);
+  return 0;
+}
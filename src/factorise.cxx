@@ -0,0 +1,138 @@
+//
+//   @file    factorise.cxx
+//            report the rank and accuracy of the factorised weights
+//            for each bin of a grid
+//
+//   Created: Sat 17 Oct 2026
+
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+
+#include "appl_grid/appl_grid.h"
+#include "amconfig.h"
+
+#include "appl_grid/appl_timer.h"
+
+
+int usage(std::ostream& s, int argc, char** argv) {
+  if ( argc<1 ) return -1; /// should never be the case
+  s << "Usage: " << argv[0] << " [OPTIONS] input_grid.root\n\n";
+  s << "  APPLgrid \'" << argv[0] << "\' reports the rank and accuracy of the factorised weights\n"
+    << "  for each bin of an " << PACKAGE_STRING << " grid, compared to the exact convolution\n"
+    << "  with a simple test pdf\n\n";
+  s << "Options: \n";
+  s << "    -t, --tolerance value\t relative tolerance on the weights for each slice (default 0.001)\n";
+  s << "    -v, --version  \t displays the APPLgrid version\n";
+  s << "    -h, --help     \t display this help\n";
+  s << "\nReport bugs to <" << PACKAGE_BUGREPORT << ">";
+  s << std::endl;
+  return 0;
+}
+
+
+/// simple test pdf, x*f(x) for all the partons, since only the
+/// accuracy of the factorised weights relative to the exact
+/// weights is needed, not the cross section itself
+
+void testpdf(const double& x, const double& Q, double* f) {
+  double lQ = std::log(Q*Q/100);
+  for ( int i=0 ; i<13 ; i++ ) f[i] = std::pow(x,0.5)*std::pow(1-x,3+0.2*std::abs(i-6))*(1+0.01*lQ);
+  f[6]  = 3*std::pow(x,-0.1)*std::pow(1-x,5)*(1+0.02*lQ);
+  f[13] = 0.01*f[6];
+}
+
+double testalphas(const double& Q) {
+  return 0.118/(1+0.118*0.61*std::log(Q*Q/8315.));
+}
+
+
+
+int main(int argc, char** argv) {
+
+  if ( argc<2 ) return usage( std::cerr, argc, argv );
+
+  /// handle the "perform and exit" parameters
+  for ( int i=1 ; i<argc ; i++ ) {
+    if ( std::string(argv[i])=="-h" || std::string(argv[i])=="--help" )    return usage( std::cout, argc, argv );
+    if ( std::string(argv[i])=="-v" || std::string(argv[i])=="--version" ) {
+      std::cout << argv[0] << " APPLgrid version " << PACKAGE_VERSION << std::endl;
+      return 0;
+    }
+  }
+
+  double tolerance = 0.001;
+
+  std::string input_grid = "";
+
+  for ( int i=1 ; i<argc ; i++ ) {
+    if ( std::string(argv[i])=="-t" || std::string(argv[i])=="--tolerance" ) {
+      ++i;
+      if ( i<argc ) tolerance = std::atof(argv[i]);
+      else  return usage( std::cerr, argc, argv );
+    }
+    else if ( input_grid=="" ) input_grid = argv[i];
+    else return usage( std::cerr, argc, argv );
+  }
+
+  if ( input_grid=="" ) return usage( std::cerr, argc, argv );
+
+  appl::grid g(input_grid);
+
+  struct timeval tstart = appl_timer_start();
+  std::vector<double> exact = g.vconvolute( testpdf, testalphas );
+  double texact = appl_timer_stop( tstart );
+
+  tstart = appl_timer_start();
+  double residual = g.factorise( tolerance );
+  double tfactorise = appl_timer_stop( tstart );
+
+  tstart = appl_timer_start();
+  std::vector<double> approx = g.vconvolute( testpdf, testalphas );
+  double tapprox = appl_timer_stop( tstart );
+
+  std::cout << "grid:      " << input_grid << "\n";
+  std::cout << "tolerance: " << tolerance  << "\tlargest residual: " << residual << "\n" << std::endl;
+
+  /// the rank and residual are for the internal bins, the cross
+  /// sections for the bins after any combination
+  bool combined = ( g.Nobs()!=g.Nobs_internal() );
+
+  std::cout << std::setw(5) << "bin" << std::setw(12) << "low" << std::setw(12) << "high"
+	    << std::setw(6) << "rank" << std::setw(12) << "residual";
+  if ( !combined ) std::cout << std::setw(14) << "exact" << std::setw(14) << "factorised" << std::setw(14) << "rel diff";
+  std::cout << std::endl;
+
+  double maxdiff = 0;
+
+  for ( int i=0 ; i<g.Nobs_internal() ; i++ ) {
+    std::cout << std::setw(5)  << i
+	      << std::setw(12) << g.obslow_internal(i) << std::setw(12) << g.obslow_internal(i+1)
+	      << std::setw(6)  << g.rank(i) << std::setw(12) << g.residual(i);
+    if ( !combined ) {
+      double diff = ( exact[i]!=0 ? approx[i]/exact[i]-1 : approx[i] );
+      if ( std::fabs(diff)>maxdiff ) maxdiff = std::fabs(diff);
+      std::cout << std::setw(14) << exact[i] << std::setw(14) << approx[i] << std::setw(14) << diff;
+    }
+    std::cout << "\n";
+  }
+
+  if ( combined ) {
+    std::cout << "\n" << std::setw(5) << "bin" << std::setw(14) << "exact" << std::setw(14) << "factorised" << std::setw(14) << "rel diff" << "\n";
+    for ( unsigned i=0 ; i<exact.size() ; i++ ) {
+      double diff = ( exact[i]!=0 ? approx[i]/exact[i]-1 : approx[i] );
+      if ( std::fabs(diff)>maxdiff ) maxdiff = std::fabs(diff);
+      std::cout << std::setw(5) << i << std::setw(14) << exact[i] << std::setw(14) << approx[i] << std::setw(14) << diff << "\n";
+    }
+  }
+
+  std::cout << "\nlargest relative difference: " << maxdiff << "\n";
+  std::cout << "convolution time: exact " << texact << " ms\tfactorised " << tapprox << " ms"
+	    << "\t(factorisation " << tfactorise << " ms)" << std::endl;
+
+  return 0;
+}
@@ -124,6 +124,33 @@ void setckm_( const int& id, const double* ckm ) {
 }
 
 
+void setcache_( const int& id, const int& flag ) { 
+  std::map<int,appl::grid*>::iterator gitr = _grid.find(id);
+  if ( gitr!=_grid.end() ) {
+    gitr->second->setCache( flag!=0 );
+  }
+  else throw appl::grid::exception( std::cerr << "No grid with id " << id << std::endl );
+}
+
+
+void setcachegeneration_( const int& id, const int& generation ) { 
+  std::map<int,appl::grid*>::iterator gitr = _grid.find(id);
+  if ( gitr!=_grid.end() ) {
+    gitr->second->setCacheGeneration( generation );
+  }
+  else throw appl::grid::exception( std::cerr << "No grid with id " << id << std::endl );
+}
+
+
+void setcachesize_( const int& id, const int& mbytes ) { 
+  std::map<int,appl::grid*>::iterator gitr = _grid.find(id);
+  if ( gitr!=_grid.end() ) {
+    gitr->second->setCacheSize( size_t(mbytes>0 ? mbytes : 0)*1024*1024 );
+  }
+  else throw appl::grid::exception( std::cerr << "No grid with id " << id << std::endl );
+}
+
+
 void getckm_( const int& id, double* ckm ) { 
   std::map<int,appl::grid*>::iterator gitr = _grid.find(id);
   if ( gitr!=_grid.end() ) { 
@@ -101,6 +101,8 @@ lumi_pdf::lumi_pdf(const std::string& s, const std::vector<int>& combinations )
 
   create_lookup();
 
+  create_photons();
+
   //  std::cout << "decideSuprocess " << decideSubProcess( 0, 0 ) << std::endl;
   //  std::cout << "lumi_pdf::lumi_pdf() " << s << "\tv size " << m_combinations.size() << " lookup size " << m_lookup.size() << std::endl; 
   //  std::cout << *this << std::endl;
@@ -138,6 +140,8 @@ lumi_pdf::lumi_pdf(const std::string& s, const std::vector<combination>& combina
   m_Nproc = m_combinations.size();
 
   create_lookup();
+
+  create_photons();
   
 }
 
@@ -158,6 +162,27 @@ void lumi_pdf::create_lookup() {
 
 
 
+void lumi_pdf::create_photons() { 
+  /// photon is 7 in the lhapdf numbering
+  for ( int nphotons=0 ; nphotons<3 ; nphotons++ ) { 
+    m_photons[nphotons].clear();
+    for ( unsigned i=0 ; i<size() ; i++ ) { 
+      const combination& c = m_combinations[i];
+      std::vector<int> v(2);
+      v[0] = c.index();
+      for ( unsigned j=0 ; j<c.size() ; j++ ) { 
+	if ( (c[j].first==7) + (c[j].second==7) != nphotons ) continue;
+	v.push_back( c[j].first );
+	v.push_back( c[j].second );
+      }
+      v[1] = (v.size()-2)/2;
+      m_photons[nphotons].push_back( combination(v) );
+    }
+  }
+}
+
+
+
 void lumi_pdf::evaluate(const double* xfA, const double* xfB, double* H) { 
   /// if need to include the ckm matrix ...
   if ( m_ckmcharge==0 )  {
@@ -173,6 +198,22 @@ void lumi_pdf::evaluate(const double* xfA, const double* xfB, double* H) {
 }
 
 
+void lumi_pdf::evaluatePhotons(const double* xfA, const double* xfB, double* H, int nphotons, double* ) { 
+  if ( nphotons<0 || nphotons>2 ) throw exception( std::cerr << "lumi_pdf::evaluatePhotons() invalid number of photons " << nphotons );
+  const std::vector<combination>& combinations = m_photons[nphotons];
+  if ( m_ckmcharge==0 )  {
+    for ( unsigned i=size() ; i-- ; ) { 
+      H[i] = combinations[i].evaluate( xfA, xfB ); 
+    }
+  }
+  else { 
+    for ( unsigned i=size() ; i-- ; ) { 
+      H[i] = combinations[i].evaluate( xfA, xfB, m_ckmsum, m_ckm2 ); 
+    }
+  }
+}
+
+
 int  lumi_pdf::decideSubProcess(const int iflav1, const int iflav2) const { 
   //  std::cout << "lumi_pdf::decideSubProcess() " << name() << " " << m_lookup.size() << std::endl;
   return m_lookup[iflav1+6][iflav2+6];
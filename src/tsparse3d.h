@@ -1,11 +1,33 @@
 // emacs: this is -*- c++ -*-
 //
-//   tsparse3d.h        
+//   tsparse3d.h
 //
-//   very basic 3d sparse matrix class, needs to be improved, 
-//   and extended to 3d                   
-// 
-//   Copyright (C) 2007 M.Sutton (sutt@hep.ucl.ac.uk)    
+//   very basic 3d sparse matrix class, all the occupied ranges are
+//   stored in a single block of memory (the arena) rather than as
+//   separate arrays for each row, with tables of the occupied range
+//   in y for each x, and of the occupied range in z, and the offset
+//   into the arena, for each (x,y) row
+//
+//   each (i,j,k) node can hold a vector of Nw values, stored together,
+//   with the (i,j,k) operator accessing the first and node(i,j,k) the
+//   whole vector - a node is only trimmed if all its values are zero
+//
+//   while filling, a row that needs to grow is moved to the end of the
+//   arena with space reserved for twice as many elements as before, so
+//   that it can then grow in place, and the arena is only made compact
+//   again when the matrix is trimmed - if the arena would need more
+//   space than the full grid, the full grid is allocated instead
+//
+//   the values of a trimmed matrix can also be used in place, eg from
+//   a memory mapped file, in which case they are only copied into the
+//   arena when the matrix is first modified
+//
+//   NB: as for tsparse2d, the non-const (i,j,k) operator will create
+//       the element if it doesn't already exist, and this may move
+//       the existing elements within the arena, so references to
+//       elements are only valid until the next element is created
+//
+//   Copyright (C) 2007 M.Sutton (sutt@hep.ucl.ac.uk)
 //
 //   $Id: tsparse3d.h, v   Fri Nov  9 00:17:31 CET 2007 sutt
 
@@ -14,197 +36,406 @@
 #define __TSPARSE3D_H
 
 #include <iostream>
+#include <vector>
 
 #include "tsparse2d.h"
 
 
-template<class T> 
+template<class T>
 class tsparse3d : public tsparse_base {
 
 public:
 
-  tsparse3d(int nx, int ny, int nz) 
-    : tsparse_base(nx), m_Ny(ny), m_Nz(nz), m_v(NULL), m_trimmed(false) {
-    m_v = new tsparse2d<T>*[m_Nx];
-    for ( int i=0 ; i<m_Nx ; i++ ) m_v[i] = new tsparse2d<T>(m_Ny, m_Nz);
-    //   setup_fast();
-  }
-
-  // Fixme: need to rewrite this constructor properly, so that 
-  // a trimmed matrix is copied as trimmed and not copied in full 
-  // and then trimmed
-  tsparse3d(const tsparse3d& t) 
-    : tsparse_base(t.m_Nx), m_Ny(t.m_Ny), m_Nz(t.m_Nz), m_v(NULL), m_trimmed(t.m_trimmed) {
-    m_v = new tsparse2d<T>*[m_Nx];
-    for ( int i=0 ; i<m_Nx ; i++ ) m_v[i] = new tsparse2d<T>(m_Ny, m_Nz);
-    //   setup_fast();
-    // deep copy of all elements
+  // an empty matrix has no elements allocated until they are filled, 
+  // otherwise all the elements are created, as for untrim()
+  tsparse3d(int nx, int ny, int nz, int nw=1, bool empty=false)
+    : tsparse_base(nx), m_Ny(ny), m_Nz(nz), m_Nw(nw), m_mapped(NULL), m_nmapped(0), m_garbage(0), m_dense(false), m_trimmed(false) {
+    if ( empty ) clear();
+    else         untrim();
+  }
+
+  // a trimmed matrix is copied trimmed, an untrimmed one in full
+  tsparse3d(const tsparse3d& t)
+    : tsparse_base(t.m_Nx), m_Ny(t.m_Ny), m_Nz(t.m_Nz), m_Nw(t.m_Nw), m_mapped(NULL), m_nmapped(0), m_garbage(0), m_dense(false), m_trimmed(false) {
+    copy(t);
+  }
+
+
+  virtual ~tsparse3d() { }
+
+
+  // accessors
+  int Ny() const { return m_Ny; }
+  int Nz() const { return m_Nz; }
+  int Nw() const { return m_Nw; }
+
+  // occupied range in y for x bin i, and in z for row (i,j)
+  int ylo(int i) const { return m_ylo[i]; }
+  int yhi(int i) const { return m_yhi[i]; }
+
+  int zlo(int i, int j) const { return m_zlo[i*m_Ny+j]; }
+  int zhi(int i, int j) const { return m_zhi[i*m_Ny+j]; }
+
+  // the elements of row (i,j), from zlo(i,j) to zhi(i,j), each with 
+  // Nw values - only valid for i and j within the occupied ranges
+  const T* row(int i, int j) const { 
+    const T* v = values();
+    return ( v ? v + m_offset[i*m_Ny+j] : NULL ); 
+  }
+
+  // set up a trimmed matrix directly from the occupied x range, the 
+  // occupied y range for each x bin, and the occupied z range and offset 
+  // for each row, with the values of the rows stored contiguously - if 
+  // mapped the values are used in place rather than copied, until the 
+  // matrix is next modified, so they must remain valid until then
+  void assign( int lx, int ux, const int* ylo, const int* yhi, 
+	       const int* zlo, const int* zhi, const int* offset, 
+	       const T* arena, int narena, bool mapped ) {
+
+    clear();
+
+    m_lx = lx;
+    m_ux = ux;
+
+    m_ylo.assign( ylo, ylo+m_Nx );
+    m_yhi.assign( yhi, yhi+m_Nx );
+
+    m_zlo.assign( zlo, zlo+m_Nx*m_Ny );
+    m_zhi.assign( zhi, zhi+m_Nx*m_Ny );
+    m_offset.assign( offset, offset+m_Nx*m_Ny );
+
+    m_clo = m_zlo;
+    m_chi = m_zhi;
+
+    if ( mapped ) { 
+      m_mapped  = arena;
+      m_nmapped = narena;
+    }
+    else m_arena.assign( arena, arena+narena );
+
+    m_trimmed = true;
+  }
+
+  // set up a trimmed matrix from a full array of single values, eg the
+  // bins of a histogram, with element (i,j,k) at v[i*sx+j*sy+k*sz], so
+  // the result is the same as filling every element and then trimming,
+  // but the full matrix is never allocated - the array is read twice,
+  // with i varying fastest, first for the non-zero range of each row
+  // and then to copy those ranges, and the values are held in a single
+  // allocation of exactly the size needed
+  void assign( const T* v, int sx, int sy, int sz ) {
+
+    clear();
+
+    if ( m_Nw!=1 ) throw out_of_range("assign from array with Nw>1");
+
+    m_zlo.assign( m_Nx*m_Ny, m_Nz );
+    m_zhi.assign( m_Nx*m_Ny, -1 );
+
+    for ( int k=0 ; k<m_Nz ; k++ ) {
+      for ( int j=0 ; j<m_Ny ; j++ ) {
+	const T* vjk = v + j*sy + k*sz;
+	for ( int i=0 ; i<m_Nx ; i++ ) {
+	  if ( vjk[i*sx]==T(0) ) continue;
+	  int r = i*m_Ny+j;
+	  if ( m_zlo[r]>k ) m_zlo[r] = k;
+	  m_zhi[r] = k;
+	}
+      }
+    }
+
+    m_ylo.assign( m_Nx, m_Ny );
+    m_yhi.assign( m_Nx, m_Ny-1 );
+    m_offset.assign( m_Nx*m_Ny, 0 );
+
+    m_lx = m_Nx;
+    m_ux = m_Nx-1;
+
+    // the occupied ranges, and the overall range in y and z to copy
+    int ymin = m_Ny;
+    int ymax = -1;
+    int zmin = m_Nz;
+    int zmax = -1;
+
+    int n = 0;
     for ( int i=0 ; i<m_Nx ; i++ ) {
       for ( int j=0 ; j<m_Ny ; j++ ) {
-	for ( int k=0 ; k<m_Nz ; k++ ) (*this)(i,j,k) = t(i,j,k);
+	int r = i*m_Ny+j;
+	if ( m_zlo[r]>m_zhi[r] ) {
+	  m_zhi[r] = m_Nz-1;
+	  continue;
+	}
+	m_offset[r] = n;
+	n += m_zhi[r]-m_zlo[r]+1;
+
+	if ( m_zlo[r]<zmin ) zmin = m_zlo[r];
+	if ( m_zhi[r]>zmax ) zmax = m_zhi[r];
+
+	if ( m_ylo[i]>m_yhi[i] ) m_ylo[i] = j;
+	m_yhi[i] = j;
+
+	if ( m_lx>m_ux ) m_lx = i;
+	m_ux = i;
+      }
+      if ( m_ylo[i]<ymin ) ymin = m_ylo[i];
+      if ( m_ylo[i]<=m_yhi[i] && m_yhi[i]>ymax ) ymax = m_yhi[i];
+    }
+
+    m_arena.resize( n );
+
+    for ( int k=zmin ; k<=zmax ; k++ ) {
+      for ( int j=ymin ; j<=ymax ; j++ ) {
+	const T* vjk = v + j*sy + k*sz;
+	for ( int i=m_lx ; i<=m_ux ; i++ ) {
+	  int r = i*m_Ny+j;
+	  if ( k<m_zlo[r] || k>m_zhi[r] ) continue;
+	  m_arena[m_offset[r]+k-m_zlo[r]] = vjk[i*sx];
+	}
       }
-    }    
-    if ( m_trimmed ) trim();
-  }
-  
-  
-  ~tsparse3d() { 
-    if ( m_v ) { 
-      for ( int i=m_ux-m_lx+1 ; i-- ;  )  if ( m_v[i] ) delete m_v[i];
-      delete[] m_v;
     }
-    //    empty_fast();
+
+    m_clo = m_zlo;
+    m_chi = m_zhi;
+
+    m_trimmed = true;
   }
-  
 
-  // accessors
-  int Ny() const { return m_Ny; } 
-  int Nz() const { return m_Nz; } 
+  // are the values being used in place
+  bool mapped() const { return m_mapped!=NULL; }
+
 
+  void trim() {
 
+    // values used in place are already trimmed
+    if ( m_mapped ) return;
 
-  void trim() { 
-    
     m_trimmed = true;
-    
-    // trim each column down 
-    for ( int i=m_ux-m_lx+1 ; i-- ;  )  if ( m_v[i] ) m_v[i]->trim();
+    m_dense   = false;
+
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+
+      // trim each row down
+      for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+
+	int r = i*m_Ny+j;
+
+	int zmin = m_zlo[r];
+	int zmax = m_zhi[r];
+
+	// offset of element z=0 of the row
+	int o = m_offset[r]-m_zlo[r]*m_Nw;
+
+	for ( ; zmin<zmax+1 && zeronode(o+zmin*m_Nw) ; zmin++ ) { }
+	for ( ; zmin<zmax   && zeronode(o+zmax*m_Nw) ; zmax-- ) { }
+
+	// the unused elements will be removed when the arena is compacted
+	if ( zmin<=zmax ) m_offset[r] += (zmin-m_zlo[r])*m_Nw;
 
+	m_zlo[r] = zmin;
+	m_zhi[r] = zmax;
+      }
+
+      // now find new limits for the rows
+      int ymin = m_ylo[i];
+      int ymax = m_yhi[i];
+
+      for ( ; ymin<ymax+1 && rowsize(i,ymin)==0 ; ymin++ ) { }
+      for ( ; ymin<ymax   && rowsize(i,ymax)==0 ; ymax-- ) { }
+
+      m_ylo[i] = ymin;
+      m_yhi[i] = ymax;
+    }
+
+    // and for the x bins
     int xmin = m_lx;
     int xmax = m_ux;
-    
-    // now find new limits
-    for ( ; xmin<xmax+1 && (*m_v[xmin-m_lx])==0 ; xmin++ )  delete m_v[xmin-m_lx];
-    for ( ; xmin<xmax   && (*m_v[xmax-m_lx])==0 ; xmax-- )  delete m_v[xmax-m_lx];
-   
-    // don't need to change anything
-    if ( xmin==m_lx && xmax==m_ux ) return; 
-
-    // trimmed matrix is empty
-    if ( xmax<xmin ) { 
-      m_lx = xmin;   m_ux = xmax;
-      delete[] m_v;  m_v = NULL;
-      return; 
-    }
 
-    // copy to trimmed matrix (there must be a better way to do this)
-    tsparse2d<T>** m_vnew = new tsparse2d<T>*[xmax-xmin+1]; 
-    tsparse2d<T>** mnp = m_vnew;
-    tsparse2d<T>** mvp = m_v+xmin-m_lx;
-    for ( int j=xmin ; j<=xmax ; j++ )  (*mnp++) = (*mvp++);
-    delete[] m_v;
+    for ( ; xmin<xmax+1 && planesize(xmin)==0 ; xmin++ ) { }
+    for ( ; xmin<xmax   && planesize(xmax)==0 ; xmax-- ) { }
 
-    // update the sparse data and corresponding limits 
     m_lx = xmin;
     m_ux = xmax;
-    m_v  = m_vnew;
+
+    // copy the remaining elements into a new, contiguous, arena
+    compact();
+  }
+
+
+  void untrim() {
+
+    unmap();
+
+    m_trimmed = false;
+
+    if ( m_dense ) return;
+
+    // copy everything into a new arena with all elements present
+    std::vector<T> arena( m_Nx*m_Ny*m_Nz*m_Nw, T(0) );
+
+    if ( m_ylo.size() ) {
+      for ( int i=m_lx ; i<=m_ux ; i++ ) {
+	for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+	  int r = i*m_Ny+j;
+	  int n = (m_zhi[r]-m_zlo[r]+1)*m_Nw;
+	  for ( int k=0 ; k<n ; k++ ) arena[(r*m_Nz+m_zlo[r])*m_Nw+k] = m_arena[m_offset[r]+k];
+	}
+      }
+    }
+
+    m_arena.swap( arena );
+
+    m_ylo.assign( m_Nx, 0 );
+    m_yhi.assign( m_Nx, m_Ny-1 );
+
+    m_zlo.assign( m_Nx*m_Ny, 0 );
+    m_zhi.assign( m_Nx*m_Ny, m_Nz-1 );
+
+    m_offset.resize( m_Nx*m_Ny );
+    for ( int r=0 ; r<m_Nx*m_Ny ; r++ ) m_offset[r] = r*m_Nz*m_Nw;
+
+    m_clo.assign( m_Nx*m_Ny, 0 );
+    m_chi.assign( m_Nx*m_Ny, m_Nz-1 );
+
+    m_lx = 0;
+    m_ux = m_Nx-1;
+
+    m_garbage = 0;
+    m_dense   = true;
   }
 
+  // remove all the elements, and release the tables of the occupied 
+  // ranges - the elements are created again as they are filled
+  void clear() {
+    m_mapped  = NULL;
+    m_nmapped = 0;
+    std::vector<T>().swap( m_arena );
+    std::vector<int>().swap( m_ylo );
+    std::vector<int>().swap( m_yhi );
+    std::vector<int>().swap( m_zlo );
+    std::vector<int>().swap( m_zhi );
+    std::vector<int>().swap( m_offset );
+    std::vector<int>().swap( m_clo );
+    std::vector<int>().swap( m_chi );
+
+    m_lx = 0;
+    m_ux = -1;
 
-  void untrim() { 
+    m_garbage = 0;
+    m_dense   = false;
     m_trimmed = false;
-    grow(0);
-    grow(Nx()-1);
-    tsparse2d<T>** mvp = m_v;
-    for ( int i=m_lx ; i<=m_ux ; i++ ) (*mvp++)->untrim();
   }
-  
+
   bool trimmed() const { return m_trimmed; }
 
-  bool trimmed(int i, int j, int k) const { 
+  bool trimmed(int i, int j, int k) const {
     if ( i<m_lx || i>m_ux ) return false;
-    else                    return m_v[i-m_lx]->trimmed(j,k);
-  } 
+    if ( j<m_ylo[i] || j>m_yhi[i] ) return false;
+    int r = i*m_Ny+j;
+    return ( k<m_zlo[r] || k>m_zhi[r] ? false : true );
+  }
 
 
   T operator()(int i, int j, int k) const {
     //  range_check(i);
     if ( i<m_lx || i>m_ux ) return 0;
-    return (*((const tsparse2d<T>** const)m_v)[i-m_lx])(j,k);
-  } 
-
+    if ( j<m_ylo[i] || j>m_yhi[i] ) return 0;
+    int r = i*m_Ny+j;
+    if ( k<m_zlo[r] || k>m_zhi[r] ) return 0;
+    return values()[m_offset[r]+(k-m_zlo[r])*m_Nw];
+  }
 
-  const tsparse2d<T>* operator[](int i) const {
-    // range_check(i);
-    if ( i<m_lx || i>m_ux ) return NULL;
-    return m_v[i-m_lx];
-  } 
-  
 
   T& operator()(int i, int j, int k) {
     // range_check(i);
-    grow(i);
-    return (*m_v[i-m_lx])(j,k);
-  } 
-
-  int size() const { 
-    int N=0;
-    for ( int i=m_ux-m_lx+1 ; i-- ; )  N += m_v[i]->size();
-    return N; // +3*sizeof(int);
+    return *node(i,j,k);
   }
 
-#if 0
-  void setup_fast() { 
-    // set up fast lookup table into the (untrimmed) 3d array.
-    m_fastindex = new T*[Nx()*Ny()*Nz()];
+  // all the values for node (i,j,k), or NULL if it is not occupied
+  const T* node(int i, int j, int k) const {
+    if ( i<m_lx || i>m_ux ) return NULL;
+    if ( j<m_ylo[i] || j>m_yhi[i] ) return NULL;
+    int r = i*m_Ny+j;
+    if ( k<m_zlo[r] || k>m_zhi[r] ) return NULL;
+    return values()+m_offset[r]+(k-m_zlo[r])*m_Nw;
+  }
 
-    for ( int i=0 ; i<Nx() ; i++ ) { 
-      for ( int j=0 ; j<Ny() ; j++ ) { 
-	for ( int k=0 ; k<Nz() ; k++ ) { 
-	  m_fastindex[(i*Ny()+j)*Nz()+k] = &(m_v[i]->v()[j])->v()[k];
-	}
-      }
-    }
+  // all the values for node (i,j,k), creating it if need be
+  T* node(int i, int j, int k) {
+    if ( m_mapped ) unmap();
+    if ( i<m_lx || i>m_ux ) grow(i);
+    if ( j<m_ylo[i] || j>m_yhi[i] ) growy(i,j);
+    int r = i*m_Ny+j;
+    if ( k<m_zlo[r] || k>m_zhi[r] ) growz(r,k);
+    return &m_arena[m_offset[r]+(k-m_zlo[r])*m_Nw];
   }
-  
-  
-  void empty_fast() { 
-    if ( m_fastindex ) delete[] m_fastindex;
-    m_fastindex=NULL;
+
+  // the total number of values, Nw for each occupied node
+  int size() const {
+    int N=0;
+    for ( int i=m_ux ; i>=m_lx ; i-- )  N += planesize(i);
+    return N*m_Nw; // +3*sizeof(int);
   }
-  
-  T& fill_fast(int i, int j, int k) { 
-    return *m_fastindex[(i*Ny()+j)*Nz()+k];
+
+  // the heap memory allocated for the values and the row 
+  // tables, in bytes, and the number of separate allocations
+  size_t bytes() const { 
+    return m_arena.capacity()*sizeof(T) + 
+      ( m_ylo.capacity() + m_yhi.capacity() + m_zlo.capacity() + m_zhi.capacity() + 
+	m_offset.capacity() + m_clo.capacity() + m_chi.capacity() )*sizeof(int);
   }
 
-  T fill_fast(int i, int j, int k) const { 
-    return *m_fastindex[(i*Ny()+j)*Nz()+k];
+  int allocations() const { 
+    return ( m_arena.capacity() ? 1 : 0 ) + 
+      ( m_ylo.capacity() ? 1 : 0 ) + ( m_yhi.capacity() ? 1 : 0 ) + 
+      ( m_zlo.capacity() ? 1 : 0 ) + ( m_zhi.capacity() ? 1 : 0 ) + ( m_offset.capacity() ? 1 : 0 ) + 
+      ( m_clo.capacity() ? 1 : 0 ) + ( m_chi.capacity() ? 1 : 0 );
   }
-#endif
 
 
   void print() const {
     if ( m_ux-m_lx+1==0 ) std::cout << "-" << "\n";
-    else { 
-      for ( int i=0 ; i<Nx() ; i++ ) {     
-	if ( tsparse_base::trimmed(i) ) { 
-	  std::cout << "m_v[" << i << "]=" << m_v[i-m_lx] << "\n";
-	  if ( m_v[i-m_lx] ) m_v[i-m_lx]->print();
+    else {
+      for ( int i=0 ; i<Nx() ; i++ ) {
+	if ( tsparse_base::trimmed(i) ) {
+	  std::cout << "m_v[" << i << "]=" << planesize(i) << "\n";
+	  std::cout << "\t\t+";
+	  for ( int k=0 ; k<Nz() ; k++ ) std::cout << "--";
+	  std::cout << "+\n";
+	  for ( int j=0 ; j<Ny() ; j++ ) {
+	    std::cout << std::setw(9) << ( j<m_ylo[i] || j>m_yhi[i] ? 0 : 1 ) << "\t|";
+	    for ( int k=0 ; k<Nz() ; k++ ) {
+	      if      ( trimmed(i,j,k) ) std::cout << "oo";
+	      else if ( j==k )           std::cout << ". ";
+	      else                       std::cout << "  ";
+	    }
+	    std::cout << "|\n";
+	  }
+	  std::cout << "\t\t+";
+	  for ( int k=0 ; k<Nz() ; k++ ) std::cout << "--";
+	  std::cout << "+\n";
 	}
 	else {
-	  std::cout << "- \t"; 
+	  std::cout << "- \t";
 	}
 	std::cout << "\n";
       }
     }
-  }  
+  }
 
-  int ymin() { 
+  int ymin() {
     int minx = m_Ny;
-    tsparse2d<T>** mvp = m_v;
-    for ( int i=m_lx ; i<=m_ux ; i++ ) { 
-      int _minx=(*mvp++)->xmin();
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      int _minx=m_ylo[i];
       if ( _minx<minx ) minx=_minx;
     }
     return minx;
   }
 
-  int ymax() { 
+  int ymax() {
     int maxx = -1;
-    tsparse2d<T>** mvp = m_v;
-    for ( int i=m_lx ; i<=m_ux ; i++ ) { 
-      int _minx=(*mvp)->xmin();
-      int _maxx=(*mvp++)->xmax();
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      int _minx=m_ylo[i];
+      int _maxx=m_yhi[i];
       if ( _minx<=_maxx && _maxx>maxx ) maxx=_maxx;
     }
     if ( maxx==-1 ) maxx=m_Ny-1;
@@ -212,22 +443,20 @@ public:
   }
 
 
-  int zmin() { 
+  int zmin() {
     int minx = m_Nz;
-    tsparse2d<T>** mvp = m_v;
-    for ( int i=m_lx ; i<=m_ux ; i++ ) { 
-      int _minx=(*mvp++)->ymin();
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      int _minx=planezmin(i);
       if ( _minx<minx ) minx=_minx;
     }
     return minx;
   }
 
-  int zmax() { 
+  int zmax() {
     int maxx = -1;
-    tsparse2d<T>** mvp = m_v;
-    for ( int i=m_lx ; i<=m_ux ; i++ ) { 
-      int _minx=(*mvp)->ymin();
-      int _maxx=(*mvp++)->ymax();
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      int _minx=planezmin(i);
+      int _maxx=planezmax(i);
       if ( _minx<=_maxx && _maxx>maxx ) maxx=_maxx;
     }
     if ( maxx==-1 ) maxx=m_Nz-1;
@@ -237,112 +466,450 @@ public:
 
   // algebraic operators
 
-  tsparse3d& operator=(const tsparse3d& t) { 
-    // clearout what is already in the matrix 
-    if ( m_v ) { 
-      for ( int i=m_ux-m_lx+1 ; i-- ; )  if ( m_v[i] ) delete m_v[i];
-      delete[] m_v;
-      m_v = NULL;
-    }
+  tsparse3d& operator=(const tsparse3d& t) {
 
-    m_trimmed = t.m_trimmed;
+    if ( this==&t ) return *this;
 
-    // now copy everything else
     m_Nx = t.m_Nx;
     m_Ny = t.m_Ny;
-    m_Nz = t.m_Nz;    
+    m_Nz = t.m_Nz;
+    m_Nw = t.m_Nw;
 
-    m_lx = 0;
-    m_ux = m_Nx-1;
-    m_v = new tsparse2d<T>*[m_Nx];
-    for ( int i=0 ; i<m_Nx ; i++ ) m_v[i] = new tsparse2d<T>(m_Ny, m_Nz);
-    //   setup_fast();
-    // deep copy of all elements
-    for ( int i=0 ; i<m_Nx ; i++ ) {
-      for ( int j=0 ; j<m_Ny ; j++ ) {
-	for ( int k=0 ; k<m_Nz ; k++ ) (*this)(i,j,k) = t(i,j,k);
-      }
-    }    
-    if ( m_trimmed ) trim();
-  }
-  
-  
-  tsparse3d& operator*=(const double& d) { 
-    for ( int i=0 ; i<Nx() ; i++ ) {     
-      if ( tsparse_base::trimmed(i) ) { 
-	if ( m_v[i-m_lx] ) (*m_v[i-m_lx])*=d;
+    copy(t);
+
+    return *this;
+  }
+
+
+  tsparse3d& operator*=(const double& d) {
+    unmap();
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+	int r = i*m_Ny+j;
+	int n = (m_zhi[r]-m_zlo[r]+1)*m_Nw;
+	for ( int k=m_offset[r] ; k<m_offset[r]+n ; k++ ) if ( m_arena[k] ) m_arena[k] *= d;
       }
     }
     return *this;
   }
-  
-  
+
+
+  // only the occupied rows of t are added, with the corresponding 
+  // rows of this matrix grown to include them if need be
   tsparse3d& operator+=(const tsparse3d& t) {
+    unmap();
     m_trimmed = false;
-    if ( Nx()!=t.Nx() || Ny()!=t.Ny() || Nz()!=t.Nz() ) throw out_of_range("bin mismatch");
-    for ( int i=0 ; i<Nx() ; i++ ) {
-      for ( int j=0 ; j<Ny() ; j++ ) {
-	for ( int k=0 ; k<Nz() ; k++ ) (*this)(i,j,k) += t(i,j,k);
+    if ( Nx()!=t.Nx() || Ny()!=t.Ny() || Nz()!=t.Nz() || Nw()!=t.Nw() ) throw out_of_range("bin mismatch");
+    for ( int i=t.m_lx ; i<=t.m_ux ; i++ ) {
+      for ( int j=t.m_ylo[i] ; j<=t.m_yhi[i] ; j++ ) {
+	int r = i*m_Ny+j;
+	if ( t.m_zlo[r]>t.m_zhi[r] ) continue;
+	node( i, j, t.m_zhi[r] );
+	T* v = node( i, j, t.m_zlo[r] );
+	const T* tv = t.row(i,j);
+	int n = (t.m_zhi[r]-t.m_zlo[r]+1)*m_Nw;
+	for ( int k=0 ; k<n ; k++ ) v[k] += tv[k];
       }
     }
     return *this;
   }
-  
+
+
+  // are all the elements the same - only the occupied 
+  // elements of each matrix need be compared
+  bool operator==(const tsparse3d& t) const {
+    if ( Nx()!=t.Nx() || Ny()!=t.Ny() || Nz()!=t.Nz() || Nw()!=t.Nw() ) return false;
+    return ( matches(t) && t.matches(*this) );
+  }
+
+  bool operator!=(const tsparse3d& t) const { return !( *this==t ); }
+
+
+protected:
+
+  // the full, untrimmed, arena with element (i,j,k) at ((i*Ny+j)*Nz+k)*Nw,
+  // or NULL if the matrix has been trimmed since it was last untrimmed
+  T* dense() { return ( m_dense && m_arena.size() ? &m_arena[0] : NULL ); }
 
 private:
-  
-  void grow(int i) { 
-     
-    // nothing needs to be done; 
+
+  // the values in use, either the arena or the values used in place
+  const T* values() const { return ( m_mapped ? m_mapped : m_arena.size() ? &m_arena[0] : NULL ); }
+
+  // copy the values used in place into the arena, before any change
+  void unmap() {
+    if ( m_mapped==NULL ) return;
+    m_arena.assign( m_mapped, m_mapped+m_nmapped );
+    m_mapped  = NULL;
+    m_nmapped = 0;
+  }
+
+  // are all the values of the node at offset o zero
+  bool zeronode(int o) const {
+    const T* v = values()+o;
+    for ( int w=0 ; w<m_Nw ; w++ ) if ( v[w]!=0 ) return false;
+    return true;
+  }
+
+  // copy the occupied elements of t - if t is trimmed, only the non-zero 
+  // range of each row is copied, giving the same structure as copying 
+  // all the elements and then trimming, otherwise the storage is copied 
+  // as it is, so a full untrimmed matrix is copied in full
+  void copy(const tsparse3d& t) {
+
+    m_mapped  = NULL;
+    m_nmapped = 0;
+
+    m_lx = t.m_lx;
+    m_ux = t.m_ux;
+
+    if ( !t.m_trimmed ) {
+      m_arena   = t.m_arena;
+      m_ylo     = t.m_ylo;
+      m_yhi     = t.m_yhi;
+      m_zlo     = t.m_zlo;
+      m_zhi     = t.m_zhi;
+      m_offset  = t.m_offset;
+      m_clo     = t.m_clo;
+      m_chi     = t.m_chi;
+      m_garbage = t.m_garbage;
+      m_dense   = t.m_dense;
+      m_trimmed = false;
+      return;
+    }
+
+    std::vector<T>().swap( m_arena );
+    m_arena.reserve( t.size() );
+
+    m_ylo.assign( m_Nx, m_Ny );
+    m_yhi.assign( m_Nx, m_Ny-1 );
+
+    m_zlo.assign( m_Nx*m_Ny, m_Nz );
+    m_zhi.assign( m_Nx*m_Ny, m_Nz-1 );
+    m_offset.assign( m_Nx*m_Ny, 0 );
+    m_clo.assign( m_Nx*m_Ny, m_Nz );
+    m_chi.assign( m_Nx*m_Ny, m_Nz-1 );
+
+    m_lx = m_Nx;
+    m_ux = m_Nx-1;
+
+    for ( int i=t.m_lx ; i<=t.m_ux ; i++ ) {
+      for ( int j=t.m_ylo[i] ; j<=t.m_yhi[i] ; j++ ) {
+
+	int r = i*m_Ny+j;
+
+	int zmin = t.m_zlo[r];
+	int zmax = t.m_zhi[r];
+
+	// offset of element z=0 of the row
+	int o = t.m_offset[r]-t.m_zlo[r]*m_Nw;
+
+	for ( ; zmin<zmax+1 && t.zeronode(o+zmin*m_Nw) ; zmin++ ) { }
+	for ( ; zmin<zmax   && t.zeronode(o+zmax*m_Nw) ; zmax-- ) { }
+
+	if ( zmin>zmax ) continue;
+
+	m_zlo[r]    = zmin;
+	m_zhi[r]    = zmax;
+	m_clo[r]    = zmin;
+	m_chi[r]    = zmax;
+	m_offset[r] = m_arena.size();
+
+	const T* tv = t.values()+o;
+	m_arena.insert( m_arena.end(), tv+zmin*m_Nw, tv+(zmax+1)*m_Nw );
+
+	if ( m_ylo[i]>m_yhi[i] ) m_ylo[i] = j;
+	m_yhi[i] = j;
+
+	if ( m_lx>m_ux ) m_lx = i;
+	m_ux = i;
+      }
+    }
+
+    m_garbage = 0;
+    m_dense   = false;
+    m_trimmed = true;
+  }
+
+  // do all the occupied elements of this matrix match those of t
+  bool matches(const tsparse3d& t) const {
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+	const T* v = row(i,j);
+	for ( int k=zlo(i,j) ; k<=zhi(i,j) ; k++, v+=m_Nw ) {
+	  const T* tv = t.node(i,j,k);
+	  for ( int w=0 ; w<m_Nw ; w++ ) if ( v[w]!=( tv ? tv[w] : T(0) ) ) return false;
+	}
+      }
+    }
+    return true;
+  }
+
+  int rowsize(int i, int j) const {
+    int r = i*m_Ny+j;
+    return m_zhi[r]-m_zlo[r]+1;
+  }
+
+  int planesize(int i) const {
+    int N=0;
+    for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) N += rowsize(i,j);
+    return N;
+  }
+
+  // minimum and maximum occupied z in x bin i, as for tsparse2d::ymin() etc
+  int planezmin(int i) const {
+    int minx = m_Nz;
+    for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+      int _minx=m_zlo[i*m_Ny+j];
+      if ( _minx<=minx ) minx=_minx;
+    }
+    return minx;
+  }
+
+  int planezmax(int i) const {
+    int maxx = -1;
+    for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+      int r = i*m_Ny+j;
+      if ( m_zlo[r]<=m_zhi[r] && m_zhi[r]>maxx ) maxx=m_zhi[r];
+    }
+    if ( maxx==-1 ) maxx=m_Nz-1;
+    return maxx;
+  }
+
+
+  // grow the occupied x range to include bin i, new x bins are empty
+  void grow(int i) {
+
+    // nothing needs to be done;
     if ( i>=m_lx && i<=m_ux ) return;
 
-    // is it empty? add a single row
-    if ( m_lx>m_ux ) { 
-      m_v    = new tsparse2d<T>*[1];
-      (*m_v) = new tsparse2d<T>(m_Ny, m_Nz, m_Ny, m_Nz, 0, 0);
+    // is it empty? add a single x bin
+    if ( m_lx>m_ux ) {
+      // the range tables are released by clear()
+      if ( m_ylo.empty() ) {
+	m_ylo.resize( m_Nx );
+	m_yhi.resize( m_Nx );
+	m_zlo.resize( m_Nx*m_Ny );
+	m_zhi.resize( m_Nx*m_Ny );
+	m_offset.resize( m_Nx*m_Ny );
+	m_clo.resize( m_Nx*m_Ny );
+	m_chi.resize( m_Nx*m_Ny );
+      }
       m_lx = m_ux = i;
+      clearplane(i);
       return;
     }
-    
-    tsparse2d<T>** newv = new tsparse2d<T>*[ ( i<m_lx ? m_ux-i+1 : i-m_lx+1 ) ];
-    tsparse2d<T>** newp = newv;
-    tsparse2d<T>** mvp  = m_v;
-
-    int lx = m_lx;
-    int ux = m_ux;
 
     // grow at front
-    for ( ; m_lx>i ; m_lx-- )  (*newp++) = new tsparse2d<T>(m_Ny, m_Nz, m_Ny, m_Nz, 0, 0);
-    // copy existing
-    for ( ; lx<=ux ; lx++ )    (*newp++) = (*mvp++);
+    for ( ; m_lx>i ; ) clearplane(--m_lx);
     // grow at back
-    for ( ; m_ux<i ; m_ux++ )  (*newp++) = new tsparse2d<T>(m_Ny, m_Nz, m_Ny, m_Nz, 0, 0);
+    for ( ; m_ux<i ; ) clearplane(++m_ux);
+  }
 
-    delete[] m_v;
-    m_v = newv;
+  // grow the occupied y range of x bin i to include j, new rows are empty
+  void growy(int i, int j) {
+
+    if ( j>=m_ylo[i] && j<=m_yhi[i] ) return;
+
+    if ( m_ylo[i]>m_yhi[i] ) {
+      m_ylo[i] = m_yhi[i] = j;
+      clearrow(i*m_Ny+j);
+      return;
+    }
+
+    for ( ; m_ylo[i]>j ; ) clearrow(i*m_Ny + --m_ylo[i]);
+    for ( ; m_yhi[i]<j ; ) clearrow(i*m_Ny + ++m_yhi[i]);
+  }
+
+  // grow the occupied range of row r to include k, moving the row to the 
+  // end of the arena if it has outgrown the space reserved for it
+  void growz(int r, int k) {
+
+    if ( k>=m_zlo[r] && k<=m_zhi[r] ) return;
+
+    int zlo = k;
+    int zhi = k;
+    if ( m_zlo[r]<=m_zhi[r] ) {
+      if ( m_zlo[r]<zlo ) zlo = m_zlo[r];
+      if ( m_zhi[r]>zhi ) zhi = m_zhi[r];
+    }
+
+    // start of the space reserved for the row
+    int start = m_offset[r]-(m_zlo[r]-m_clo[r])*m_Nw;
+
+    if ( zlo<m_clo[r] || zhi>m_chi[r] ) {
+
+      // reserve twice the space, extending it in the direction of growth
+      int w = 2*(m_chi[r]-m_clo[r]+1);
+      if ( w<zhi-zlo+1 ) w = zhi-zlo+1;
+      if ( w>m_Nz )      w = m_Nz;
+
+      int clo;
+      int chi;
+      if ( k==zhi ) {
+	clo = zlo;
+	chi = clo+w-1;
+	if ( chi>m_Nz-1 ) { chi = m_Nz-1; clo = chi-w+1; }
+      }
+      else {
+	chi = zhi;
+	clo = chi-w+1;
+	if ( clo<0 ) { clo = 0; chi = w-1; }
+      }
+
+      int full = m_Nx*m_Ny*m_Nz*m_Nw;
+
+      // never use much more space than the full grid would - once a matrix 
+      // being filled from scratch is half full it is simply given the full 
+      // grid, otherwise the reserved space is released and the row only 
+      // gets what it needs
+      if ( !m_trimmed && 2*(int(m_arena.size())-m_garbage+w*m_Nw) > full ) { 
+	untrim();
+	return;
+      }
+
+      if ( int(m_arena.size())-m_garbage+w*m_Nw > full ) {
+	compact();
+	w   = zhi-zlo+1;
+	clo = zlo;
+	chi = zhi;
+      }
+
+      m_dense = false;
+
+      int base = m_arena.size();
+
+      // don't let the arena itself grow much beyond the full grid - near 
+      // the full size, reuse the abandoned space rather than growing 
+      if ( base+w*m_Nw > int(m_arena.capacity()) ) { 
+	int capacity = 2*m_arena.capacity();
+	if ( capacity>full ) { 
+	  capacity = full;
+	  if ( 8*m_garbage>int(m_arena.capacity()) ) { 
+	    compact( true );
+	    base = m_arena.size();
+	  }
+	}
+	if ( capacity<base+w*m_Nw ) capacity = base+w*m_Nw+(base+w*m_Nw)/8;
+	if ( capacity>int(m_arena.capacity()) ) m_arena.reserve( capacity );
+      }
+
+      m_arena.resize( base+w*m_Nw, T(0) );
+
+      if ( m_zlo[r]<=m_zhi[r] ) {
+	int n = (m_zhi[r]-m_zlo[r]+1)*m_Nw;
+	for ( int i=0 ; i<n ; i++ ) m_arena[base+(m_zlo[r]-clo)*m_Nw+i] = m_arena[m_offset[r]+i];
+	m_garbage += (m_chi[r]-m_clo[r]+1)*m_Nw;
+      }
+
+      start    = base;
+      m_clo[r] = clo;
+      m_chi[r] = chi;
+    }
+
+    m_zlo[r]    = zlo;
+    m_zhi[r]    = zhi;
+    m_offset[r] = start+(zlo-m_clo[r])*m_Nw;
+
+    // don't let the abandoned space grow without limit
+    if ( m_garbage>1024 && 2*m_garbage>int(m_arena.size()) ) compact( true );
+  }
+
+  void clearplane(int i) {
+    m_ylo[i] = m_Ny;
+    m_yhi[i] = m_Ny-1;
+  }
+
+  void clearrow(int r) {
+    m_zlo[r]    = m_Nz;
+    m_zhi[r]    = m_Nz-1;
+    m_offset[r] = 0;
+    m_clo[r]    = m_Nz;
+    m_chi[r]    = m_Nz-1;
+  }
+
+  // copy all the occupied rows, in order, into a new arena with no
+  // unused space - unless the rows are to keep the space reserved for
+  // them, in which case only the abandoned space is removed
+  void compact( bool keepreserved=false ) {
+
+    std::vector<T> arena;
+    arena.reserve( keepreserved ? m_arena.size()-m_garbage : size() );
+
+    for ( int i=m_lx ; i<=m_ux ; i++ ) {
+      for ( int j=m_ylo[i] ; j<=m_yhi[i] ; j++ ) {
+	int r = i*m_Ny+j;
+	int offset = arena.size();
+	if ( keepreserved && m_clo[r]<=m_chi[r] ) {
+	  int start = m_offset[r]-(m_zlo[r]-m_clo[r])*m_Nw;
+	  arena.insert( arena.end(), m_arena.begin()+start, m_arena.begin()+start+(m_chi[r]-m_clo[r]+1)*m_Nw );
+	  m_offset[r] = offset+(m_zlo[r]-m_clo[r])*m_Nw;
+	  continue;
+	}
+	if ( m_zlo[r]<=m_zhi[r] ) { 
+	  arena.insert( arena.end(), m_arena.begin()+m_offset[r], m_arena.begin()+m_offset[r]+(m_zhi[r]-m_zlo[r]+1)*m_Nw );
+	  m_clo[r] = m_zlo[r];
+	  m_chi[r] = m_zhi[r];
+	}
+	else { 
+	  m_clo[r] = m_Nz;
+	  m_chi[r] = m_Nz-1;
+	}
+	m_offset[r] = offset;
+      }
+    }
+
+    m_arena.swap( arena );
+    m_garbage = 0;
   }
 
 
 protected:
-  
+
   int m_Ny;
   int m_Nz;
-  
-  tsparse2d<T>**  m_v;
-  
-  //  T** m_fastindex;
-  
+
+  // number of values at each node
+  int m_Nw;
+
+  // all the elements
+  std::vector<T>   m_arena;
+
+  // or the values used in place, and their number
+  const T*         m_mapped;
+  int              m_nmapped;
+
+  // occupied y range for each x bin
+  std::vector<int> m_ylo;
+  std::vector<int> m_yhi;
+
+  // occupied z range, and offset into the arena, for each (x,y) row
+  std::vector<int> m_zlo;
+  std::vector<int> m_zhi;
+  std::vector<int> m_offset;
+
+  // range in z of the space reserved for each row, which includes the 
+  // occupied range, with any unoccupied elements in it set to zero
+  std::vector<int> m_clo;
+  std::vector<int> m_chi;
+
+  // elements in the arena no longer used by any row
+  int  m_garbage;
+
+  // are all the elements present, in order
+  bool m_dense;
+
   bool m_trimmed;
 
 };
 
 
 // stream IO template
-template<class T> std::ostream& operator<<(std::ostream& s, const tsparse3d<T>& sp) { 
-  for ( int i=0 ; i<sp.Nx() ; i++ ) { 
-    for ( int j=0 ; j<sp.Ny() ; j++ ) { 
-      for ( int k=0 ; k<sp.Nz() ; k++ ) { 
-	s << sp(i,j,k) << "\t"; 
+template<class T> std::ostream& operator<<(std::ostream& s, const tsparse3d<T>& sp) {
+  for ( int i=0 ; i<sp.Nx() ; i++ ) {
+    for ( int j=0 ; j<sp.Ny() ; j++ ) {
+      for ( int k=0 ; k<sp.Nz() ; k++ ) {
+	s << sp(i,j,k) << "\t";
       }
       s << "\n";
     }
@@ -352,7 +919,7 @@ template<class T> std::ostream& operator<<(std::ostream& s, const tsparse3d<T>&
 }
 
 
-#endif  // __TSPARSE3D_H 
+#endif  // __TSPARSE3D_H
 
 
 